@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../utils/promise.h"
+#include "../net/socket_profile.h"
 
 namespace Sari { namespace Asio {
 
@@ -173,6 +174,79 @@ namespace Sari { namespace Asio {
 		);
 	}
 
+	// Connects the socket to the first of the endpoints which accepts, e.g. the ones of a resolver
+	// left after some have been filtered out. The endpoints are copied.
+	template<typename Socket, typename EndpointSequence>
+	Utils::Promise AsyncConnectSequence(Socket& socket, const EndpointSequence& endpoints)
+	{
+		return Utils::Promise(
+			socket.get_executor(),
+			[&](Utils::AnyFunction resolve, Utils::AnyFunction reject) {
+				boost::asio::async_connect(socket, endpoints, [=](const boost::system::error_code& ec, const typename Socket::endpoint_type&) {
+					if (ec) {
+						reject(ec);
+					}
+					else {
+						resolve();
+					}
+				});
+			},
+			Utils::Promise::Async
+		);
+	}
+
+	// Connects the socket and sets the options of the profile. The socket is opened first if needed,
+	// so that the options which must precede the handshake (buffer sizes, fast open) take effect.
+	template<typename Socket>
+	Utils::Promise AsyncConnect(Socket& socket, const typename Socket::endpoint_type& endpoint, const Net::SocketProfile& profile)
+	{
+		if (!socket.is_open()) {
+			boost::system::error_code ec;
+
+			socket.open(endpoint.protocol(), ec);
+
+			if (ec) {
+				return Utils::Promise::Reject(socket.get_executor(), ec);
+			}
+		}
+
+		profile.applyBeforeConnect(socket);
+
+		return AsyncConnect(socket, endpoint)
+			.then([&socket, profile]() {
+				profile.applyAfterConnect(socket);
+			});
+	}
+
+	// Tries to connect the socket to the endpoints one by one and sets the options of the profile
+	// before and after each attempt.
+	template<typename Socket, typename Iterator>
+	Utils::Promise AsyncConnectEndpoints(Socket& socket, Iterator it, const Net::SocketProfile& profile)
+	{
+		if (it == Iterator()) {
+			return Utils::Promise::Reject(socket.get_executor(), make_error_code(boost::asio::error::host_not_found));
+		}
+
+		typename Socket::endpoint_type endpoint = *it;
+
+		boost::system::error_code ec;
+		socket.close(ec);
+
+		Utils::Promise promise = AsyncConnect(socket, endpoint, profile);
+
+		return Utils::Promise::AllSettled(socket.get_executor(), { promise })
+			.then([&socket, it, profile](Utils::Promise p) {
+
+				if (p.isFulfilled() || std::next(it) == Iterator()) {
+					return p.isFulfilled()
+						? Utils::Promise::Resolve(p.getExecutor())
+						: Utils::Promise::Reject(p.getExecutor(), p.result());
+				}
+
+				return AsyncConnectEndpoints(socket, std::next(it), profile);
+			});
+	}
+
     /**
      * Adds a timeout constraint to a Utils::Promise.
      *
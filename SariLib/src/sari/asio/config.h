@@ -0,0 +1,76 @@
+#pragma once
+
+// Build configuration of the I/O stack.
+//
+// SARI_USE_IO_URING
+//   Runs all I/O of the io_context on Linux through io_uring instead of epoll. It requires
+//   Boost 1.78 or newer and liburing (link with -luring). The macro changes the layout of
+//   Boost.Asio's types, so it must be defined for every translation unit of the program,
+//   preferably in the project settings (-DSARI_USE_IO_URING).
+//
+// SARI_HAS_REGISTERED_BUFFERS
+//   Defined by this header with SARI_USE_IO_URING and Boost 1.79 or newer, the blocks of a
+//   RegisteredBuffers pool are read and written with io_uring's fixed buffer operations.
+//
+// SARI_HAS_SPLICE
+//   Defined by this header on Linux, socket to socket relays move data with splice(2)
+//   without copying it to user space. Define SARI_DISABLE_SPLICE to turn it off.
+//
+// SARI_HAS_MMSG
+//   Defined by this header on Linux, UDP relays receive and send batches of datagrams with
+//   recvmmsg(2) and sendmmsg(2). Define SARI_DISABLE_MMSG to turn it off.
+
+#include <boost/version.hpp>
+
+#if defined(SARI_USE_IO_URING)
+
+#	if !defined(__linux__)
+#		error "SARI_USE_IO_URING is supported on Linux only"
+#	endif
+
+#	if BOOST_VERSION < 107800
+#		error "SARI_USE_IO_URING requires Boost 1.78 or newer"
+#	endif
+
+#	if defined(BOOST_ASIO_DETAIL_CONFIG_HPP) && !defined(BOOST_ASIO_HAS_IO_URING)
+#		error "Boost.Asio has been included before sari/asio/config.h without io_uring, define SARI_USE_IO_URING in the project settings"
+#	endif
+
+#	if !defined(BOOST_ASIO_HAS_IO_URING)
+#		define BOOST_ASIO_HAS_IO_URING 1
+#	endif
+
+	// Sockets and descriptors go through io_uring as well, not only files.
+#	if !defined(BOOST_ASIO_DISABLE_EPOLL)
+#		define BOOST_ASIO_DISABLE_EPOLL 1
+#	endif
+
+#	if BOOST_VERSION >= 107900
+#		define SARI_HAS_REGISTERED_BUFFERS 1
+#	endif
+
+#endif
+
+#if defined(__linux__) && !defined(SARI_DISABLE_SPLICE)
+#	define SARI_HAS_SPLICE 1
+#endif
+
+#if defined(__linux__) && !defined(SARI_DISABLE_MMSG)
+#	define SARI_HAS_MMSG 1
+#endif
+
+namespace Sari { namespace Asio {
+
+	// The name of the backend running the asynchronous operations.
+	constexpr const char* IoBackend =
+#if defined(SARI_USE_IO_URING)
+		"io_uring";
+#elif defined(_WIN32)
+		"iocp";
+#elif defined(__linux__)
+		"epoll";
+#else
+		"reactor";
+#endif
+
+}}
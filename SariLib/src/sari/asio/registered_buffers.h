@@ -0,0 +1,173 @@
+#pragma once
+
+#include "config.h"
+
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace Sari { namespace Asio {
+
+	// Blocks of memory registered with an io_context once, so the io_uring backend reads and
+	// writes them with the fixed buffer operations and the kernel does not map the pages of a
+	// buffer for every call. An io_context takes one registration at a time, so one pool serves
+	// all relays of the context. When the registration fails, e.g. above RLIMIT_MEMLOCK, the
+	// pool has no blocks and the relays use their ordinary buffers.
+	//
+	// The pool is destroyed after the io_context has stopped and before the io_context itself.
+	// Blocks released later, by the handlers the io_context destroys, are simply dropped.
+	class RegisteredBuffers {
+	private:
+		struct State;
+
+	public:
+
+		// A block borrowed from the pool, it is returned when destroyed.
+		class Block {
+		public:
+
+			Block() = default;
+
+			Block(Block&& other) noexcept :
+				state_(std::move(other.state_)),
+				index_(other.index_),
+				registered_(other.registered_)
+			{}
+
+			Block& operator= (Block&& other) noexcept
+			{
+				if (this != &other) {
+					reset();
+					state_ = std::move(other.state_);
+					index_ = other.index_;
+					registered_ = other.registered_;
+				}
+				return *this;
+			}
+
+			Block(const Block&) = delete;
+			Block& operator= (const Block&) = delete;
+
+			~Block()
+			{
+				reset();
+			}
+
+			char* data() const { return static_cast<char*>(registered_.data()); }
+			std::size_t size() const { return registered_.size(); }
+			explicit operator bool() const { return state_ != nullptr; }
+
+			// The part of the block from the offset as a registered buffer.
+			boost::asio::mutable_registered_buffer buffer(std::size_t offset, std::size_t length) const
+			{
+				return boost::asio::buffer(registered_ + offset, length);
+			}
+
+			void reset()
+			{
+				if (state_) {
+					std::lock_guard<std::mutex> lock(state_->mutex);
+					state_->free.push_back(index_);
+					state_.reset();
+				}
+			}
+
+		private:
+
+			friend class RegisteredBuffers;
+
+			Block(std::shared_ptr<State> state, std::size_t index, boost::asio::mutable_registered_buffer registered) :
+				state_(std::move(state)),
+				index_(index),
+				registered_(registered)
+			{}
+
+			std::shared_ptr<State> state_;
+			std::size_t index_ = 0;
+			boost::asio::mutable_registered_buffer registered_;
+
+		};
+
+		// Registers count blocks of blockSize bytes with the io_context.
+		RegisteredBuffers(boost::asio::io_context& ioContext, std::size_t count, std::size_t blockSize) :
+			state_(std::make_shared<State>())
+		{
+			state_->memory.reset(new char[count * blockSize]);
+
+			std::vector<boost::asio::mutable_buffer> blocks;
+
+			for (std::size_t i = 0; i < count; ++i) {
+				blocks.push_back(boost::asio::buffer(state_->memory.get() + i * blockSize, blockSize));
+			}
+
+			try {
+				registration_.emplace(boost::asio::register_buffers(ioContext, blocks));
+			}
+			catch (const boost::system::system_error&) {
+				return;
+			}
+
+			for (std::size_t i = count; i > 0; --i) {
+				state_->free.push_back(i - 1);
+			}
+		}
+
+		RegisteredBuffers(const RegisteredBuffers&) = delete;
+		RegisteredBuffers& operator= (const RegisteredBuffers&) = delete;
+
+		~RegisteredBuffers()
+		{
+			std::lock_guard<std::mutex> lock(state_->mutex);
+			// blocks released from now on are not handed out again
+			state_->free.clear();
+			state_->closed = true;
+		}
+
+		// Returns a free block, or an empty one when all blocks are borrowed.
+		Block acquire()
+		{
+			std::lock_guard<std::mutex> lock(state_->mutex);
+
+			if (state_->free.empty() || state_->closed) {
+				return Block();
+			}
+
+			std::size_t index = state_->free.back();
+			state_->free.pop_back();
+
+			return Block(state_, index, (*registration_)[index]);
+		}
+
+		// Whether the io_context has taken the registration.
+		bool registered() const
+		{
+			return registration_.has_value();
+		}
+
+	private:
+
+		using Registration = decltype(boost::asio::register_buffers(
+			std::declval<boost::asio::io_context&>(), std::declval<const std::vector<boost::asio::mutable_buffer>&>()
+		));
+
+		struct State {
+			std::mutex mutex;
+			std::unique_ptr<char[]> memory;
+			std::vector<std::size_t> free;
+			bool closed = false;
+		};
+
+		std::shared_ptr<State> state_;
+		std::optional<Registration> registration_;
+
+	};
+
+}}
+
+#endif
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+#include "server.h"
+
+namespace Sari { namespace Net {
+
+	// Runs a Net::Server on several threads, each of them with its own io_context.
+	//
+	// In the ReusePort mode every thread listens on the same port through its own SO_REUSEPORT
+	// acceptor and the kernel distributes new connections among them. In the RoundRobin mode
+	// a single acceptor runs on the first thread and hands accepted sockets to the threads in turn.
+	//
+	// The connection handler is called on the thread that owns the accepted socket, so any state
+	// it shares with other connections must be synchronized.
+	class MultiServer {
+	public:
+
+		enum class Mode {
+			ReusePort, RoundRobin
+		};
+
+		using ConnectionHandler = Server::ConnectionHandler;
+
+		// The ReusePort mode falls back to RoundRobin on platforms without SO_REUSEPORT.
+		// The socket profile is applied to the listening and all accepted sockets.
+		MultiServer(
+			unsigned short port, ConnectionHandler connectionHandler,
+			std::size_t numOfThreads = std::thread::hardware_concurrency(),
+			Mode mode = Mode::ReusePort,
+			const SocketProfile& socketProfile = SocketProfile{}
+		) :
+			mode_(ReusePortSupported ? mode : Mode::RoundRobin)
+		{
+			boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+
+			if (numOfThreads == 0) {
+				numOfThreads = 1;
+			}
+
+			for (std::size_t i = 0; i < numOfThreads; i++) {
+				auto ioContext = std::make_unique<boost::asio::io_context>(1);
+				workGuards_.emplace_back(boost::asio::make_work_guard(*ioContext));
+				ioContexts_.push_back(std::move(ioContext));
+			}
+
+			if (mode_ == Mode::ReusePort) {
+				for (auto& ioContext : ioContexts_) {
+					servers_.push_back(std::make_unique<Server>(
+						Listen(*ioContext, endpoint, socketProfile, true), connectionHandler
+					));
+					servers_.back()->setSocketProfile(socketProfile);
+					// The other acceptors must share the port even if the first one got an ephemeral port.
+					endpoint = servers_.back()->localEndpoint();
+				}
+			}
+			else {
+				auto dispatchingHandler = [connectionHandler](const boost::system::error_code& ec, boost::asio::ip::tcp::socket peer) {
+					if (ec) {
+						connectionHandler(ec, std::move(peer));
+						return;
+					}
+					// Continue on the thread the accepted socket belongs to.
+					auto executor = peer.get_executor();
+					boost::asio::post(executor, [connectionHandler, ec, peer = std::move(peer)]() mutable {
+						connectionHandler(ec, std::move(peer));
+					});
+				};
+
+				servers_.push_back(std::make_unique<Server>(
+					Listen(*ioContexts_[0], endpoint, socketProfile), dispatchingHandler,
+					[this]() {
+						// Called on the accepting thread only.
+						auto& ioContext = *ioContexts_[nextContext_];
+						nextContext_ = (nextContext_ + 1) % ioContexts_.size();
+						return ioContext.get_executor();
+					}
+				));
+				servers_.back()->setSocketProfile(socketProfile);
+			}
+		}
+
+		~MultiServer()
+		{
+			stop();
+			join();
+		}
+
+		Mode mode() const
+		{
+			return mode_;
+		}
+
+		std::size_t numOfThreads() const
+		{
+			return ioContexts_.size();
+		}
+
+		boost::asio::io_context& ioContext(std::size_t index)
+		{
+			return *ioContexts_.at(index);
+		}
+
+		boost::asio::ip::tcp::endpoint localEndpoint() const
+		{
+			return servers_.front()->localEndpoint();
+		}
+
+		// Starts one thread per io_context and returns immediately.
+		void start()
+		{
+			if (!threads_.empty()) {
+				return;
+			}
+
+			for (auto& ioContext : ioContexts_) {
+				threads_.emplace_back([&ioContext = *ioContext]() {
+					ioContext.run();
+				});
+			}
+		}
+
+		// Stops all io_contexts, the running threads return as soon as possible.
+		void stop()
+		{
+			for (auto& ioContext : ioContexts_) {
+				ioContext->stop();
+			}
+		}
+
+		// Waits until all threads return.
+		void join()
+		{
+			for (auto& thread : threads_) {
+				if (thread.joinable()) {
+					thread.join();
+				}
+			}
+
+			threads_.clear();
+		}
+
+		// Starts the threads and waits until they return.
+		void run()
+		{
+			start();
+			join();
+		}
+
+	private:
+
+		using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+		Mode mode_;
+		std::vector<std::unique_ptr<boost::asio::io_context>> ioContexts_;
+		std::vector<WorkGuard> workGuards_;
+		std::vector<std::unique_ptr<Server>> servers_;
+		std::vector<std::thread> threads_;
+		std::size_t nextContext_ = 0;
+
+	};
+
+}}
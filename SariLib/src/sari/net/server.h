@@ -1,40 +1,429 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include "../asio/config.h"
 #include <boost/asio.hpp>
 
+#include "socket_profile.h"
+
 namespace Sari { namespace Net {
 
-	class Server {
+#if defined(SO_REUSEPORT)
+	using ReusePortOption = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+	constexpr bool ReusePortSupported = true;
+#else
+	constexpr bool ReusePortSupported = false;
+#endif
+
+	// Opens an acceptor bound to the endpoint, sets the listener options of the profile
+	// and starts listening. SO_REUSEPORT is set on request where the platform supports it.
+	template<typename ExecutionContext, typename Endpoint>
+	typename Endpoint::protocol_type::acceptor Listen(
+		ExecutionContext& ioContext,
+		const Endpoint& endpoint,
+		const SocketProfile& profile = SocketProfile{},
+		bool reusePort = false
+	)
+	{
+		typename Endpoint::protocol_type::acceptor acceptor(ioContext);
+
+		acceptor.open(endpoint.protocol());
+		acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+
+#if defined(SO_REUSEPORT)
+		if (reusePort) {
+			// Must be set on every acceptor sharing the port before it is bound.
+			acceptor.set_option(ReusePortOption(true));
+		}
+#endif
+
+		profile.applyToListener(acceptor);
+
+		acceptor.bind(endpoint);
+		acceptor.listen();
+
+		return acceptor;
+	}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+	// Returns a Unix domain socket endpoint with a path in the file system.
+	inline boost::asio::local::stream_protocol::endpoint LocalEndpoint(const std::string& path)
+	{
+		return boost::asio::local::stream_protocol::endpoint(path);
+	}
+
+	// Returns a Unix domain socket endpoint in the Linux abstract namespace. Such sockets have
+	// no file system entry and vanish together with the last socket using the name.
+	inline boost::asio::local::stream_protocol::endpoint AbstractLocalEndpoint(const std::string& name)
+	{
+		return boost::asio::local::stream_protocol::endpoint(std::string(1, '\0') + name);
+	}
+
+#endif
+
+	// Accepts stream connections of the given protocol (TCP or a Unix domain socket)
+	// and passes them to a connection handler.
+	template<typename Protocol>
+	class BasicServer {
 	public:
 
+		using Socket = typename Protocol::socket;
+		using Acceptor = typename Protocol::acceptor;
+		using Endpoint = typename Protocol::endpoint;
+
 		using ConnectionHandler = std::function<void(
 			const boost::system::error_code&,
-			boost::asio::ip::tcp::socket
+			Socket
 		)>;
 
-		Server(boost::asio::io_context& ioContext, unsigned short port, ConnectionHandler connectionHandler) :
-			acceptor_(ioContext, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)),
-			connectionHandler_(connectionHandler)
+		// The connection is counted as live until the last copy of its ticket is destroyed.
+		using Ticket = std::shared_ptr<void>;
+
+		using TrackedConnectionHandler = std::function<void(
+			const boost::system::error_code&,
+			Socket,
+			Ticket
+		)>;
+
+		// Returns the executor to which the next accepted socket will be bound.
+		using ExecutorSelector = std::function<boost::asio::any_io_executor()>;
+
+		// The connection limits count the tickets of live connections, so they apply to servers
+		// with a TrackedConnectionHandler only. A ConnectionHandler drops the ticket as soon as it
+		// returns, which is why the constructors taking one take no limits.
+		struct Limits {
+			// Accepting is paused when the number of live connections reaches this value (0 means no limit).
+			std::size_t maxConnections = 0;
+			// Accepting is resumed when the number of live connections drops to this value.
+			std::size_t lowWaterMark = 0;
+			// The maximum number of connections accepted per wakeup of the accept loop.
+			std::size_t acceptBatch = 1;
+			// The accept loop waits from minBackoff up to maxBackoff after running out of resources.
+			std::chrono::milliseconds minBackoff{10};
+			std::chrono::milliseconds maxBackoff{1000};
+		};
+
+		struct Counters {
+			std::size_t live = 0;
+			std::size_t accepted = 0;
+			// The number of failed accepts.
+			std::size_t rejected = 0;
+			// How many times accepting has been paused because of the connection limit.
+			std::size_t paused = 0;
+			// How many times the accept loop has backed off because of exhausted resources.
+			std::size_t backoffs = 0;
+		};
+
+		BasicServer(boost::asio::io_context& ioContext, unsigned short port, ConnectionHandler connectionHandler) :
+			BasicServer(ioContext, Endpoint(Protocol::v4(), port), connectionHandler)
+		{}
+
+		BasicServer(boost::asio::io_context& ioContext, unsigned short port, TrackedConnectionHandler connectionHandler) :
+			BasicServer(ioContext, Endpoint(Protocol::v4(), port), connectionHandler, Limits{})
+		{}
+
+		BasicServer(boost::asio::io_context& ioContext, unsigned short port, TrackedConnectionHandler connectionHandler, Limits limits) :
+			BasicServer(ioContext, Endpoint(Protocol::v4(), port), connectionHandler, limits)
+		{}
+
+		BasicServer(boost::asio::io_context& ioContext, const Endpoint& endpoint, ConnectionHandler connectionHandler) :
+			BasicServer(Acceptor(ioContext, endpoint), connectionHandler)
+		{}
+
+		BasicServer(boost::asio::io_context& ioContext, const Endpoint& endpoint, TrackedConnectionHandler connectionHandler, Limits limits) :
+			BasicServer(Acceptor(ioContext, endpoint), connectionHandler, limits)
+		{}
+
+		// Accepts connections on an already listening acceptor. When an executor selector is given,
+		// accepted sockets are bound to the executors it returns instead of the acceptor's executor.
+		BasicServer(Acceptor acceptor, ConnectionHandler connectionHandler, ExecutorSelector executorSelector = nullptr) :
+			BasicServer(std::move(acceptor), Untracked(connectionHandler), Limits{}, executorSelector)
+		{}
+
+		BasicServer(
+			Acceptor acceptor, TrackedConnectionHandler connectionHandler,
+			Limits limits, ExecutorSelector executorSelector = nullptr
+		) :
+			acceptor_(std::move(acceptor)),
+			backoffTimer_(acceptor_.get_executor()),
+			connectionHandler_(connectionHandler),
+			executorSelector_(executorSelector),
+			limits_(limits),
+			backoff_(limits.minBackoff),
+			state_(std::make_shared<State>(this, acceptor_.get_executor()))
 		{
+			if (limits_.maxConnections != 0 && limits_.lowWaterMark >= limits_.maxConnections) {
+				limits_.lowWaterMark = limits_.maxConnections - 1;
+			}
+
+			if (limits_.acceptBatch > 1) {
+				// Lets the accept loop drain pending connections without blocking.
+				acceptor_.non_blocking(true);
+			}
+
 			startAccept();
 		}
 
+		~BasicServer()
+		{
+			state_->server = nullptr;
+		}
+
+		Endpoint localEndpoint() const
+		{
+			return acceptor_.local_endpoint();
+		}
+
+		// Sets the options applied to every accepted socket. Failing options are ignored.
+		void setSocketProfile(const SocketProfile& socketProfile)
+		{
+			socketProfile_ = socketProfile;
+		}
+
+		Counters counters() const
+		{
+			Counters counters;
+
+			counters.live = state_->live.load(std::memory_order_relaxed);
+			counters.accepted = state_->accepted.load(std::memory_order_relaxed);
+			counters.rejected = state_->rejected.load(std::memory_order_relaxed);
+			counters.paused = state_->paused.load(std::memory_order_relaxed);
+			counters.backoffs = state_->backoffs.load(std::memory_order_relaxed);
+
+			return counters;
+		}
+
 		void startAccept()
 		{
-			acceptor_.async_accept(
-				[this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket peer) {
-					this->connectionHandler_(ec, std::move(peer));
-					startAccept();
+			if (isAccepting_ || isWaiting_ || !acceptor_.is_open()) {
+				return;
+			}
+
+			if (isFull()) {
+				pause();
+				return;
+			}
+
+			isAccepting_ = true;
+
+			auto handler = [this](const boost::system::error_code& ec, Socket peer) {
+
+				if (ec == boost::asio::error::operation_aborted) {
+					// The acceptor has been closed, the server may no longer exist.
+					return;
 				}
-			);
+
+				isAccepting_ = false;
+				handleAccept(ec, std::move(peer));
+			};
+
+			if (executorSelector_) {
+				acceptor_.async_accept(executorSelector_(), handler);
+			}
+			else {
+				acceptor_.async_accept(handler);
+			}
+		}
+
+		// Stops accepting new connections.
+		void close()
+		{
+			boost::system::error_code ec;
+
+			backoffTimer_.cancel();
+			acceptor_.close(ec);
 		}
 
 	private:
 
-		boost::asio::ip::tcp::acceptor acceptor_;
-		ConnectionHandler connectionHandler_;
+		struct State {
+
+			BasicServer* server;
+			boost::asio::any_io_executor ioExecutor;
+			std::atomic<std::size_t> live{0};
+			std::atomic<std::size_t> accepted{0};
+			std::atomic<std::size_t> rejected{0};
+			std::atomic<std::size_t> paused{0};
+			std::atomic<std::size_t> backoffs{0};
+			std::atomic<bool> isPaused{false};
+
+			State(BasicServer* server, boost::asio::any_io_executor ioExecutor) :
+				server(server),
+				ioExecutor(ioExecutor)
+			{}
+
+		};
+
+		// Decrements the number of live connections when destroyed and resumes
+		// the paused accept loop once the low-water mark is reached.
+		class ConnectionTicket {
+		public:
+
+			ConnectionTicket(std::shared_ptr<State> state, std::size_t lowWaterMark) :
+				state_(state),
+				lowWaterMark_(lowWaterMark)
+			{
+				state_->live.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			~ConnectionTicket()
+			{
+				std::size_t live = state_->live.fetch_sub(1, std::memory_order_relaxed) - 1;
+
+				if (live <= lowWaterMark_ && state_->isPaused.exchange(false)) {
+					// The ticket may be released on any thread, the accept loop is resumed on its own one.
+					boost::asio::post(state_->ioExecutor, [state = state_]() {
+						if (state->server) {
+							state->server->startAccept();
+						}
+					});
+				}
+			}
+
+		private:
+
+			std::shared_ptr<State> state_;
+			std::size_t lowWaterMark_;
+
+		};
+
+		Acceptor acceptor_;
+		boost::asio::steady_timer backoffTimer_;
+		TrackedConnectionHandler connectionHandler_;
+		ExecutorSelector executorSelector_;
+		Limits limits_;
+		std::chrono::milliseconds backoff_;
+		SocketProfile socketProfile_;
+		std::shared_ptr<State> state_;
+		bool isAccepting_ = false;
+		bool isWaiting_ = false;
+
+		// The ticket is released when the handler returns, the connection is not counted after that.
+		static TrackedConnectionHandler Untracked(ConnectionHandler connectionHandler)
+		{
+			return [connectionHandler](const boost::system::error_code& ec, Socket peer, Ticket) {
+				connectionHandler(ec, std::move(peer));
+			};
+		}
+
+		static bool IsResourceError(const boost::system::error_code& ec)
+		{
+			return ec == boost::asio::error::no_descriptors
+				|| ec == boost::system::errc::too_many_files_open_in_system
+				|| ec == boost::asio::error::no_buffer_space
+				|| ec == boost::asio::error::no_memory;
+		}
+
+		bool isFull() const
+		{
+			return limits_.maxConnections != 0
+				&& state_->live.load(std::memory_order_relaxed) >= limits_.maxConnections;
+		}
+
+		void pause()
+		{
+			state_->paused.fetch_add(1, std::memory_order_relaxed);
+			state_->isPaused = true;
+
+			// Connections may have ended before the flag was set, the loop resumes at the same
+			// low-water mark as when a ticket is released.
+			if (state_->live.load(std::memory_order_relaxed) <= limits_.lowWaterMark && state_->isPaused.exchange(false)) {
+				boost::asio::post(acceptor_.get_executor(), [state = state_]() {
+					if (state->server) {
+						state->server->startAccept();
+					}
+				});
+			}
+		}
+
+		void handleAccept(const boost::system::error_code& ec, Socket peer)
+		{
+			if (ec) {
+				handleError(ec);
+				return;
+			}
+
+			backoff_ = limits_.minBackoff;
+			deliver(std::move(peer));
+
+			// Drain further pending connections within the same wakeup.
+			for (std::size_t i = 1; i < limits_.acceptBatch && !isFull(); i++) {
+
+				Socket nextPeer(
+					executorSelector_ ? executorSelector_() : acceptor_.get_executor()
+				);
+
+				boost::system::error_code nextEc;
+
+				acceptor_.accept(nextPeer, nextEc);
+
+				if (nextEc == boost::asio::error::would_block || nextEc == boost::asio::error::try_again) {
+					break;
+				}
+
+				if (nextEc) {
+					handleError(nextEc);
+					return;
+				}
+
+				deliver(std::move(nextPeer));
+			}
+
+			startAccept();
+		}
+
+		void deliver(Socket peer)
+		{
+			state_->accepted.fetch_add(1, std::memory_order_relaxed);
+
+			socketProfile_.applyToAccepted(peer);
+
+			Ticket ticket = std::make_shared<ConnectionTicket>(state_, limits_.lowWaterMark);
+
+			connectionHandler_(boost::system::error_code{}, std::move(peer), ticket);
+		}
+
+		void handleError(const boost::system::error_code& ec)
+		{
+			state_->rejected.fetch_add(1, std::memory_order_relaxed);
+
+			connectionHandler_(ec, Socket(acceptor_.get_executor()), nullptr);
+
+			if (!IsResourceError(ec)) {
+				startAccept();
+				return;
+			}
+
+			// Re-arming immediately would spin until some descriptors are released.
+			state_->backoffs.fetch_add(1, std::memory_order_relaxed);
+			isWaiting_ = true;
+
+			backoffTimer_.expires_after(backoff_);
+			backoffTimer_.async_wait([this](const boost::system::error_code& ec) {
+
+				if (ec == boost::asio::error::operation_aborted) {
+					return;
+				}
+
+				isWaiting_ = false;
+				startAccept();
+			});
+
+			backoff_ = std::min(backoff_ * 2, limits_.maxBackoff);
+		}
 
 	};
 
-}}
+	using Server = BasicServer<boost::asio::ip::tcp>;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	using LocalServer = BasicServer<boost::asio::local::stream_protocol>;
+#endif
 
+}}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <optional>
+#include <type_traits>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+namespace Sari { namespace Net {
+
+	// Describes the options set on listening, accepted and outbound TCP sockets.
+	// Options that are not set are left untouched. Options that the platform does not
+	// support (most of the keepalive tuning, fast open and deferred accept outside Linux)
+	// are silently skipped. Only the buffer sizes are applied to Unix domain sockets.
+	struct SocketProfile {
+
+		// TCP_NODELAY, disables Nagle's algorithm.
+		std::optional<bool> noDelay;
+		// SO_RCVBUF and SO_SNDBUF in bytes. They are also set on the listener so that accepted
+		// sockets inherit them before the TCP window scale is negotiated.
+		std::optional<int> receiveBufferSize;
+		std::optional<int> sendBufferSize;
+		// SO_KEEPALIVE.
+		std::optional<bool> keepAlive;
+		// TCP_KEEPIDLE, TCP_KEEPINTVL (both in seconds) and TCP_KEEPCNT.
+		std::optional<int> keepAliveIdle;
+		std::optional<int> keepAliveInterval;
+		std::optional<int> keepAliveCount;
+		// TCP_USER_TIMEOUT in milliseconds, how long unacknowledged data may stay in flight.
+		std::optional<int> userTimeout;
+		// TCP_FASTOPEN, the length of the listener's fast open queue.
+		std::optional<int> fastOpenQueueLength;
+		// TCP_FASTOPEN_CONNECT, sends the first write along with the SYN on outbound connects.
+		std::optional<bool> fastOpenConnect;
+		// TCP_DEFER_ACCEPT in seconds, the listener wakes up only when data arrives.
+		std::optional<int> deferAccept;
+
+		// Low latency settings for interactive sessions such as Telnet.
+		static SocketProfile Interactive()
+		{
+			SocketProfile profile;
+
+			profile.noDelay = true;
+			profile.keepAlive = true;
+			profile.keepAliveIdle = 60;
+			profile.keepAliveInterval = 10;
+			profile.keepAliveCount = 6;
+
+			return profile;
+		}
+
+		// Large buffers for bulk relays over high bandwidth paths.
+		static SocketProfile Bulk()
+		{
+			SocketProfile profile;
+
+			profile.receiveBufferSize = 1024 * 1024;
+			profile.sendBufferSize = 1024 * 1024;
+			profile.keepAlive = true;
+
+			return profile;
+		}
+
+		// Sets the options of an open acceptor. It must be called before the acceptor starts listening.
+		template<typename Acceptor>
+		boost::system::error_code applyToListener(Acceptor& acceptor) const
+		{
+			Applier applier;
+
+			applyBuffers(acceptor, applier);
+
+			if constexpr (IsTcp<Acceptor>) {
+
+#if defined(TCP_FASTOPEN)
+				if (fastOpenQueueLength) {
+					applier(acceptor, TcpOption<TCP_FASTOPEN>(*fastOpenQueueLength));
+				}
+#endif
+
+#if defined(TCP_DEFER_ACCEPT)
+				if (deferAccept) {
+					applier(acceptor, TcpOption<TCP_DEFER_ACCEPT>(*deferAccept));
+				}
+#endif
+
+			}
+
+			return applier.ec;
+		}
+
+		// Sets the options of an accepted socket.
+		template<typename Socket>
+		boost::system::error_code applyToAccepted(Socket& socket) const
+		{
+			Applier applier;
+
+			applyBuffers(socket, applier);
+
+			if constexpr (IsTcp<Socket>) {
+				applyConnected(socket, applier);
+			}
+
+			return applier.ec;
+		}
+
+		// Sets the options of an open socket that is about to connect.
+		template<typename Socket>
+		boost::system::error_code applyBeforeConnect(Socket& socket) const
+		{
+			Applier applier;
+
+			applyBuffers(socket, applier);
+
+			if constexpr (IsTcp<Socket>) {
+
+				applyKeepAlive(socket, applier);
+
+#if defined(TCP_FASTOPEN_CONNECT)
+				if (fastOpenConnect) {
+					applier(socket, TcpOption<TCP_FASTOPEN_CONNECT>(*fastOpenConnect));
+				}
+#endif
+
+			}
+
+			return applier.ec;
+		}
+
+		// Sets the options of a connected socket.
+		template<typename Socket>
+		boost::system::error_code applyAfterConnect(Socket& socket) const
+		{
+			Applier applier;
+
+			if constexpr (IsTcp<Socket>) {
+				if (noDelay) {
+					applier(socket, boost::asio::ip::tcp::no_delay(*noDelay));
+				}
+			}
+
+			return applier.ec;
+		}
+
+	private:
+
+		template<typename Socket>
+		static constexpr bool IsTcp = std::is_same_v<typename Socket::protocol_type, boost::asio::ip::tcp>;
+
+		template<int Name>
+		using TcpOption = boost::asio::detail::socket_option::integer<IPPROTO_TCP, Name>;
+
+		// Sets the options one by one and keeps the first error.
+		struct Applier {
+
+			boost::system::error_code ec;
+
+			template<typename Socket, typename Option>
+			void operator() (Socket& socket, const Option& option)
+			{
+				boost::system::error_code optionEc;
+
+				socket.set_option(option, optionEc);
+
+				if (optionEc && !ec) {
+					ec = optionEc;
+				}
+			}
+
+		};
+
+		template<typename Socket>
+		void applyBuffers(Socket& socket, Applier& applier) const
+		{
+			if (receiveBufferSize) {
+				applier(socket, boost::asio::socket_base::receive_buffer_size(*receiveBufferSize));
+			}
+
+			if (sendBufferSize) {
+				applier(socket, boost::asio::socket_base::send_buffer_size(*sendBufferSize));
+			}
+		}
+
+		template<typename Socket>
+		void applyKeepAlive(Socket& socket, Applier& applier) const
+		{
+			if (keepAlive) {
+				applier(socket, boost::asio::socket_base::keep_alive(*keepAlive));
+			}
+
+#if defined(TCP_KEEPIDLE)
+			if (keepAliveIdle) {
+				applier(socket, TcpOption<TCP_KEEPIDLE>(*keepAliveIdle));
+			}
+#endif
+
+#if defined(TCP_KEEPINTVL)
+			if (keepAliveInterval) {
+				applier(socket, TcpOption<TCP_KEEPINTVL>(*keepAliveInterval));
+			}
+#endif
+
+#if defined(TCP_KEEPCNT)
+			if (keepAliveCount) {
+				applier(socket, TcpOption<TCP_KEEPCNT>(*keepAliveCount));
+			}
+#endif
+
+#if defined(TCP_USER_TIMEOUT)
+			if (userTimeout) {
+				applier(socket, TcpOption<TCP_USER_TIMEOUT>(*userTimeout));
+			}
+#endif
+		}
+
+		template<typename Socket>
+		void applyConnected(Socket& socket, Applier& applier) const
+		{
+			applyKeepAlive(socket, applier);
+
+			if (noDelay) {
+				applier(socket, boost::asio::ip::tcp::no_delay(*noDelay));
+			}
+		}
+
+	};
+
+}}
@@ -0,0 +1,625 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "raw.h"
+
+namespace Sari { namespace Socks5 {
+
+	// Rules allowing or denying destinations. A rule is a network, 10.0.0.0/8 or 2001:db8::/32,
+	// an address, or a domain name which also covers all its subdomains. The most specific rule
+	// matching a destination decides, i.e. the longest prefix or the longest domain suffix,
+	// otherwise the default action does. Domain names are matched as they are requested, before
+	// they are resolved, except for the ones which are addresses, e.g. "127.0.0.1", which are
+	// matched as the addresses. The addresses a name resolves to are up to the caller to check.
+	//
+	// The rules are compiled into a path-compressed binary trie for each address family, with a
+	// table of where the first 12 bits of an address lead, and into a trie of the labels of the
+	// domains from the top-level domain down, with the edges in a hash table. A lookup walks at
+	// most one node per branching bit or per label.
+	class AccessPolicy {
+	public:
+
+		enum class Action : unsigned char { Allow, Deny };
+
+		struct Rule {
+			Action action;
+			std::string pattern;
+		};
+
+		explicit AccessPolicy(const std::vector<Rule>& rules, Action defaultAction = Action::Allow) :
+			defaultAction_(defaultAction)
+		{
+			std::vector<BuildNode> v4(1);
+			std::vector<BuildNode> v6(1);
+
+			for (const Rule& rule : rules) {
+
+				auto slash = rule.pattern.find('/');
+				boost::system::error_code ec;
+				auto address = boost::asio::ip::make_address(rule.pattern.substr(0, slash), ec);
+
+				if (ec) {
+					if (slash != std::string::npos) {
+						throw std::invalid_argument("invalid network " + rule.pattern);
+					}
+					addDomain(rule.action, rule.pattern);
+					continue;
+				}
+
+				unsigned bits = address.is_v4() ? 32 : 128;
+				unsigned length = bits;
+
+				if (slash != std::string::npos) {
+					std::size_t end = 0;
+					std::string suffix = rule.pattern.substr(slash + 1);
+					unsigned long parsed = suffix.empty() ? bits + 1 : std::stoul(suffix, &end);
+					if (end != suffix.size() || parsed > bits) {
+						throw std::invalid_argument("invalid prefix length " + rule.pattern);
+					}
+					length = static_cast<unsigned>(parsed);
+				}
+
+				Key key = ToKey(address);
+				Insert(address.is_v4() ? v4 : v6, key, length, rule.action);
+			}
+
+			Compile(v4, 32, v4_);
+			Compile(v6, 128, v6_);
+		}
+
+		// Loads the rules of a file of lines "allow <pattern>", "deny <pattern>" and
+		// "default allow|deny". Empty lines and lines starting with # are skipped. Throws
+		// std::runtime_error if the file cannot be read or a line is malformed.
+		static std::shared_ptr<const AccessPolicy> Load(const std::string& path)
+		{
+			std::ifstream file(path);
+
+			if (!file) {
+				throw std::runtime_error(path + ": cannot open the file");
+			}
+
+			std::vector<Rule> rules;
+			Action defaultAction = Action::Allow;
+			std::string line;
+			std::size_t lineNumber = 0;
+
+			while (std::getline(file, line)) {
+
+				++lineNumber;
+
+				if (!line.empty() && line.back() == '\r') {
+					line.pop_back();
+				}
+				if (line.empty() || line[0] == '#') {
+					continue;
+				}
+
+				auto space = line.find(' ');
+				std::string verb = line.substr(0, space);
+				auto patternBegin = space != std::string::npos ? line.find_first_not_of(' ', space) : std::string::npos;
+				std::string pattern = patternBegin != std::string::npos ? line.substr(patternBegin) : "";
+				std::string where = path + ":" + std::to_string(lineNumber) + ": ";
+
+				if (verb == "default") {
+					if (pattern != "allow" && pattern != "deny") {
+						throw std::runtime_error(where + "expected default allow or default deny");
+					}
+					defaultAction = pattern == "allow" ? Action::Allow : Action::Deny;
+					continue;
+				}
+				if (verb != "allow" && verb != "deny") {
+					throw std::runtime_error(where + "expected allow, deny or default");
+				}
+				if (pattern.empty()) {
+					throw std::runtime_error(where + "expected a network or a domain");
+				}
+
+				Action action = verb == "allow" ? Action::Allow : Action::Deny;
+
+				rules.push_back(Rule{ action, pattern });
+			}
+
+			try {
+				return std::make_shared<const AccessPolicy>(rules, defaultAction);
+			}
+			catch (const std::exception& e) {
+				throw std::runtime_error(path + ": " + e.what());
+			}
+		}
+
+		Action evaluate(const boost::asio::ip::address& address) const
+		{
+			if (address.is_v6() && address.to_v6().is_v4_mapped()) {
+				return evaluate(boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6()));
+			}
+
+			return Lookup(address.is_v4() ? v4_ : v6_, ToKey(address), defaultAction_);
+		}
+
+		// Evaluates the domain name without its length byte, in any case.
+		Action evaluate(std::string_view domainName) const
+		{
+			if (!domainName.empty() && domainName.back() == '.') {
+				domainName.remove_suffix(1);
+			}
+
+			// a top-level domain never ends in a digit, so only an address may
+			bool literal = !domainName.empty()
+				&& ((domainName.back() >= '0' && domainName.back() <= '9') || domainName.find(':') != std::string_view::npos);
+
+			if (literal) {
+
+				boost::system::error_code ec;
+				auto address = boost::asio::ip::make_address(std::string(domainName), ec);
+
+				if (!ec) {
+					return evaluate(address);
+				}
+			}
+
+			Action action = defaultAction_;
+			std::uint32_t node = 0;
+			std::size_t end = domainName.size();
+
+			while (end > 0 && !edges_.empty()) {
+
+				std::size_t dot = domainName.rfind('.', end - 1);
+				std::size_t begin = dot == std::string_view::npos ? 0 : dot + 1;
+				std::string_view label = domainName.substr(begin, end - begin);
+
+				node = findChild(node, label);
+
+				if (node == None) {
+					break;
+				}
+				if (labels_[node].hasAction) {
+					action = labels_[node].action;
+				}
+				if (dot == std::string_view::npos) {
+					break;
+				}
+
+				end = dot;
+			}
+
+			return action;
+		}
+
+		// Evaluates the destination of a request.
+		Action evaluate(const RawAddress& dest) const
+		{
+			switch (dest.atyp) {
+				case AddressType::IPV4:
+					return Lookup(v4_, ToKey(dest.data(), 4), defaultAction_);
+				case AddressType::IPV6: {
+					Key key = ToKey(dest.data(), 16);
+					// ::ffff:0:0/96
+					if (key.hi == 0 && (key.lo >> 32) == 0xffff) {
+						return Lookup(v4_, Key{ key.lo << 32, 0 }, defaultAction_);
+					}
+					return Lookup(v6_, key, defaultAction_);
+				}
+				case AddressType::DomainName:
+					return evaluate(std::string_view(reinterpret_cast<const char*>(dest.data()) + 1, dest.size() - 1));
+				default:
+					return Action::Deny;
+			}
+		}
+
+		// The reply to a request to the destination, Reply::ConnectionNoAllowed if it is denied.
+		Reply check(const RawAddress& dest) const
+		{
+			return evaluate(dest) == Action::Allow ? Reply::Succeeded : Reply::ConnectionNoAllowed;
+		}
+
+		Action defaultAction() const
+		{
+			return defaultAction_;
+		}
+
+	private:
+
+		static constexpr std::uint32_t None = UINT32_MAX;
+
+		// the bits of an address from the most significant one, IPv4 addresses in hi
+		struct Key {
+			std::uint64_t hi = 0;
+			std::uint64_t lo = 0;
+		};
+
+		struct BuildNode {
+			std::uint32_t child[2] = { None, None };
+			bool hasAction = false;
+			Action action = Action::Allow;
+		};
+
+		struct Node {
+			Key key;
+			std::uint32_t child[2];
+			// the bits of the key the node stands for
+			unsigned char length;
+			bool hasAction;
+			Action action;
+		};
+
+		struct Label {
+			std::string label;
+			bool hasAction = false;
+			Action action = Action::Allow;
+		};
+
+		struct Edge {
+			std::uint64_t hash;
+			std::uint32_t parent;
+			std::uint32_t child;
+		};
+
+		// The key of the bytes of an address in network byte order.
+		static Key ToKey(const unsigned char* bytes, std::size_t size)
+		{
+			Key key;
+
+			for (std::size_t i = 0; i < size && i < 8; ++i) {
+				key.hi |= static_cast<std::uint64_t>(bytes[i]) << (56 - 8 * i);
+			}
+			for (std::size_t i = 8; i < size; ++i) {
+				key.lo |= static_cast<std::uint64_t>(bytes[i]) << (56 - 8 * (i - 8));
+			}
+
+			return key;
+		}
+
+		static Key ToKey(const boost::asio::ip::address& address)
+		{
+			if (address.is_v4()) {
+				return ToKey(address.to_v4().to_bytes().data(), 4);
+			}
+
+			return ToKey(address.to_v6().to_bytes().data(), 16);
+		}
+
+		static unsigned Bit(const Key& key, unsigned i)
+		{
+			return i < 64 ? (key.hi >> (63 - i)) & 1 : (key.lo >> (127 - i)) & 1;
+		}
+
+		static void SetBit(Key& key, unsigned i)
+		{
+			if (i < 64) {
+				key.hi |= std::uint64_t(1) << (63 - i);
+			}
+			else {
+				key.lo |= std::uint64_t(1) << (127 - i);
+			}
+		}
+
+		// Whether the first length bits of the keys are the same.
+		static bool SamePrefix(const Key& a, const Key& b, unsigned length)
+		{
+			std::uint64_t hiMask = length >= 64 ? ~std::uint64_t(0) : length == 0 ? 0 : ~std::uint64_t(0) << (64 - length);
+			std::uint64_t loMask = length <= 64 ? 0 : length >= 128 ? ~std::uint64_t(0) : ~std::uint64_t(0) << (128 - length);
+
+			return (((a.hi ^ b.hi) & hiMask) | ((a.lo ^ b.lo) & loMask)) == 0;
+		}
+
+		static void Insert(std::vector<BuildNode>& trie, const Key& key, unsigned length, Action action)
+		{
+			std::uint32_t node = 0;
+
+			for (unsigned i = 0; i < length; ++i) {
+
+				unsigned bit = Bit(key, i);
+
+				if (trie[node].child[bit] == None) {
+					trie[node].child[bit] = static_cast<std::uint32_t>(trie.size());
+					trie.emplace_back();
+				}
+
+				node = trie[node].child[bit];
+			}
+
+			// a later rule for the same network wins
+			trie[node].hasAction = true;
+			trie[node].action = action;
+		}
+
+		// Copies the node of the trie and its subtrees to the compressed trie, skipping the
+		// nodes which neither branch nor hold an action. Returns the index of the copy.
+		static std::uint32_t Compress(const std::vector<BuildNode>& trie, std::uint32_t node, unsigned length, Key key, std::vector<Node>& nodes)
+		{
+			while (!trie[node].hasAction && (trie[node].child[0] == None) != (trie[node].child[1] == None)) {
+
+				unsigned bit = trie[node].child[0] == None ? 1 : 0;
+
+				if (bit) {
+					SetBit(key, length);
+				}
+
+				node = trie[node].child[bit];
+				++length;
+			}
+
+			std::uint32_t index = static_cast<std::uint32_t>(nodes.size());
+
+			nodes.push_back(Node{ key, { None, None }, static_cast<unsigned char>(length), trie[node].hasAction, trie[node].action });
+
+			for (unsigned bit = 0; bit < 2; ++bit) {
+				if (trie[node].child[bit] != None) {
+
+					Key childKey = key;
+
+					if (bit) {
+						SetBit(childKey, length);
+					}
+
+					std::uint32_t child = Compress(trie, trie[node].child[bit], length + 1, childKey, nodes);
+					nodes[index].child[bit] = child;
+				}
+			}
+
+			return index;
+		}
+
+		// where a lookup continues after the first StrideBits bits of the key
+		struct Start {
+			std::uint32_t node;
+			bool hasAction;
+			Action action;
+		};
+
+		// the bits of a key the first table of a trie is indexed by, poptrie's direct pointing
+		static constexpr unsigned StrideBits = 12;
+
+		struct Trie {
+			std::vector<Node> nodes;
+			std::vector<Start> starts;
+			// the bits of the addresses
+			unsigned bits;
+		};
+
+		// Compiles the trie of the rules and the table of the nodes which the first bits of the
+		// keys lead to, so a lookup skips the top of the trie, where it branches the most.
+		static void Compile(const std::vector<BuildNode>& rules, unsigned bits, Trie& trie)
+		{
+			trie.bits = bits;
+			Compress(rules, 0, 0, Key{}, trie.nodes);
+
+			trie.starts.resize(std::size_t(1) << StrideBits);
+
+			for (std::size_t i = 0; i < trie.starts.size(); ++i) {
+
+				Key key{ static_cast<std::uint64_t>(i) << (64 - StrideBits), 0 };
+				Start& start = trie.starts[i];
+				std::uint32_t index = 0;
+
+				start = Start{ None, false, Action::Allow };
+
+				// the nodes shorter than the stride depend only on the first bits of the key
+				while (index != None && trie.nodes[index].length < StrideBits) {
+
+					const Node& node = trie.nodes[index];
+
+					if (!SamePrefix(key, node.key, node.length)) {
+						index = None;
+						break;
+					}
+					if (node.hasAction) {
+						start.hasAction = true;
+						start.action = node.action;
+					}
+
+					index = node.child[Bit(key, node.length)];
+				}
+
+				start.node = index;
+			}
+		}
+
+		static Action Lookup(const Trie& trie, const Key& key, Action action)
+		{
+			const Start& start = trie.starts[key.hi >> (64 - StrideBits)];
+			std::uint32_t index = start.node;
+
+			if (start.hasAction) {
+				action = start.action;
+			}
+
+			while (index != None) {
+
+				const Node& node = trie.nodes[index];
+
+				if (!SamePrefix(key, node.key, node.length)) {
+					break;
+				}
+				if (node.hasAction) {
+					action = node.action;
+				}
+				if (node.length == trie.bits) {
+					break;
+				}
+
+				index = node.child[Bit(key, node.length)];
+			}
+
+			return action;
+		}
+
+		static char Lower(char c)
+		{
+			return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+		}
+
+		static std::uint64_t Hash(std::uint32_t parent, std::string_view label)
+		{
+			std::uint64_t hash = 14695981039346656037ull ^ parent;
+
+			for (char c : label) {
+				hash = (hash ^ static_cast<unsigned char>(Lower(c))) * 1099511628211ull;
+			}
+
+			return hash;
+		}
+
+		static bool EqualLabels(std::string_view a, std::string_view b)
+		{
+			if (a.size() != b.size()) {
+				return false;
+			}
+
+			for (std::size_t i = 0; i < a.size(); ++i) {
+				if (Lower(a[i]) != Lower(b[i])) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		void addDomain(Action action, std::string_view domain)
+		{
+			if (!domain.empty() && domain.back() == '.') {
+				domain.remove_suffix(1);
+			}
+			if (!domain.empty() && domain.front() == '.') {
+				domain.remove_prefix(1);
+			}
+			if (domain.empty()) {
+				throw std::invalid_argument("empty domain");
+			}
+
+			if (labels_.empty()) {
+				// the root
+				labels_.emplace_back();
+			}
+
+			std::uint32_t node = 0;
+			std::size_t end = domain.size();
+
+			for (;;) {
+
+				std::size_t dot = end > 0 ? domain.rfind('.', end - 1) : std::string_view::npos;
+				std::size_t begin = dot == std::string_view::npos ? 0 : dot + 1;
+				std::string_view label = domain.substr(begin, end - begin);
+
+				if (label.empty()) {
+					throw std::invalid_argument("empty label in " + std::string(domain));
+				}
+
+				std::uint32_t child = edges_.empty() ? None : findChild(node, label);
+
+				if (child == None) {
+					child = static_cast<std::uint32_t>(labels_.size());
+					labels_.push_back(Label{ std::string(label) });
+					addEdge(Edge{ Hash(node, label), node, child });
+				}
+
+				node = child;
+
+				if (dot == std::string_view::npos) {
+					break;
+				}
+
+				end = dot;
+			}
+
+			labels_[node].hasAction = true;
+			labels_[node].action = action;
+		}
+
+		// Adds the edge to the open addressing table, which is kept at most half full.
+		void addEdge(const Edge& edge)
+		{
+			if ((numOfEdges_ + 1) * 2 > edges_.size()) {
+
+				std::vector<Edge> edges = std::move(edges_);
+
+				edges_.assign(std::max<std::size_t>(16, edges.size() * 2), Edge{ 0, None, None });
+
+				for (const Edge& e : edges) {
+					if (e.child != None) {
+						place(e);
+					}
+				}
+			}
+
+			place(edge);
+			++numOfEdges_;
+		}
+
+		void place(const Edge& edge)
+		{
+			std::size_t mask = edges_.size() - 1;
+			std::size_t i = edge.hash & mask;
+
+			while (edges_[i].child != None) {
+				i = (i + 1) & mask;
+			}
+
+			edges_[i] = edge;
+		}
+
+		std::uint32_t findChild(std::uint32_t parent, std::string_view label) const
+		{
+			std::uint64_t hash = Hash(parent, label);
+			std::size_t mask = edges_.size() - 1;
+
+			for (std::size_t i = hash & mask; edges_[i].child != None; i = (i + 1) & mask) {
+
+				const Edge& edge = edges_[i];
+
+				if (edge.hash == hash && edge.parent == parent && EqualLabels(labels_[edge.child].label, label)) {
+					return edge.child;
+				}
+			}
+
+			return None;
+		}
+
+		Action defaultAction_;
+		Trie v4_;
+		Trie v6_;
+		std::vector<Label> labels_;
+		std::vector<Edge> edges_;
+		std::size_t numOfEdges_ = 0;
+	};
+
+	// The policy in force, replaced while it is in use. Readers take the current policy without
+	// locking and keep it for as long as they hold it, a new policy is swapped in at once.
+	class AccessControl {
+	public:
+
+		explicit AccessControl(std::shared_ptr<const AccessPolicy> policy) :
+			policy_(std::move(policy))
+		{}
+
+		AccessControl(const AccessControl&) = delete;
+		AccessControl& operator= (const AccessControl&) = delete;
+
+		std::shared_ptr<const AccessPolicy> policy() const
+		{
+			return std::atomic_load(&policy_);
+		}
+
+		void update(std::shared_ptr<const AccessPolicy> policy)
+		{
+			std::atomic_store(&policy_, std::move(policy));
+		}
+
+	private:
+		std::shared_ptr<const AccessPolicy> policy_;
+	};
+
+}}
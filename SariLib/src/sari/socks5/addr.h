@@ -2,6 +2,7 @@
 
 #include <string>
 #include <algorithm>
+#include "../asio/config.h"
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 #include <boost/endian/conversion.hpp>
@@ -47,19 +48,23 @@ namespace Sari { namespace Socks5 {
 			switch (addr_.atyp) {
 				case AddressType::IPV4: {
 
+					const unsigned char* bytes = addr_.data();
+
 					boost::asio::ip::address_v4 addrV4(
-						{ addr_.addr[0], addr_.addr[1], addr_.addr[2], addr_.addr[3] }
+						{ bytes[0], bytes[1], bytes[2], bytes[3] }
 					);
 
 					return boost::asio::ip::tcp::endpoint{addrV4, getPort()};
 				} case AddressType::IPV6: {
 
+					const unsigned char* bytes = addr_.data();
+
 					boost::asio::ip::address_v6 addrV6(
 						{
-							addr_.addr[0], addr_.addr[1], addr_.addr[2], addr_.addr[3],
-							addr_.addr[4], addr_.addr[5], addr_.addr[6], addr_.addr[7],
-							addr_.addr[8], addr_.addr[9], addr_.addr[10], addr_.addr[11],
-							addr_.addr[12], addr_.addr[13], addr_.addr[14], addr_.addr[15]
+							bytes[0], bytes[1], bytes[2], bytes[3],
+							bytes[4], bytes[5], bytes[6], bytes[7],
+							bytes[8], bytes[9], bytes[10], bytes[11],
+							bytes[12], bytes[13], bytes[14], bytes[15]
 						}
 					);
 
@@ -75,14 +80,12 @@ namespace Sari { namespace Socks5 {
 			boost::asio::ip::address addr = endpoint.address();
 
 			if (addr.is_v4()) {
-				addr_.atyp = Socks5::AddressType::IPV4;
 				std::array<unsigned char, 4> addrV4 = addr.to_v4().to_bytes();
-				std::copy(addrV4.begin(), addrV4.end(), addr_.addr);
+				std::copy(addrV4.begin(), addrV4.end(), addr_.assign(Socks5::AddressType::IPV4, addrV4.size()));
 			}
 			else if (addr.is_v6()) {
-				addr_.atyp = Socks5::AddressType::IPV6;
 				std::array<unsigned char, 16> addrV6 = addr.to_v6().to_bytes();
-				std::copy(addrV6.begin(), addrV6.end(), addr_.addr);
+				std::copy(addrV6.begin(), addrV6.end(), addr_.assign(Socks5::AddressType::IPV6, addrV6.size()));
 			}
 
 			setPort(endpoint.port());
@@ -95,8 +98,8 @@ namespace Sari { namespace Socks5 {
 			}
 
 			return std::string{
-				reinterpret_cast<char*>(&addr_.addr[1]),
-				addr_.addr[0]
+				reinterpret_cast<const char*>(addr_.data() + 1),
+				addr_.data()[0]
 			};
 		}
 
@@ -106,9 +109,10 @@ namespace Sari { namespace Socks5 {
 				throw std::logic_error("domain name is too long");
 			}
 
-			addr_.atyp = Socks5::AddressType::DomainName;
-			addr_.addr[0] = static_cast<unsigned char>(domainName.length());
-			std::copy(domainName.cbegin(), domainName.cend(), &addr_.addr[1]);
+			unsigned char* bytes = addr_.assign(Socks5::AddressType::DomainName, domainName.length() + 1);
+
+			bytes[0] = static_cast<unsigned char>(domainName.length());
+			std::copy(domainName.cbegin(), domainName.cend(), bytes + 1);
 		}
 
 	private:
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+#include "../utils/promise.h"
+#include "credentials.h"
+#include "socks5.h"
+
+namespace Sari { namespace Socks5 {
+
+	// Verifies the username and the password of a client, RFC 1929.
+	class Authenticator {
+	public:
+
+		virtual ~Authenticator() = default;
+
+		// Resolves with true if the credentials are valid, on the I/O executor.
+		virtual Utils::Promise authenticate(boost::asio::any_io_executor ioExecutor, const UserPassRequest& userPassReq) = 0;
+
+		// Changes whenever the credentials the authenticator verifies with may have changed, so
+		// the verifications made before are no longer valid.
+		virtual std::uint64_t generation() const
+		{
+			return 0;
+		}
+	};
+
+	// Verifies the credentials with the current index of the store, on the I/O thread.
+	class IndexAuthenticator : public Authenticator {
+	public:
+
+		explicit IndexAuthenticator(const CredentialStore& store) :
+			store_(store)
+		{}
+
+		Utils::Promise authenticate(boost::asio::any_io_executor ioExecutor, const UserPassRequest& userPassReq) override
+		{
+			bool valid = store_.index()->verify(userPassReq.username(), userPassReq.password());
+
+			return Utils::Promise::Resolve(ioExecutor, valid);
+		}
+
+		// Changes with every reload of the store.
+		std::uint64_t generation() const override
+		{
+			return store_.generation();
+		}
+
+	private:
+		const CredentialStore& store_;
+	};
+
+	// Verifies the credentials with a blocking function, e.g. a query of a directory, on the work
+	// executor. At most maxConcurrent verifications run at once, the others wait in turn, so slow
+	// verifications never take all threads of the work executor.
+	class BlockingAuthenticator : public Authenticator {
+	public:
+
+		using Verify = std::function<bool(std::string_view username, std::string_view password)>;
+
+		BlockingAuthenticator(Verify verify, boost::asio::any_io_executor workExecutor, std::size_t maxConcurrent = 4) :
+			state_(std::make_shared<State>())
+		{
+			state_->verify = std::move(verify);
+			state_->workExecutor = workExecutor;
+			state_->maxConcurrent = maxConcurrent > 0 ? maxConcurrent : 1;
+		}
+
+		Utils::Promise authenticate(boost::asio::any_io_executor ioExecutor, const UserPassRequest& userPassReq) override
+		{
+			return Utils::Promise(
+				ioExecutor,
+				[&](Utils::AnyFunction resolve, Utils::AnyFunction) {
+
+					Job job{
+						std::string(userPassReq.username()),
+						std::string(userPassReq.password()),
+						boost::asio::prefer(ioExecutor, boost::asio::execution::outstanding_work.tracked),
+						resolve
+					};
+
+					{
+						std::lock_guard<std::mutex> lock(state_->mutex);
+
+						if (state_->running == state_->maxConcurrent) {
+							state_->waiting.push_back(std::move(job));
+							return;
+						}
+
+						++state_->running;
+					}
+
+					Run(state_, std::move(job));
+				},
+				Utils::Promise::Async
+			);
+		}
+
+	private:
+
+		struct Job {
+			std::string username;
+			std::string password;
+			boost::asio::any_io_executor ioExecutor;
+			Utils::AnyFunction resolve;
+		};
+
+		struct State {
+			Verify verify;
+			boost::asio::any_io_executor workExecutor;
+			std::size_t maxConcurrent;
+			std::mutex mutex;
+			std::size_t running = 0;
+			std::deque<Job> waiting;
+		};
+
+		// Verifies the job and then the waiting ones until there are none.
+		static void Run(std::shared_ptr<State> state, Job job)
+		{
+			boost::asio::post(state->workExecutor, [state, job = std::move(job)]() mutable {
+
+				bool valid = false;
+
+				try {
+					valid = state->verify(job.username, job.password);
+				}
+				catch (...) {
+				}
+
+				boost::asio::post(job.ioExecutor, [resolve = job.resolve, valid]() {
+					resolve(valid);
+				});
+
+				std::unique_lock<std::mutex> lock(state->mutex);
+
+				if (state->waiting.empty()) {
+					--state->running;
+					return;
+				}
+
+				Job next = std::move(state->waiting.front());
+				state->waiting.pop_front();
+				lock.unlock();
+
+				Run(state, std::move(next));
+			});
+		}
+
+		std::shared_ptr<State> state_;
+	};
+
+	// Remembers the credentials the authenticator has accepted for the session time, so a client
+	// opening connection after connection is verified once per session. Rejected credentials
+	// are always verified again, and so are all credentials once the generation of the
+	// authenticator has changed, e.g. after the credentials have been reloaded.
+	class CachingAuthenticator : public Authenticator {
+	public:
+
+		using Clock = std::chrono::steady_clock;
+
+		CachingAuthenticator(
+			std::shared_ptr<Authenticator> authenticator,
+			Clock::duration sessionTime = std::chrono::minutes(5),
+			std::size_t maxSessions = 10000
+		) :
+			authenticator_(std::move(authenticator)),
+			state_(std::make_shared<State>())
+		{
+			state_->sessionTime = sessionTime;
+			state_->maxSessions = maxSessions;
+		}
+
+		Utils::Promise authenticate(boost::asio::any_io_executor ioExecutor, const UserPassRequest& userPassReq) override
+		{
+			auto now = Clock::now();
+			// taken before the verification, which may already see newer credentials
+			std::uint64_t generation = authenticator_->generation();
+
+			{
+				std::lock_guard<std::mutex> lock(state_->mutex);
+
+				auto session = state_->sessions.find(std::string(userPassReq.username()));
+
+				if (session != state_->sessions.end()
+					&& session->second.generation == generation
+					&& session->second.expiry > now
+					&& ConstantTimeEqual(session->second.password, userPassReq.password())
+				) {
+					return Utils::Promise::Resolve(ioExecutor, true);
+				}
+			}
+
+			return authenticator_->authenticate(ioExecutor, userPassReq)
+				.then([state = state_, userPassReq, generation](bool valid) {
+					if (valid) {
+						state->remember(userPassReq, generation);
+					}
+					return valid;
+				});
+		}
+
+		std::uint64_t generation() const override
+		{
+			return authenticator_->generation();
+		}
+
+	private:
+
+		struct Session {
+			std::string password;
+			Clock::time_point expiry;
+			// the generation of the authenticator which has accepted the credentials
+			std::uint64_t generation;
+		};
+
+		struct State {
+
+			Clock::duration sessionTime;
+			std::size_t maxSessions;
+			std::mutex mutex;
+			std::unordered_map<std::string, Session> sessions;
+
+			void remember(const UserPassRequest& userPassReq, std::uint64_t generation)
+			{
+				auto now = Clock::now();
+
+				std::lock_guard<std::mutex> lock(mutex);
+
+				// the sessions of another generation are no longer valid either
+				if (sessions.size() >= maxSessions) {
+					for (auto it = sessions.begin(); it != sessions.end(); ) {
+						it = it->second.expiry <= now || it->second.generation != generation ? sessions.erase(it) : std::next(it);
+					}
+				}
+
+				if (sessions.size() < maxSessions) {
+					sessions[std::string(userPassReq.username())] = Session{ std::string(userPassReq.password()), now + sessionTime, generation };
+				}
+			}
+		};
+
+		std::shared_ptr<Authenticator> authenticator_;
+		std::shared_ptr<State> state_;
+	};
+
+	// Runs the username/password subnegotiation on the server side, after the method reply
+	// has selected Method::UsernamePassword. Rejects with Socks5Errc::AuthenticationFailed after
+	// telling the client so.
+	template<typename Stream>
+	Utils::Promise AsyncAuthenticate(Stream& stream, RecvBuffer& buffer, Authenticator& authenticator)
+	{
+		return AsyncRecvUserPassRequest(stream, buffer)
+			.then([&stream, &authenticator](UserPassRequest userPassReq) {
+				return authenticator.authenticate(stream.get_executor(), userPassReq);
+			}).then([&stream](bool valid) {
+				return AsyncSendUserPassReply(stream, UserPassReply{ valid })
+					.then([&stream, valid]() {
+						if (!valid) {
+							return Utils::Promise::Reject(stream.get_executor(), make_error_code(Socks5Errc::AuthenticationFailed));
+						}
+						return Utils::Promise::Resolve(stream.get_executor());
+					});
+			});
+	}
+
+}}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+#include "../utils/promise.h"
+#include "../utils/timer_wheel.h"
+#include "socks5.h"
+
+namespace Sari { namespace Socks5 {
+
+	// Listening sockets opened in advance for BIND requests. A request takes a listener from
+	// the pool and the listener returns to the pool when the request releases it, so serving
+	// a request does not bind and listen a new socket. The pool must be used from the thread
+	// running its executor.
+	class ListenerPool {
+	public:
+
+		using tcp = boost::asio::ip::tcp;
+		using Clock = Utils::TimerWheel::Clock;
+
+		// Opens the listeners on consecutive ports from the port of the endpoint, or on ports
+		// the system picks if it is 0. A listener nobody connects to within the accept timeout
+		// is released.
+		ListenerPool(
+			boost::asio::any_io_executor ioExecutor,
+			const tcp::endpoint& endpoint,
+			std::size_t size,
+			Clock::duration acceptTimeout = std::chrono::seconds(60)
+		) :
+			state_(std::make_shared<State>()),
+			acceptTimeout_(acceptTimeout),
+			timerWheel_(ioExecutor, std::chrono::milliseconds(100))
+		{
+			state_->idle.reserve(size);
+
+			for (std::size_t i = 0; i < size; ++i) {
+
+				auto port = endpoint.port() != 0 ? static_cast<unsigned short>(endpoint.port() + i) : 0;
+				auto listener = std::make_unique<tcp::acceptor>(ioExecutor, tcp::endpoint(endpoint.address(), port));
+
+				listener->non_blocking(true);
+				state_->idle.push_back(std::move(listener));
+			}
+		}
+
+		ListenerPool(const ListenerPool&) = delete;
+		ListenerPool& operator= (const ListenerPool&) = delete;
+
+		// Takes a listener, null if all of them are taken. The connections which have waited
+		// on the listener while it was idle are closed.
+		std::shared_ptr<tcp::acceptor> acquire()
+		{
+			if (state_->idle.empty()) {
+				return nullptr;
+			}
+
+			tcp::acceptor* listener = state_->idle.back().release();
+			state_->idle.pop_back();
+
+			boost::system::error_code ec;
+
+			for (;;) {
+				tcp::socket stale(listener->get_executor());
+				listener->accept(stale, ec);
+				if (ec) {
+					break;
+				}
+			}
+
+			std::weak_ptr<State> pool = state_;
+
+			return std::shared_ptr<tcp::acceptor>(listener, [pool](tcp::acceptor* listener) {
+
+				auto state = pool.lock();
+
+				if (state && listener->is_open()) {
+					// the vector has the room for all listeners
+					state->idle.emplace_back(listener);
+				}
+				else {
+					delete listener;
+				}
+			});
+		}
+
+		// The number of listeners in the pool.
+		std::size_t available() const
+		{
+			return state_->idle.size();
+		}
+
+		Clock::duration acceptTimeout() const
+		{
+			return acceptTimeout_;
+		}
+
+		Utils::TimerWheel& timerWheel()
+		{
+			return timerWheel_;
+		}
+
+	private:
+
+		struct State {
+			std::vector<std::unique_ptr<tcp::acceptor>> idle;
+		};
+
+		std::shared_ptr<State> state_;
+		Clock::duration acceptTimeout_;
+		Utils::TimerWheel timerWheel_;
+	};
+
+	// Accepts the connection of the expected address on the listener, or of any address if
+	// the expected one is unspecified. Rejects with timed_out when nobody connects within the
+	// accept timeout of the pool.
+	inline Utils::Promise AsyncAcceptFrom(
+		ListenerPool& pool,
+		std::shared_ptr<boost::asio::ip::tcp::acceptor> listener,
+		std::shared_ptr<boost::asio::ip::tcp::socket> peer,
+		const boost::asio::ip::address& expected
+	)
+	{
+		struct Accept {
+
+			std::shared_ptr<boost::asio::ip::tcp::acceptor> listener;
+			std::shared_ptr<boost::asio::ip::tcp::socket> peer;
+			boost::asio::ip::address expected;
+			bool done = false;
+			bool timedOut = false;
+
+			void start(Utils::AnyFunction resolve, Utils::AnyFunction reject, std::shared_ptr<Accept> self)
+			{
+				listener->async_accept(*peer, [self, resolve, reject](const boost::system::error_code& ec) {
+
+					if (ec) {
+						self->done = true;
+						self->listener.reset();
+						reject(self->timedOut ? make_error_code(boost::system::errc::timed_out) : ec);
+						return;
+					}
+
+					boost::system::error_code ignored;
+					auto remote = self->peer->remote_endpoint(ignored);
+
+					if (!self->expected.is_unspecified() && remote.address() != self->expected) {
+						self->peer->close(ignored);
+						self->start(resolve, reject, self);
+						return;
+					}
+
+					self->done = true;
+					// the listener returns to the pool
+					self->listener.reset();
+					resolve();
+				});
+			}
+		};
+
+		auto accept = std::make_shared<Accept>();
+
+		accept->listener = std::move(listener);
+		accept->peer = std::move(peer);
+		accept->expected = expected;
+
+		return Utils::Promise(
+			accept->listener->get_executor(),
+			[&](Utils::AnyFunction resolve, Utils::AnyFunction reject) {
+
+				accept->start(resolve, reject, accept);
+
+				pool.timerWheel().schedule(pool.acceptTimeout(), [weak = std::weak_ptr<Accept>(accept)]() {
+
+					auto accept = weak.lock();
+
+					if (accept && !accept->done) {
+						boost::system::error_code ignored;
+						accept->timedOut = true;
+						accept->listener->cancel(ignored);
+					}
+				});
+			},
+			Utils::Promise::Async
+		);
+	}
+
+	// Serves a BIND request received on the control connection as RFC 1928 defines. The first
+	// reply tells the address of a listener from the pool, the second one the address of the
+	// host which has connected to it. Resolves with the connection of the host,
+	// std::shared_ptr<tcp::socket>, the listener is back in the pool by then.
+	template<typename Socket>
+	Utils::Promise AsyncBind(Socket& control, CommandRequest cmdReq, ListenerPool& pool)
+	{
+		using tcp = boost::asio::ip::tcp;
+		using Utils::Promise;
+
+		auto listener = pool.acquire();
+
+		if (!listener) {
+			return AsyncSendCommandReply(control, CommandReply{ Reply::GeneralServeFailure, cmdReq.dest().getAddr() })
+				.then([&control]() {
+					return Promise::Reject(control.get_executor(), make_error_code(Socks5Errc::GeneralServerFailure));
+				});
+		}
+
+		// a listener on all interfaces is reached on the address the client is connected to
+		tcp::endpoint bound = listener->local_endpoint();
+
+		if (bound.address().is_unspecified()) {
+			bound.address(control.local_endpoint().address());
+		}
+
+		// the host the client expects, if it has told one
+		boost::asio::ip::address expected;
+
+		if (cmdReq.dest().getAddrType() != AddressType::DomainName) {
+			expected = cmdReq.dest().getEndpoint().address();
+		}
+
+		auto peer = std::make_shared<tcp::socket>(control.get_executor());
+
+		return AsyncSendCommandReply(control, CommandReply{ Reply::Succeeded, bound })
+			.then([&control, &pool, listener, peer, expected]() mutable {
+				return Promise::AllSettled(control.get_executor(), { AsyncAcceptFrom(pool, std::move(listener), peer, expected) });
+			}).then([&control, peer, bound](Promise accepted) {
+
+				if (!accepted.isFulfilled()) {
+
+					auto ec = accepted.result<boost::system::error_code>(0);
+					auto reply = ec == boost::system::errc::timed_out ? Reply::TTLExpired : Reply::GeneralServeFailure;
+
+					return AsyncSendCommandReply(control, CommandReply{ reply, bound })
+						.then([&control, ec]() {
+							return Promise::Reject(control.get_executor(), ec);
+						});
+				}
+
+				return AsyncSendCommandReply(control, CommandReply{ Reply::Succeeded, peer->remote_endpoint() })
+					.then([peer]() {
+						return peer;
+					});
+			});
+	}
+
+}}
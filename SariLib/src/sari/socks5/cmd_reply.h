@@ -7,8 +7,8 @@ namespace Sari { namespace Socks5 {
 	class CommandReply {
 	public:
 
-		CommandReply(const RawCommandReply cmdReply) :
-			cmdReply_(cmdReply)
+		CommandReply(RawCommandReply cmdReply) :
+			cmdReply_(std::move(cmdReply))
 		{}
 
 		CommandReply(Reply reply, const RawAddress& addr)
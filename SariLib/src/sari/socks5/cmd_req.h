@@ -7,8 +7,8 @@ namespace Sari { namespace Socks5 {
 	class CommandRequest {
 	public:
 
-		CommandRequest(const RawCommandRequest cmdReq) :
-			cmdReq_(cmdReq)
+		CommandRequest(RawCommandRequest cmdReq) :
+			cmdReq_(std::move(cmdReq))
 		{}
 
 		CommandRequest(Command cmd, const RawAddress& addr)
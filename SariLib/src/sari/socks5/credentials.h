@@ -0,0 +1,286 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "../utils/promise.h"
+
+namespace Sari { namespace Socks5 {
+
+	// Compares the credentials in a time which depends neither on their bytes nor on where they
+	// differ. Both must be at most 255 bytes long, as RFC 1929 allows.
+	inline bool ConstantTimeEqual(std::string_view a, std::string_view b)
+	{
+		std::size_t diff = a.size() ^ b.size();
+
+		for (std::size_t i = 0; i < 255; ++i) {
+			unsigned char x = i < a.size() ? static_cast<unsigned char>(a[i]) : 0;
+			unsigned char y = i < b.size() ? static_cast<unsigned char>(b[i]) : 0;
+			diff |= x ^ y;
+		}
+
+		return diff == 0;
+	}
+
+	// The credentials of a file of lines username:password, the password being the rest of the
+	// line. Empty lines and lines starting with # are skipped. The file is mapped into memory and
+	// indexed by a hash table of the offsets of the usernames and the passwords, so loading it
+	// costs one pass and no allocation per user. The file must not be modified while it is
+	// mapped, replace it by renaming a new one over it.
+	class CredentialIndex {
+	public:
+
+		// An index without any credentials.
+		CredentialIndex() = default;
+
+		// Loads the file, throws std::runtime_error if it cannot be read or a line is malformed.
+		explicit CredentialIndex(const std::string& path)
+		{
+			namespace ipc = boost::interprocess;
+
+			std::error_code ec;
+			auto fileSize = std::filesystem::file_size(path, ec);
+
+			if (ec) {
+				throw std::runtime_error(path + ": " + ec.message());
+			}
+
+			// an empty file cannot be mapped
+			if (fileSize > 0) {
+				try {
+					ipc::file_mapping file(path.c_str(), ipc::read_only);
+					region_ = ipc::mapped_region(file, ipc::read_only);
+				}
+				catch (const ipc::interprocess_exception& e) {
+					throw std::runtime_error(path + ": " + e.what());
+				}
+			}
+
+			if (region_.get_size() > UINT32_MAX) {
+				throw std::runtime_error(path + ": the file is too large");
+			}
+
+			data_ = static_cast<const char*>(region_.get_address());
+
+			build(path, region_.get_size());
+		}
+
+		CredentialIndex(const CredentialIndex&) = delete;
+		CredentialIndex& operator= (const CredentialIndex&) = delete;
+
+		// The number of users.
+		std::size_t size() const
+		{
+			return size_;
+		}
+
+		// Whether the password is the one of the user. An unknown user costs the same as a wrong
+		// password.
+		bool verify(std::string_view username, std::string_view password) const
+		{
+			const Slot* slot = find(username);
+			std::string_view expected = slot ? std::string_view(data_ + slot->password, slot->passwordSize) : std::string_view();
+
+			// compared even for an unknown user
+			bool equal = ConstantTimeEqual(expected, password);
+
+			return slot != nullptr && equal;
+		}
+
+	private:
+
+		struct Slot {
+			std::uint64_t hash;
+			std::uint32_t username;
+			std::uint32_t password;
+			unsigned char usernameSize;
+			unsigned char passwordSize;
+			bool used;
+		};
+
+		// FNV-1a
+		static std::uint64_t Hash(std::string_view s)
+		{
+			std::uint64_t hash = 14695981039346656037ull;
+
+			for (char c : s) {
+				hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+			}
+
+			return hash;
+		}
+
+		const Slot* find(std::string_view username) const
+		{
+			if (slots_.empty()) {
+				return nullptr;
+			}
+
+			std::uint64_t hash = Hash(username);
+			std::size_t mask = slots_.size() - 1;
+
+			for (std::size_t i = hash & mask; slots_[i].used; i = (i + 1) & mask) {
+
+				const Slot& slot = slots_[i];
+
+				if (slot.hash == hash && ConstantTimeEqual(std::string_view(data_ + slot.username, slot.usernameSize), username)) {
+					return &slot;
+				}
+			}
+
+			return nullptr;
+		}
+
+		void build(const std::string& path, std::size_t fileSize)
+		{
+			std::vector<Slot> lines;
+			std::size_t lineNumber = 0;
+
+			for (std::size_t begin = 0; begin < fileSize; ) {
+
+				const char* eol = static_cast<const char*>(std::memchr(data_ + begin, '\n', fileSize - begin));
+				std::size_t end = eol ? eol - data_ : fileSize;
+				std::size_t next = end + 1;
+
+				++lineNumber;
+
+				if (end > begin && data_[end - 1] == '\r') {
+					--end;
+				}
+
+				std::string_view line(data_ + begin, end - begin);
+
+				if (!line.empty() && line[0] != '#') {
+
+					std::size_t colon = line.find(':');
+
+					if (colon == std::string_view::npos || colon == 0 || colon > 255 || line.size() - colon - 1 > 255) {
+						throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected username:password");
+					}
+
+					Slot slot;
+
+					slot.hash = Hash(line.substr(0, colon));
+					slot.username = static_cast<std::uint32_t>(begin);
+					slot.usernameSize = static_cast<unsigned char>(colon);
+					slot.password = static_cast<std::uint32_t>(begin + colon + 1);
+					slot.passwordSize = static_cast<unsigned char>(line.size() - colon - 1);
+					slot.used = true;
+
+					lines.push_back(slot);
+				}
+
+				begin = next;
+			}
+
+			// at most half of the slots are used
+			std::size_t capacity = 16;
+
+			while (capacity < lines.size() * 2) {
+				capacity *= 2;
+			}
+
+			slots_.assign(capacity, Slot{});
+
+			std::size_t mask = capacity - 1;
+
+			for (const Slot& line : lines) {
+
+				std::size_t i = line.hash & mask;
+				std::string_view username(data_ + line.username, line.usernameSize);
+
+				while (slots_[i].used && !(slots_[i].hash == line.hash && std::string_view(data_ + slots_[i].username, slots_[i].usernameSize) == username)) {
+					i = (i + 1) & mask;
+				}
+
+				// the last line of a user wins
+				size_ += slots_[i].used ? 0 : 1;
+				slots_[i] = line;
+			}
+		}
+
+		boost::interprocess::mapped_region region_;
+		const char* data_ = nullptr;
+		std::vector<Slot> slots_;
+		std::size_t size_ = 0;
+	};
+
+	// The credentials of a file which can be reloaded while they are in use. Readers take the
+	// current index without locking, a reload loads the file off the I/O thread and swaps the new
+	// index in at once.
+	class CredentialStore {
+	public:
+
+		explicit CredentialStore(std::string path) :
+			path_(std::move(path)),
+			index_(std::make_shared<const CredentialIndex>(path_))
+		{}
+
+		CredentialStore(const CredentialStore&) = delete;
+		CredentialStore& operator= (const CredentialStore&) = delete;
+
+		std::shared_ptr<const CredentialIndex> index() const
+		{
+			return std::atomic_load(&index_);
+		}
+
+		// The number of times the index has been replaced, read it before the index to tell
+		// whether what the index says may have changed since.
+		std::uint64_t generation() const
+		{
+			return generation_.load();
+		}
+
+		// Loads the file on the work executor, e.g. of a thread pool, and swaps the index. The
+		// promise resolves with the number of users, or rejects with std::runtime_error, on the
+		// I/O executor. The previous index serves until the new one is loaded, and keeps serving
+		// if loading fails. The store must outlive the reload.
+		Utils::Promise reload(boost::asio::any_io_executor ioExecutor, boost::asio::any_io_executor workExecutor)
+		{
+			return Utils::Promise(
+				ioExecutor,
+				[&](Utils::AnyFunction resolve, Utils::AnyFunction reject) {
+					// the I/O executor has work until the result is back
+					auto work = boost::asio::prefer(ioExecutor, boost::asio::execution::outstanding_work.tracked);
+
+					boost::asio::post(workExecutor, [this, ioExecutor = boost::asio::any_io_executor(work), resolve, reject]() {
+						try {
+							auto index = std::make_shared<const CredentialIndex>(path_);
+							std::size_t size = index->size();
+
+							std::atomic_store(&index_, std::move(index));
+							++generation_;
+
+							boost::asio::post(ioExecutor, [resolve, size]() {
+								resolve(size);
+							});
+						}
+						catch (const std::exception& e) {
+							boost::asio::post(ioExecutor, [reject, error = std::runtime_error(e.what())]() {
+								reject(error);
+							});
+						}
+					});
+				},
+				Utils::Promise::Async
+			);
+		}
+
+	private:
+		std::string path_;
+		std::shared_ptr<const CredentialIndex> index_;
+		std::atomic<std::uint64_t> generation_{ 0 };
+	};
+
+}}
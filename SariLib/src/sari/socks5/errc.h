@@ -8,7 +8,10 @@ enum class Socks5Errc {
     InvalidAddressType = 2,
     NoAcceptableMethods = 3,
     CommandNotSupported = 4,
-    HostUnreachable = 5
+    HostUnreachable = 5,
+    GeneralServerFailure = 6,
+    AuthenticationFailed = 7,
+    ConnectionNotAllowed = 8
 };
 
 namespace boost {
@@ -47,6 +50,12 @@ namespace Sari { namespace Socks5 {
                     return "command is not supported";
                 case Socks5Errc::HostUnreachable:
                     return "host is unreachable";
+                case Socks5Errc::GeneralServerFailure:
+                    return "general server failure";
+                case Socks5Errc::AuthenticationFailed:
+                    return "authentication failed";
+                case Socks5Errc::ConnectionNotAllowed:
+                    return "connection is not allowed by the rules";
                 default:
                     return "unknown";
             }
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio/ip/address.hpp>
+
+#include "raw.h"
+
+namespace Sari { namespace Socks5 {
+
+	// Connection metrics of the destinations which drive the most load: connections, replies
+	// by code, bytes relayed and the time to connect. A destination is a domain name as it is
+	// requested, an IPv4 /24 or an IPv6 /48 network.
+	//
+	// The table is a space-saving heavy-hitters sketch of a fixed number of slots, so its memory
+	// is bounded however many destinations appear. A destination without a slot takes the one
+	// of the fewest connections and counts those connections as its own, they are its error.
+	// A destination with more than 1/capacity of all connections always has a slot. The other
+	// counters of a slot count the connections since its destination has taken it.
+	class DestinationMetrics {
+	public:
+
+		using Clock = std::chrono::steady_clock;
+
+		// What happened to one connection.
+		struct Connection {
+			Reply reply = Reply::Succeeded;
+			// how long resolving the destination and connecting to it took
+			Clock::duration connectTime = Clock::duration::zero();
+			// bytes relayed to the destination and back
+			std::uint64_t bytesSent = 0;
+			std::uint64_t bytesReceived = 0;
+		};
+
+		struct Entry {
+			std::string destination;
+			std::uint64_t connections = 0;
+			// the connections may be overestimated by this many
+			std::uint64_t error = 0;
+			// the connections by the code of their reply
+			std::array<std::uint64_t, 9> replies = {};
+			std::uint64_t bytesSent = 0;
+			std::uint64_t bytesReceived = 0;
+			// the sum of the connect times of the successful connections
+			Clock::duration connectTime = Clock::duration::zero();
+
+			// The mean time to connect to the destination.
+			Clock::duration meanConnectTime() const
+			{
+				return replies[0] > 0 ? connectTime / static_cast<Clock::rep>(replies[0]) : Clock::duration::zero();
+			}
+		};
+
+		explicit DestinationMetrics(std::size_t capacity = 1024) :
+			slots_(std::max<std::size_t>(capacity, 1)),
+			index_(IndexSize(slots_.size()), None)
+		{
+			heap_.reserve(slots_.size());
+		}
+
+		DestinationMetrics(const DestinationMetrics&) = delete;
+		DestinationMetrics& operator= (const DestinationMetrics&) = delete;
+
+		// Records a connection once it has completed, or failed.
+		void record(const RawAddress& dest, const Connection& connection)
+		{
+			Key key;
+
+			if (!MakeKey(dest, key)) {
+				return;
+			}
+
+			std::uint64_t hash = Hash(key);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			++connections_;
+
+			std::uint32_t index = find(key, hash);
+
+			if (index == None) {
+				index = take(key, hash);
+			}
+
+			Slot& slot = slots_[index];
+			auto reply = static_cast<std::size_t>(connection.reply);
+
+			++slot.connections;
+			++slot.replies[reply < slot.replies.size() ? reply : static_cast<std::size_t>(Reply::GeneralServeFailure)];
+			slot.bytesSent += connection.bytesSent;
+			slot.bytesReceived += connection.bytesReceived;
+			if (connection.reply == Reply::Succeeded) {
+				slot.connectTime += connection.connectTime;
+			}
+
+			siftDown(slot.heapIndex);
+		}
+
+		// The destinations of the most connections, at most k of them, from the most.
+		std::vector<Entry> top(std::size_t k) const
+		{
+			std::vector<Slot> slots;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				std::vector<std::uint32_t> used(heap_.begin(), heap_.end());
+				k = std::min(k, used.size());
+
+				std::partial_sort(used.begin(), used.begin() + k, used.end(), [this](std::uint32_t a, std::uint32_t b) {
+					return slots_[a].connections > slots_[b].connections;
+				});
+
+				for (std::size_t i = 0; i < k; ++i) {
+					slots.push_back(slots_[used[i]]);
+				}
+			}
+
+			std::vector<Entry> entries(slots.size());
+
+			for (std::size_t i = 0; i < slots.size(); ++i) {
+
+				const Slot& slot = slots[i];
+				Entry& entry = entries[i];
+
+				entry.destination = ToString(slot.key);
+				entry.connections = slot.connections;
+				entry.error = slot.error;
+				entry.replies = slot.replies;
+				entry.bytesSent = slot.bytesSent;
+				entry.bytesReceived = slot.bytesReceived;
+				entry.connectTime = slot.connectTime;
+			}
+
+			return entries;
+		}
+
+		// The connections recorded.
+		std::uint64_t connections() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return connections_;
+		}
+
+	private:
+
+		static constexpr std::uint32_t None = UINT32_MAX;
+
+		// The type of the address and the bytes of the name or of the network.
+		struct Key {
+			AddressType atyp = AddressType::IPV4;
+			unsigned char size = 0;
+			std::array<unsigned char, 255> bytes;
+
+			bool operator== (const Key& other) const
+			{
+				return atyp == other.atyp && size == other.size && std::equal(bytes.begin(), bytes.begin() + size, other.bytes.begin());
+			}
+		};
+
+		struct Slot {
+			Key key;
+			std::uint64_t hash = 0;
+			std::uint32_t heapIndex = 0;
+			std::uint64_t connections = 0;
+			std::uint64_t error = 0;
+			std::array<std::uint64_t, 9> replies = {};
+			std::uint64_t bytesSent = 0;
+			std::uint64_t bytesReceived = 0;
+			Clock::duration connectTime = Clock::duration::zero();
+		};
+
+		// at most half of the index is used
+		static std::size_t IndexSize(std::size_t capacity)
+		{
+			std::size_t size = 16;
+
+			while (size < capacity * 2) {
+				size *= 2;
+			}
+
+			return size;
+		}
+
+		static bool MakeKey(const RawAddress& dest, Key& key)
+		{
+			const unsigned char* bytes = dest.data();
+
+			switch (dest.atyp) {
+				case AddressType::IPV4:
+					key.atyp = AddressType::IPV4;
+					key.size = 3;
+					std::copy(bytes, bytes + 3, key.bytes.begin());
+					return true;
+				case AddressType::IPV6: {
+					// ::ffff:0:0/96
+					static const unsigned char v4Mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+					if (std::equal(v4Mapped, v4Mapped + 12, bytes)) {
+						key.atyp = AddressType::IPV4;
+						key.size = 3;
+						std::copy(bytes + 12, bytes + 15, key.bytes.begin());
+						return true;
+					}
+					key.atyp = AddressType::IPV6;
+					key.size = 6;
+					std::copy(bytes, bytes + 6, key.bytes.begin());
+					return true;
+				}
+				case AddressType::DomainName:
+					key.atyp = AddressType::DomainName;
+					key.size = bytes[0];
+					std::transform(bytes + 1, bytes + 1 + key.size, key.bytes.begin(), [](unsigned char c) {
+						return c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c - 'A' + 'a') : c;
+					});
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		// FNV-1a
+		static std::uint64_t Hash(const Key& key)
+		{
+			std::uint64_t hash = (14695981039346656037ull ^ static_cast<unsigned char>(key.atyp)) * 1099511628211ull;
+
+			for (std::size_t i = 0; i < key.size; ++i) {
+				hash = (hash ^ key.bytes[i]) * 1099511628211ull;
+			}
+
+			return hash;
+		}
+
+		static std::string ToString(const Key& key)
+		{
+			switch (key.atyp) {
+				case AddressType::IPV4:
+					return std::to_string(key.bytes[0]) + "." + std::to_string(key.bytes[1]) + "." + std::to_string(key.bytes[2]) + ".0/24";
+				case AddressType::IPV6: {
+					boost::asio::ip::address_v6::bytes_type bytes{};
+					std::copy(key.bytes.begin(), key.bytes.begin() + 6, bytes.begin());
+					return boost::asio::ip::address_v6(bytes).to_string() + "/48";
+				}
+				default:
+					return std::string(key.bytes.begin(), key.bytes.begin() + key.size);
+			}
+		}
+
+		std::uint32_t find(const Key& key, std::uint64_t hash) const
+		{
+			std::size_t mask = index_.size() - 1;
+
+			for (std::size_t i = hash & mask; index_[i] != None; i = (i + 1) & mask) {
+
+				const Slot& slot = slots_[index_[i]];
+
+				if (slot.hash == hash && slot.key == key) {
+					return index_[i];
+				}
+			}
+
+			return None;
+		}
+
+		// Gives the destination a free slot or the one of the fewest connections.
+		std::uint32_t take(const Key& key, std::uint64_t hash)
+		{
+			std::uint32_t index;
+
+			if (heap_.size() < slots_.size()) {
+				index = static_cast<std::uint32_t>(heap_.size());
+				slots_[index].heapIndex = index;
+				slots_[index].connections = 0;
+				heap_.push_back(index);
+				siftUp(index);
+			}
+			else {
+				index = heap_[0];
+				unindex(index);
+			}
+
+			Slot& slot = slots_[index];
+			std::uint32_t heapIndex = slot.heapIndex;
+			std::uint64_t connections = slot.connections;
+
+			slot = Slot();
+			slot.key = key;
+			slot.hash = hash;
+			slot.heapIndex = heapIndex;
+			slot.connections = connections;
+			slot.error = connections;
+
+			std::size_t mask = index_.size() - 1;
+			std::size_t i = hash & mask;
+
+			while (index_[i] != None) {
+				i = (i + 1) & mask;
+			}
+
+			index_[i] = index;
+
+			return index;
+		}
+
+		// Removes the slot from the index, shifting the entries of the probe sequence back.
+		void unindex(std::uint32_t index)
+		{
+			std::size_t mask = index_.size() - 1;
+			std::size_t i = slots_[index].hash & mask;
+
+			while (index_[i] != index) {
+				i = (i + 1) & mask;
+			}
+
+			for (std::size_t j = (i + 1) & mask; index_[j] != None; j = (j + 1) & mask) {
+
+				std::size_t home = slots_[index_[j]].hash & mask;
+
+				// the entry at j may fill the hole at i unless its home lies cyclically in (i, j]
+				if (((j - home) & mask) >= ((j - i) & mask)) {
+					index_[i] = index_[j];
+					i = j;
+				}
+			}
+
+			index_[i] = None;
+		}
+
+		// Restores the min-heap of the slots by their connections after one has been added.
+		void siftUp(std::uint32_t position)
+		{
+			while (position > 0) {
+
+				std::uint32_t parent = (position - 1) / 2;
+
+				if (slots_[heap_[parent]].connections <= slots_[heap_[position]].connections) {
+					return;
+				}
+
+				std::swap(heap_[position], heap_[parent]);
+				slots_[heap_[position]].heapIndex = position;
+				slots_[heap_[parent]].heapIndex = parent;
+
+				position = parent;
+			}
+		}
+
+		// Restores the min-heap of the slots by their connections after one has grown.
+		void siftDown(std::uint32_t position)
+		{
+			std::size_t size = heap_.size();
+
+			for (;;) {
+
+				std::size_t smallest = position;
+				std::size_t left = 2 * position + 1;
+				std::size_t right = left + 1;
+
+				if (left < size && slots_[heap_[left]].connections < slots_[heap_[smallest]].connections) {
+					smallest = left;
+				}
+				if (right < size && slots_[heap_[right]].connections < slots_[heap_[smallest]].connections) {
+					smallest = right;
+				}
+				if (smallest == position) {
+					return;
+				}
+
+				std::swap(heap_[position], heap_[smallest]);
+				slots_[heap_[position]].heapIndex = position;
+				slots_[heap_[smallest]].heapIndex = static_cast<std::uint32_t>(smallest);
+
+				position = static_cast<std::uint32_t>(smallest);
+			}
+		}
+
+		mutable std::mutex mutex_;
+		std::vector<Slot> slots_;
+		// the slots by the hashes of their destinations
+		std::vector<std::uint32_t> index_;
+		// the used slots by their connections, the fewest first
+		std::vector<std::uint32_t> heap_;
+		std::uint64_t connections_ = 0;
+	};
+
+}}
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "../asio/config.h"
+#include <boost/asio/buffer.hpp>
+#include <boost/system/error_code.hpp>
+
+#include "errc.h"
+#include "meth_req.h"
+#include "meth_reply.h"
+#include "user_pass_req.h"
+#include "user_pass_reply.h"
+#include "cmd_req.h"
+#include "cmd_reply.h"
+
+namespace Sari { namespace Socks5 {
+
+	// The bytes received from a connection and not parsed yet. It is kept for the whole
+	// handshake, so the bytes of a message a client has pipelined after the previous one
+	// wait here for their parser.
+	class RecvBuffer {
+	public:
+
+		// more than a method request and a command request together
+		static constexpr std::size_t Capacity = 1024;
+
+		const unsigned char* data() const
+		{
+			return data_.data() + begin_;
+		}
+
+		std::size_t size() const
+		{
+			return end_ - begin_;
+		}
+
+		bool empty() const
+		{
+			return begin_ == end_;
+		}
+
+		void consume(std::size_t bytes)
+		{
+			begin_ += std::min(bytes, size());
+
+			if (begin_ == end_) {
+				begin_ = end_ = 0;
+			}
+		}
+
+		// The free space to read into, the unparsed bytes are moved to the front first.
+		boost::asio::mutable_buffer prepare()
+		{
+			if (begin_ != 0) {
+				std::memmove(data_.data(), data_.data() + begin_, size());
+				end_ -= begin_;
+				begin_ = 0;
+			}
+
+			return boost::asio::buffer(data_.data() + end_, Capacity - end_);
+		}
+
+		void commit(std::size_t bytes)
+		{
+			end_ = std::min(end_ + bytes, Capacity);
+		}
+
+	private:
+		std::array<unsigned char, Capacity> data_;
+		std::size_t begin_ = 0;
+		std::size_t end_ = 0;
+	};
+
+	// Parses a method request from pieces of any size. It never consumes a byte past the end
+	// of the request.
+	class MethodRequestParser {
+	public:
+
+		using Message = MethodRequest;
+
+		// Consumes the bytes of the request from the front of the data and returns their
+		// number. On a malformed request the error is set.
+		std::size_t parse(const unsigned char* data, std::size_t size, boost::system::error_code& ec)
+		{
+			std::size_t consumed = 0;
+
+			while (consumed < size && state_ != State::Done) {
+				switch (state_) {
+					case State::Ver:
+						if (data[consumed] != ProtocolVersion) {
+							ec = make_error_code(Socks5Errc::InvalidProtocolVersion);
+							return consumed;
+						}
+						raw_.ver = data[consumed++];
+						state_ = State::NMethods;
+					break;
+					case State::NMethods:
+						raw_.nmethods = data[consumed++];
+						received_ = 0;
+						state_ = raw_.nmethods != 0 ? State::Methods : State::Done;
+					break;
+					case State::Methods: {
+						std::size_t bytes = std::min<std::size_t>(raw_.nmethods - received_, size - consumed);
+						std::memcpy(raw_.methods + received_, data + consumed, bytes);
+						consumed += bytes;
+						received_ += bytes;
+						if (received_ == raw_.nmethods) {
+							state_ = State::Done;
+						}
+					} break;
+					default:
+					break;
+				}
+			}
+
+			return consumed;
+		}
+
+		bool done() const
+		{
+			return state_ == State::Done;
+		}
+
+		Message message() const
+		{
+			return MethodRequest{raw_};
+		}
+
+	private:
+
+		enum class State { Ver, NMethods, Methods, Done };
+
+		State state_ = State::Ver;
+		std::size_t received_ = 0;
+		RawMethodRequest raw_;
+	};
+
+	// Parses a method reply from pieces of any size.
+	class MethodReplyParser {
+	public:
+
+		using Message = MethodReply;
+
+		std::size_t parse(const unsigned char* data, std::size_t size, boost::system::error_code& ec)
+		{
+			std::size_t consumed = 0;
+
+			if (received_ == 0 && consumed < size) {
+				if (data[consumed] != ProtocolVersion) {
+					ec = make_error_code(Socks5Errc::InvalidProtocolVersion);
+					return consumed;
+				}
+				raw_.ver = data[consumed++];
+				++received_;
+			}
+
+			if (received_ == 1 && consumed < size) {
+				raw_.method = static_cast<Method>(data[consumed++]);
+				++received_;
+			}
+
+			return consumed;
+		}
+
+		bool done() const
+		{
+			return received_ == 2;
+		}
+
+		Message message() const
+		{
+			return MethodReply{raw_};
+		}
+
+	private:
+		std::size_t received_ = 0;
+		RawMethodReply raw_;
+	};
+
+	// Parses a username/password request from pieces of any size.
+	class UserPassRequestParser {
+	public:
+
+		using Message = UserPassRequest;
+
+		std::size_t parse(const unsigned char* data, std::size_t size, boost::system::error_code& ec)
+		{
+			std::size_t consumed = 0;
+
+			while (consumed < size && state_ != State::Done) {
+				switch (state_) {
+					case State::Ver:
+						if (data[consumed] != UserPassVersion) {
+							ec = make_error_code(Socks5Errc::InvalidProtocolVersion);
+							return consumed;
+						}
+						raw_.ver = data[consumed++];
+						state_ = State::ULen;
+					break;
+					case State::ULen:
+						raw_.ulen = data[consumed++];
+						received_ = 0;
+						state_ = State::UName;
+					break;
+					case State::UName:
+						consumed += take(raw_.uname, raw_.ulen, data + consumed, size - consumed);
+						if (received_ == raw_.ulen) {
+							state_ = State::PLen;
+						}
+					break;
+					case State::PLen:
+						raw_.plen = data[consumed++];
+						received_ = 0;
+						state_ = raw_.plen != 0 ? State::Passwd : State::Done;
+					break;
+					case State::Passwd:
+						consumed += take(raw_.passwd, raw_.plen, data + consumed, size - consumed);
+						if (received_ == raw_.plen) {
+							state_ = State::Done;
+						}
+					break;
+					default:
+					break;
+				}
+			}
+
+			return consumed;
+		}
+
+		bool done() const
+		{
+			return state_ == State::Done;
+		}
+
+		Message message() const
+		{
+			return UserPassRequest{raw_};
+		}
+
+	private:
+
+		enum class State { Ver, ULen, UName, PLen, Passwd, Done };
+
+		std::size_t take(char* field, std::size_t expected, const unsigned char* data, std::size_t size)
+		{
+			std::size_t bytes = std::min(expected - received_, size);
+			std::memcpy(field + received_, data, bytes);
+			received_ += bytes;
+			return bytes;
+		}
+
+		State state_ = State::Ver;
+		std::size_t received_ = 0;
+		RawUserPassRequest raw_;
+	};
+
+	// Parses a username/password reply from pieces of any size.
+	class UserPassReplyParser {
+	public:
+
+		using Message = UserPassReply;
+
+		std::size_t parse(const unsigned char* data, std::size_t size, boost::system::error_code& ec)
+		{
+			std::size_t consumed = 0;
+
+			if (received_ == 0 && consumed < size) {
+				if (data[consumed] != UserPassVersion) {
+					ec = make_error_code(Socks5Errc::InvalidProtocolVersion);
+					return consumed;
+				}
+				raw_.ver = data[consumed++];
+				++received_;
+			}
+
+			if (received_ == 1 && consumed < size) {
+				raw_.status = data[consumed++];
+				++received_;
+			}
+
+			return consumed;
+		}
+
+		bool done() const
+		{
+			return received_ == 2;
+		}
+
+		Message message() const
+		{
+			return UserPassReply{raw_};
+		}
+
+	private:
+		std::size_t received_ = 0;
+		RawUserPassReply raw_;
+	};
+
+	// Parses the messages made of a version, a code, a reserved byte and an address, i.e.
+	// command requests and command replies, from pieces of any size. It never consumes a byte
+	// past the end of the message.
+	class AddressMessageParser {
+	public:
+
+		std::size_t parse(const unsigned char* data, std::size_t size, boost::system::error_code& ec)
+		{
+			std::size_t consumed = 0;
+
+			while (consumed < size && state_ != State::Done) {
+				switch (state_) {
+					case State::Ver:
+						if (data[consumed] != ProtocolVersion) {
+							ec = make_error_code(Socks5Errc::InvalidProtocolVersion);
+							return consumed;
+						}
+						ver_ = data[consumed++];
+						state_ = State::Code;
+					break;
+					case State::Code:
+						code_ = data[consumed++];
+						state_ = State::Rsv;
+					break;
+					case State::Rsv:
+						rsv_ = data[consumed++];
+						state_ = State::Atyp;
+					break;
+					case State::Atyp: {
+						auto atyp = static_cast<AddressType>(data[consumed++]);
+						received_ = 0;
+						switch (atyp) {
+							case AddressType::IPV4:
+							case AddressType::IPV6:
+								expected_ = atyp == AddressType::IPV4 ? 4 : 16;
+								addr_.assign(atyp, expected_);
+								state_ = State::Addr;
+							break;
+							case AddressType::DomainName:
+								state_ = State::Length;
+							break;
+							default:
+								ec = make_error_code(Socks5Errc::InvalidAddressType);
+								return consumed;
+						}
+					} break;
+					case State::Length:
+						// the length stays in front of the name
+						expected_ = data[consumed] + 1;
+						addr_.assign(AddressType::DomainName, expected_)[0] = data[consumed++];
+						received_ = 1;
+						state_ = State::Addr;
+					break;
+					case State::Addr:
+						consumed += take(addr_.data(), data + consumed, size - consumed);
+						if (received_ == expected_) {
+							expected_ = sizeof(addr_.port);
+							received_ = 0;
+							state_ = State::Port;
+						}
+					break;
+					case State::Port:
+						consumed += take(reinterpret_cast<unsigned char*>(&addr_.port), data + consumed, size - consumed);
+						if (received_ == expected_) {
+							state_ = State::Done;
+						}
+					break;
+					default:
+					break;
+				}
+			}
+
+			return consumed;
+		}
+
+		bool done() const
+		{
+			return state_ == State::Done;
+		}
+
+	protected:
+
+		enum class State { Ver, Code, Rsv, Atyp, Length, Addr, Port, Done };
+
+		// Copies the bytes the field still misses.
+		std::size_t take(unsigned char* field, const unsigned char* data, std::size_t size)
+		{
+			std::size_t bytes = std::min(expected_ - received_, size);
+			std::memcpy(field + received_, data, bytes);
+			received_ += bytes;
+			return bytes;
+		}
+
+		State state_ = State::Ver;
+		std::size_t expected_ = 0;
+		std::size_t received_ = 0;
+
+		unsigned char ver_ = 0;
+		unsigned char code_ = 0;
+		unsigned char rsv_ = 0;
+		RawAddress addr_;
+	};
+
+	class CommandRequestParser : public AddressMessageParser {
+	public:
+
+		using Message = CommandRequest;
+
+		Message message() const
+		{
+			return CommandRequest{RawCommandRequest{ ver_, static_cast<Command>(code_), rsv_, addr_ }};
+		}
+	};
+
+	class CommandReplyParser : public AddressMessageParser {
+	public:
+
+		using Message = CommandReply;
+
+		Message message() const
+		{
+			return CommandReply{RawCommandReply{ ver_, static_cast<Reply>(code_), rsv_, addr_ }};
+		}
+	};
+
+}}
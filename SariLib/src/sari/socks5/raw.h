@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstring>
+
 namespace Sari { namespace Socks5 {
 
 	const unsigned char ProtocolVersion = 0x05;
@@ -46,10 +49,142 @@ namespace Sari { namespace Socks5 {
 		Method method;
 	};
 
-	struct RawAddress {
-		AddressType atyp;
-		unsigned char addr[256];
-		unsigned short port;
+	// the version of the username/password subnegotiation, RFC 1929
+	const unsigned char UserPassVersion = 0x01;
+
+	struct RawUserPassRequest {
+		unsigned char ver;
+		unsigned char ulen;
+		char uname[255];
+		unsigned char plen;
+		char passwd[255];
+	};
+
+	struct RawUserPassReply {
+		unsigned char ver;
+		unsigned char status;
+	};
+
+	// An address as it is sent: the type, the bytes of the address and the port in network
+	// byte order. The bytes are an IPv4 or an IPv6 address or a domain name preceded by its
+	// length. They are held inline up to InlineSize, only longer domain names are allocated,
+	// so an address is cheap to copy and to move.
+	class RawAddress {
+	public:
+
+		static constexpr std::size_t InlineSize = 32;
+
+		AddressType atyp = AddressType::IPV4;
+		unsigned short port = 0;
+
+		RawAddress()
+		{
+			std::memset(inline_, 0, sizeof(inline_));
+		}
+
+		RawAddress(const RawAddress& other) :
+			atyp(other.atyp),
+			port(other.port)
+		{
+			std::memcpy(assign(other.atyp, other.size_), other.data(), other.size_);
+		}
+
+		RawAddress(RawAddress&& other) noexcept :
+			atyp(other.atyp),
+			port(other.port)
+		{
+			steal(other);
+		}
+
+		RawAddress& operator= (const RawAddress& other)
+		{
+			if (this != &other) {
+				std::memcpy(assign(other.atyp, other.size_), other.data(), other.size_);
+				port = other.port;
+			}
+			return *this;
+		}
+
+		RawAddress& operator= (RawAddress&& other) noexcept
+		{
+			if (this != &other) {
+				release();
+				atyp = other.atyp;
+				port = other.port;
+				steal(other);
+			}
+			return *this;
+		}
+
+		~RawAddress()
+		{
+			release();
+		}
+
+		// The bytes of the address as they are sent, without the type and the port.
+		const unsigned char* data() const
+		{
+			return size_ > InlineSize ? heap_ : inline_;
+		}
+
+		unsigned char* data()
+		{
+			return size_ > InlineSize ? heap_ : inline_;
+		}
+
+		std::size_t size() const
+		{
+			return size_;
+		}
+
+		// Sets the type and the number of the bytes of the address, and returns where to
+		// write them.
+		unsigned char* assign(AddressType type, std::size_t size)
+		{
+			release();
+
+			if (size > InlineSize) {
+				heap_ = new unsigned char[size];
+			}
+
+			atyp = type;
+			size_ = static_cast<unsigned short>(size);
+
+			return data();
+		}
+
+	private:
+
+		void release()
+		{
+			if (size_ > InlineSize) {
+				delete[] heap_;
+			}
+			size_ = 4;
+		}
+
+		void steal(RawAddress& other)
+		{
+			size_ = other.size_;
+
+			if (other.size_ > InlineSize) {
+				heap_ = other.heap_;
+				// the moved-from address is 0.0.0.0, not a domain name read from the pointer
+				other.atyp = AddressType::IPV4;
+				other.size_ = 4;
+				std::memset(other.inline_, 0, sizeof(other.inline_));
+			}
+			else {
+				std::memcpy(inline_, other.inline_, other.size_);
+			}
+		}
+
+		unsigned short size_ = 4;
+
+		union {
+			unsigned char inline_[InlineSize];
+			unsigned char* heap_;
+		};
 	};
 
 	struct RawCommandRequest {
@@ -5,12 +5,89 @@
 #include "errc.h"
 #include "meth_req.h"
 #include "meth_reply.h"
+#include "user_pass_req.h"
+#include "user_pass_reply.h"
 #include "cmd_req.h"
 #include "cmd_reply.h"
+#include "parser.h"
 #include "../asio/asio.h"
 
 namespace Sari { namespace Socks5 {
 
+	// The bytes of the address without the type, empty for an unknown type.
+	inline boost::asio::const_buffer AddressBuffer(const RawAddress& addr)
+	{
+		switch (addr.atyp) {
+			case AddressType::IPV4:
+			case AddressType::DomainName:
+			case AddressType::IPV6:
+				return boost::asio::buffer(addr.data(), addr.size());
+			default:
+				return boost::asio::const_buffer();
+		}
+	}
+
+	template<typename Stream, typename Parser>
+	void AsyncParseMore(
+		Stream& stream,
+		RecvBuffer& buffer,
+		std::shared_ptr<Parser> parser,
+		Sari::Utils::AnyFunction resolve,
+		Sari::Utils::AnyFunction reject
+	) {
+		stream.async_read_some(
+			buffer.prepare(),
+			[&stream, &buffer, parser, resolve, reject](const boost::system::error_code& ec, std::size_t bytesTransferred) {
+				if (ec) {
+					reject(ec);
+					return;
+				}
+
+				buffer.commit(bytesTransferred);
+
+				boost::system::error_code parseEc;
+				buffer.consume(parser->parse(buffer.data(), buffer.size(), parseEc));
+
+				if (parseEc) {
+					reject(parseEc);
+				}
+				else if (parser->done()) {
+					resolve(parser->message());
+				}
+				else {
+					AsyncParseMore(stream, buffer, parser, resolve, reject);
+				}
+			}
+		);
+	}
+
+	// Parses a message from the buffer and reads from the stream only while the buffered bytes
+	// do not complete it. Each read takes whatever has arrived, up to the free space of the
+	// buffer, so the bytes past the end of the message are left in the buffer for the next one.
+	template<typename Parser, typename Stream>
+	Sari::Utils::Promise AsyncParse(Stream& stream, RecvBuffer& buffer)
+	{
+		auto parser = std::make_shared<Parser>();
+
+		boost::system::error_code ec;
+		buffer.consume(parser->parse(buffer.data(), buffer.size(), ec));
+
+		if (ec) {
+			return Sari::Utils::Promise::Reject(stream.get_executor(), ec);
+		}
+		if (parser->done()) {
+			return Sari::Utils::Promise::Resolve(stream.get_executor(), parser->message());
+		}
+
+		return Sari::Utils::Promise(
+			stream.get_executor(),
+			[&](Sari::Utils::AnyFunction resolve, Sari::Utils::AnyFunction reject) {
+				AsyncParseMore(stream, buffer, parser, resolve, reject);
+			},
+			Sari::Utils::Promise::Async
+		);
+	}
+
 	template<typename Stream>
 	Sari::Utils::Promise AsyncSendMethodRequest(Stream& stream, const MethodRequest& methReq)
 	{
@@ -56,6 +133,13 @@ namespace Sari { namespace Socks5 {
 		});
 	}
 
+	// Receives a method request through the buffer of the connection, usually with one read.
+	template<typename Stream>
+	Sari::Utils::Promise AsyncRecvMethodRequest(Stream& stream, RecvBuffer& buffer)
+	{
+		return AsyncParse<MethodRequestParser>(stream, buffer);
+	}
+
 	template<typename Stream>
 	Sari::Utils::Promise AsyncSendMethodReply(Stream& stream, const MethodReply& methReply)
 	{
@@ -98,6 +182,57 @@ namespace Sari { namespace Socks5 {
 		});
 	}
 
+	template<typename Stream>
+	Sari::Utils::Promise AsyncSendUserPassRequest(Stream& stream, const UserPassRequest& userPassReq)
+	{
+		using Sari::Asio::AsyncWriteSome;
+		using boost::asio::buffer;
+
+		auto raw = std::make_shared<RawUserPassRequest>(userPassReq.getRaw());
+
+		boost::array<boost::asio::const_buffer, 5> buffers;
+
+		buffers[0] = buffer(&raw->ver, sizeof(raw->ver));
+		buffers[1] = buffer(&raw->ulen, sizeof(raw->ulen));
+		buffers[2] = buffer(raw->uname, raw->ulen);
+		buffers[3] = buffer(&raw->plen, sizeof(raw->plen));
+		buffers[4] = buffer(raw->passwd, raw->plen);
+
+		return AsyncWriteSome(
+			stream, buffers
+		).then([raw]() {
+			return UserPassRequest{*raw};
+		});
+	}
+
+	// Receives a username/password request through the buffer of the connection.
+	template<typename Stream>
+	Sari::Utils::Promise AsyncRecvUserPassRequest(Stream& stream, RecvBuffer& buffer)
+	{
+		return AsyncParse<UserPassRequestParser>(stream, buffer);
+	}
+
+	template<typename Stream>
+	Sari::Utils::Promise AsyncSendUserPassReply(Stream& stream, const UserPassReply& userPassReply)
+	{
+		using Sari::Asio::AsyncWriteSome;
+		using boost::asio::buffer;
+
+		auto raw = std::make_shared<RawUserPassReply>(userPassReply.getRaw());
+
+		return AsyncWriteSome(
+			stream, buffer(raw.get(), sizeof(*raw))
+		).then([raw]() {
+			return UserPassReply{*raw};
+		});
+	}
+
+	template<typename Stream>
+	Sari::Utils::Promise AsyncRecvUserPassReply(Stream& stream, RecvBuffer& buffer)
+	{
+		return AsyncParse<UserPassReplyParser>(stream, buffer);
+	}
+
 	template<typename Stream>
 	Sari::Utils::Promise AsyncSendCommandRequest(Stream& stream, const CommandRequest& cmdReq)
 	{
@@ -112,25 +247,15 @@ namespace Sari { namespace Socks5 {
 		buffers[1] = buffer(&raw->cmd, sizeof(raw->cmd));
 		buffers[2] = buffer(&raw->rsv, sizeof(raw->rsv));
 		buffers[3] = buffer(&raw->dest.atyp, sizeof(raw->dest.atyp));
+		buffers[4] = AddressBuffer(raw->dest);
+		buffers[5] = buffer(&raw->dest.port, sizeof(raw->dest.port));
 
-		switch (raw->dest.atyp) {
-			case AddressType::IPV4:
-				buffers[4] = buffer(raw->dest.addr, 4);
-			break;
-			case AddressType::DomainName:
-				buffers[4] = buffer(raw->dest.addr, raw->dest.addr[0] + 1);
-			break;
-			case AddressType::IPV6:
-				buffers[4] = buffer(raw->dest.addr, 6);
-			break;
-			default:
-				return Sari::Utils::Promise::Reject(
-					stream.get_executor(), make_error_code(Socks5Errc::InvalidAddressType)
-				);
+		if (buffers[4].size() == 0) {
+			return Sari::Utils::Promise::Reject(
+				stream.get_executor(), make_error_code(Socks5Errc::InvalidAddressType)
+			);
 		}
 
-		buffers[5] = buffer(&raw->dest.port, sizeof(raw->dest.port));
-
 		return AsyncWriteSome(
 			stream, buffers
 		).then([raw]() {
@@ -162,15 +287,21 @@ namespace Sari { namespace Socks5 {
 		}).then([&stream, raw]() {
 			switch (raw->dest.atyp) {
 				case AddressType::IPV4:
-					return AsyncRead(stream, buffer(raw->dest.addr, 4));
-				case AddressType::DomainName:
+					return AsyncRead(stream, buffer(raw->dest.assign(AddressType::IPV4, 4), 4));
+				case AddressType::DomainName: {
+
+					auto length = std::make_shared<unsigned char>();
+
 					return AsyncRead(
-						stream, buffer(&raw->dest.addr[0], 1) // length
-					).then([&stream, raw]() {
-						return AsyncRead(stream, buffer(&raw->dest.addr[1], raw->dest.addr[0]));
+						stream, buffer(length.get(), 1)
+					).then([&stream, raw, length]() {
+						unsigned char* bytes = raw->dest.assign(AddressType::DomainName, *length + 1);
+						bytes[0] = *length;
+						return AsyncRead(stream, buffer(bytes + 1, *length));
 					});
+				}
 				case AddressType::IPV6:
-					return AsyncRead(stream, buffer(raw->dest.addr, 16));
+					return AsyncRead(stream, buffer(raw->dest.assign(AddressType::IPV6, 16), 16));
 				default:
 					return Sari::Utils::Promise::Reject(
 						stream.get_executor(), make_error_code(Socks5Errc::InvalidAddressType)
@@ -185,6 +316,14 @@ namespace Sari { namespace Socks5 {
 		});
 	}
 
+	// Receives a command request through the buffer of the connection, usually with one read
+	// or none when the client has sent it along with the method request.
+	template<typename Stream>
+	Sari::Utils::Promise AsyncRecvCommandRequest(Stream& stream, RecvBuffer& buffer)
+	{
+		return AsyncParse<CommandRequestParser>(stream, buffer);
+	}
+
 	template<typename Stream>
 	Sari::Utils::Promise AsyncSendCommandReply(Stream& stream, const CommandReply& cmdReply)
 	{
@@ -199,25 +338,15 @@ namespace Sari { namespace Socks5 {
 		buffers[1] = buffer(&raw->rep, sizeof(raw->rep));
 		buffers[2] = buffer(&raw->rsv, sizeof(raw->rsv));
 		buffers[3] = buffer(&raw->bind.atyp, sizeof(raw->bind.atyp));
+		buffers[4] = AddressBuffer(raw->bind);
+		buffers[5] = buffer(&raw->bind.port, sizeof(raw->bind.port));
 
-		switch (raw->bind.atyp) {
-			case AddressType::IPV4:
-				buffers[4] = buffer(raw->bind.addr, 4);
-			break;
-			case AddressType::DomainName:
-				buffers[4] = buffer(raw->bind.addr, raw->bind.addr[0] + 1);
-			break;
-			case AddressType::IPV6:
-				buffers[4] = buffer(raw->bind.addr, 6);
-			break;
-			default:
-				return Sari::Utils::Promise::Reject(
-					stream.get_executor(), make_error_code(Socks5Errc::InvalidAddressType)
-				);
+		if (buffers[4].size() == 0) {
+			return Sari::Utils::Promise::Reject(
+				stream.get_executor(), make_error_code(Socks5Errc::InvalidAddressType)
+			);
 		}
 
-		buffers[5] = buffer(&raw->bind.port, sizeof(raw->bind.port));
-
 		return AsyncWriteSome(
 			stream, buffers
 		).then([raw]() {
@@ -249,15 +378,21 @@ namespace Sari { namespace Socks5 {
 		}).then([&stream, raw]() {
 			switch (raw->bind.atyp) {
 				case AddressType::IPV4:
-					return AsyncRead(stream, buffer(raw->bind.addr, 4));
-				case AddressType::DomainName:
+					return AsyncRead(stream, buffer(raw->bind.assign(AddressType::IPV4, 4), 4));
+				case AddressType::DomainName: {
+
+					auto length = std::make_shared<unsigned char>();
+
 					return AsyncRead(
-						stream, buffer(&raw->bind.addr[0], 1) // length
-					).then([&stream, raw]() {
-						return AsyncRead(stream, buffer(&raw->bind.addr[1], raw->bind.addr[0]));
+						stream, buffer(length.get(), 1)
+					).then([&stream, raw, length]() {
+						unsigned char* bytes = raw->bind.assign(AddressType::DomainName, *length + 1);
+						bytes[0] = *length;
+						return AsyncRead(stream, buffer(bytes + 1, *length));
 					});
+				}
 				case AddressType::IPV6:
-					return AsyncRead(stream, buffer(raw->bind.addr, 16));
+					return AsyncRead(stream, buffer(raw->bind.assign(AddressType::IPV6, 16), 16));
 				default:
 					return Sari::Utils::Promise::Reject(
 						stream.get_executor(), make_error_code(Socks5Errc::InvalidAddressType)
@@ -272,4 +407,95 @@ namespace Sari { namespace Socks5 {
 		});
 	}
 
+	// Receives a command reply through the buffer of the connection, the bytes the proxy has
+	// relayed right after it are left in the buffer.
+	template<typename Stream>
+	Sari::Utils::Promise AsyncRecvCommandReply(Stream& stream, RecvBuffer& buffer)
+	{
+		return AsyncParse<CommandReplyParser>(stream, buffer);
+	}
+
+	// Asks the SOCKS5 proxy at the other end of the stream to connect to the target, without
+	// authentication. The method request, the command request and the payload, typically the
+	// first message of the application, are sent with one write, and both replies are parsed
+	// from the buffer, so the connection is ready after one round trip instead of two.
+	// Resolves with the command reply, whose code tells whether the proxy has connected. The
+	// bytes the proxy has relayed right after the reply are left in the buffer.
+	template<typename Stream>
+	Sari::Utils::Promise AsyncConnectVia(
+		Stream& stream,
+		RecvBuffer& buffer,
+		const CommandRequest& target,
+		const std::string& payload = std::string()
+	) {
+		auto methReq = std::make_shared<RawMethodRequest>(MethodRequest{ std::vector<Method>{ Method::NoAuthRequired } }.getRaw());
+		auto cmdReq = std::make_shared<RawCommandRequest>(target.getRaw());
+		auto data = std::make_shared<std::string>(payload);
+
+		boost::array<boost::asio::const_buffer, 10> buffers;
+
+		buffers[0] = boost::asio::buffer(&methReq->ver, sizeof(methReq->ver));
+		buffers[1] = boost::asio::buffer(&methReq->nmethods, sizeof(methReq->nmethods));
+		buffers[2] = boost::asio::buffer(methReq->methods, methReq->nmethods);
+		buffers[3] = boost::asio::buffer(&cmdReq->ver, sizeof(cmdReq->ver));
+		buffers[4] = boost::asio::buffer(&cmdReq->cmd, sizeof(cmdReq->cmd));
+		buffers[5] = boost::asio::buffer(&cmdReq->rsv, sizeof(cmdReq->rsv));
+		buffers[6] = boost::asio::buffer(&cmdReq->dest.atyp, sizeof(cmdReq->dest.atyp));
+		buffers[7] = AddressBuffer(cmdReq->dest);
+		buffers[8] = boost::asio::buffer(&cmdReq->dest.port, sizeof(cmdReq->dest.port));
+		buffers[9] = boost::asio::buffer(*data);
+
+		if (buffers[7].size() == 0) {
+			return Sari::Utils::Promise::Reject(
+				stream.get_executor(), make_error_code(Socks5Errc::InvalidAddressType)
+			);
+		}
+
+		return Sari::Utils::Promise(
+			stream.get_executor(),
+			[&](Sari::Utils::AnyFunction resolve, Sari::Utils::AnyFunction reject) {
+				boost::asio::async_write(stream, buffers,
+					[=](const boost::system::error_code& ec, std::size_t) {
+						if (ec) {
+							reject(ec);
+						}
+						else {
+							resolve();
+						}
+					});
+			},
+			Sari::Utils::Promise::Async
+		).then([&stream, &buffer, methReq, cmdReq, data]() {
+			return AsyncParse<MethodReplyParser>(stream, buffer);
+		}).then([&stream, &buffer](MethodReply methReply) {
+			if (methReply.getMethod() != Method::NoAuthRequired) {
+				return Sari::Utils::Promise::Reject(
+					stream.get_executor(), make_error_code(Socks5Errc::NoAcceptableMethods)
+				);
+			}
+			return AsyncRecvCommandReply(stream, buffer);
+		});
+	}
+
+	template<typename Stream>
+	Sari::Utils::Promise AsyncConnectVia(
+		Stream& stream,
+		RecvBuffer& buffer,
+		const boost::asio::ip::tcp::endpoint& target,
+		const std::string& payload = std::string()
+	) {
+		return AsyncConnectVia(stream, buffer, CommandRequest{ Command::Connect, target }, payload);
+	}
+
+	template<typename Stream>
+	Sari::Utils::Promise AsyncConnectVia(
+		Stream& stream,
+		RecvBuffer& buffer,
+		const std::string& host,
+		unsigned short port,
+		const std::string& payload = std::string()
+	) {
+		return AsyncConnectVia(stream, buffer, CommandRequest{ Command::Connect, host, port }, payload);
+	}
+
 }}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstring>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+#include "raw.h"
+
+namespace Sari { namespace Socks5 {
+
+	// The header a SOCKS5 client puts in front of each datagram it sends through the relay
+	// and the relay in front of each datagram it returns:
+	//   RSV(2) FRAG(1) ATYP DST.ADDR DST.PORT
+	// The header is parsed and built in place, in the buffer of the datagram.
+	struct UdpHeader {
+
+		// the size of the headers of IPv6 addresses, the largest the relay builds
+		static constexpr std::size_t MaxIpSize = 4 + 16 + 2;
+
+		// the bytes of the header
+		std::size_t size = 0;
+		// the position of the datagram in a fragmented sequence, 0 if it stands alone
+		unsigned char frag = 0;
+		AddressType atyp = AddressType::IPV4;
+		// the destination of an IPv4 or IPv6 header
+		boost::asio::ip::udp::endpoint endpoint;
+		// the destination of a domain name header, not null-terminated
+		const char* domainName = nullptr;
+		std::size_t domainNameSize = 0;
+		unsigned short port = 0;
+
+		// Parses the header at the front of the datagram. Returns false if the datagram is
+		// too short or the address type is unknown.
+		bool parse(const unsigned char* data, std::size_t length)
+		{
+			if (length < 4 || data[0] != 0 || data[1] != 0) {
+				return false;
+			}
+
+			frag = data[2];
+			atyp = static_cast<AddressType>(data[3]);
+
+			const unsigned char* addr = data + 4;
+			std::size_t addrSize;
+
+			switch (atyp) {
+				case AddressType::IPV4:
+					addrSize = 4;
+				break;
+				case AddressType::IPV6:
+					addrSize = 16;
+				break;
+				case AddressType::DomainName:
+					if (length < 5) {
+						return false;
+					}
+					addrSize = 1 + data[4];
+				break;
+				default:
+					return false;
+			}
+
+			size = 4 + addrSize + 2;
+
+			if (length < size) {
+				return false;
+			}
+
+			port = static_cast<unsigned short>((addr[addrSize] << 8) | addr[addrSize + 1]);
+
+			if (atyp == AddressType::IPV4) {
+				boost::asio::ip::address_v4::bytes_type bytes;
+				std::memcpy(bytes.data(), addr, bytes.size());
+				endpoint = boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(bytes), port);
+			}
+			else if (atyp == AddressType::IPV6) {
+				boost::asio::ip::address_v6::bytes_type bytes;
+				std::memcpy(bytes.data(), addr, bytes.size());
+				endpoint = boost::asio::ip::udp::endpoint(boost::asio::ip::address_v6(bytes), port);
+			}
+			else {
+				domainName = reinterpret_cast<const char*>(addr + 1);
+				domainNameSize = addr[0];
+			}
+
+			return true;
+		}
+
+		// The size of the header for the address.
+		static std::size_t SizeFor(const boost::asio::ip::udp::endpoint& endpoint)
+		{
+			return endpoint.address().is_v4() ? 4 + 4 + 2 : MaxIpSize;
+		}
+
+		// Writes the header for the source right in front of the payload and returns where
+		// the datagram begins. There must be SizeFor(source) bytes in front of the payload.
+		static unsigned char* Prepend(unsigned char* payload, const boost::asio::ip::udp::endpoint& source)
+		{
+			unsigned char* header = payload - SizeFor(source);
+			unsigned char* addr = header + 4;
+
+			header[0] = 0;
+			header[1] = 0;
+			header[2] = 0;
+
+			if (source.address().is_v4()) {
+				header[3] = static_cast<unsigned char>(AddressType::IPV4);
+				auto bytes = source.address().to_v4().to_bytes();
+				std::memcpy(addr, bytes.data(), bytes.size());
+				addr += bytes.size();
+			}
+			else {
+				header[3] = static_cast<unsigned char>(AddressType::IPV6);
+				auto bytes = source.address().to_v6().to_bytes();
+				std::memcpy(addr, bytes.data(), bytes.size());
+				addr += bytes.size();
+			}
+
+			addr[0] = static_cast<unsigned char>(source.port() >> 8);
+			addr[1] = static_cast<unsigned char>(source.port() & 0xff);
+
+			return header;
+		}
+
+	};
+
+}}
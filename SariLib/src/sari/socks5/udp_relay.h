@@ -0,0 +1,565 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+#if defined(SARI_HAS_MMSG)
+#include <cerrno>
+#include <sys/socket.h>
+#endif
+
+#include "../utils/promise.h"
+#include "access_policy.h"
+#include "socks5.h"
+#include "udp.h"
+
+namespace Sari { namespace Socks5 {
+
+	// Relays the datagrams of one UDP association. The client sends its datagrams with a UDP
+	// header to the client socket, the relay strips the header and sends the payload to the
+	// destination. The datagrams the destinations send back are returned to the client with
+	// the header of their source.
+	//
+	// A relay only accepts replies from the destinations the client has sent to within the
+	// idle timeout (the NAT table). The datagrams are received and sent in place in buffers
+	// allocated once, in batches with recvmmsg(2) and sendmmsg(2) where SARI_HAS_MMSG is
+	// defined. Datagrams to domain names and fragments are dropped.
+	class UdpRelay : public std::enable_shared_from_this<UdpRelay> {
+	public:
+
+		using udp = boost::asio::ip::udp;
+		using Clock = std::chrono::steady_clock;
+
+		struct Options {
+			// the datagrams received with one call
+			std::size_t batchSize = 32;
+			// the largest payload relayed, longer datagrams are dropped
+			std::size_t maxDatagramSize = 2048;
+			// how long a destination may reply after the client has last sent to it
+			std::chrono::milliseconds idleTimeout = std::chrono::seconds(60);
+			// the destinations of the NAT table, datagrams to new destinations are dropped
+			// while it is full
+			std::size_t maxDestinations = 4096;
+			// the datagrams to destinations its current policy denies are dropped, a destination
+			// is checked as it enters the NAT table
+			const AccessControl* accessControl = nullptr;
+		};
+
+		struct Stats {
+			// datagrams relayed from the client to the destinations
+			std::uint64_t sent = 0;
+			// datagrams relayed from the destinations to the client
+			std::uint64_t received = 0;
+			std::uint64_t dropped = 0;
+			// the calls receiving datagrams
+			std::uint64_t batches = 0;
+		};
+
+		// Opens the client socket on the local endpoint. Only the datagrams of the client are
+		// accepted, from any of its ports if the port of the client is 0.
+		UdpRelay(
+			boost::asio::any_io_executor ioExecutor,
+			const udp::endpoint& localEndpoint,
+			const udp::endpoint& client,
+			const Options& options
+		) :
+			options_(options),
+			client_(client),
+			clientSocket_(ioExecutor, localEndpoint),
+			upstreamSockets_{ udp::socket(ioExecutor), udp::socket(ioExecutor) },
+			fromClient_(options.batchSize, options.maxDatagramSize + MaxClientHeaderSize + 1),
+			fromUpstream_(options.batchSize, options.maxDatagramSize + 1),
+			sweepTimer_(ioExecutor)
+		{
+			clientSocket_.non_blocking(true);
+		}
+
+		udp::endpoint localEndpoint() const
+		{
+			return clientSocket_.local_endpoint();
+		}
+
+		const Stats& stats() const
+		{
+			return stats_;
+		}
+
+		std::size_t destinations() const
+		{
+			return nat_.size();
+		}
+
+		void start()
+		{
+			waitForClient();
+			sweep();
+		}
+
+		void stop()
+		{
+			if (stopped_) {
+				return;
+			}
+
+			stopped_ = true;
+
+			boost::system::error_code ec;
+
+			clientSocket_.close(ec);
+			upstreamSockets_[0].close(ec);
+			upstreamSockets_[1].close(ec);
+			sweepTimer_.cancel();
+		}
+
+	private:
+
+		// a domain name header
+		static constexpr std::size_t MaxClientHeaderSize = 4 + 256 + 2;
+
+		struct Datagram {
+			// where a datagram is received to, there is room for a header in front of it
+			unsigned char* data;
+			std::size_t size;
+			// the source of a received datagram, the destination of one to send
+			udp::endpoint endpoint;
+			// the bytes to send
+			const unsigned char* begin;
+			std::size_t length;
+		};
+
+		// Datagrams received and sent with one call.
+		class Batch {
+		public:
+
+			Batch(std::size_t size, std::size_t capacity) :
+				capacity_(capacity),
+				storage_(size * (UdpHeader::MaxIpSize + capacity)),
+				datagrams_(size)
+#if defined(SARI_HAS_MMSG)
+				, headers_(size),
+				iovecs_(size)
+#endif
+			{
+				for (std::size_t i = 0; i < size; ++i) {
+					datagrams_[i].data = storage_.data() + i * (UdpHeader::MaxIpSize + capacity) + UdpHeader::MaxIpSize;
+				}
+			}
+
+			Datagram& operator[] (std::size_t i)
+			{
+				return datagrams_[i];
+			}
+
+			// Receives the datagrams waiting on the socket without blocking. A datagram longer
+			// than the capacity gets the size of the capacity plus one.
+			std::size_t receive(udp::socket& socket, boost::system::error_code& ec)
+			{
+#if defined(SARI_HAS_MMSG)
+				for (std::size_t i = 0; i < datagrams_.size(); ++i) {
+					iovecs_[i].iov_base = datagrams_[i].data;
+					iovecs_[i].iov_len = capacity_;
+					std::memset(&headers_[i], 0, sizeof(headers_[i]));
+					headers_[i].msg_hdr.msg_name = datagrams_[i].endpoint.data();
+					headers_[i].msg_hdr.msg_namelen = static_cast<socklen_t>(datagrams_[i].endpoint.capacity());
+					headers_[i].msg_hdr.msg_iov = &iovecs_[i];
+					headers_[i].msg_hdr.msg_iovlen = 1;
+				}
+
+				int count = ::recvmmsg(socket.native_handle(), headers_.data(), static_cast<unsigned int>(headers_.size()), MSG_DONTWAIT, nullptr);
+
+				if (count < 0) {
+					if (errno != EAGAIN && errno != EWOULDBLOCK) {
+						ec.assign(errno, boost::system::system_category());
+					}
+					return 0;
+				}
+
+				for (int i = 0; i < count; ++i) {
+					datagrams_[i].size = (headers_[i].msg_hdr.msg_flags & MSG_TRUNC) ? capacity_ + 1 : headers_[i].msg_len;
+					datagrams_[i].endpoint.resize(headers_[i].msg_hdr.msg_namelen);
+				}
+
+				return static_cast<std::size_t>(count);
+#else
+				std::size_t count = 0;
+
+				while (count < datagrams_.size()) {
+
+					Datagram& datagram = datagrams_[count];
+					datagram.size = socket.receive_from(boost::asio::buffer(datagram.data, capacity_), datagram.endpoint, 0, ec);
+
+					if (ec == boost::asio::error::message_size) {
+						datagram.size = capacity_ + 1;
+					}
+					else if (ec == boost::asio::error::connection_reset) {
+						// an ICMP error of an earlier datagram
+						ec.clear();
+						continue;
+					}
+					else if (ec) {
+						if (ec == boost::asio::error::would_block) {
+							ec.clear();
+						}
+						break;
+					}
+
+					ec.clear();
+					++count;
+				}
+
+				return count;
+#endif
+			}
+
+			// Sends the datagrams from first to last to their endpoints without blocking.
+			// Returns the number of the datagrams the socket has not taken.
+			std::size_t send(udp::socket& socket, std::size_t first, std::size_t last)
+			{
+				std::size_t unsent = 0;
+#if defined(SARI_HAS_MMSG)
+				for (std::size_t i = first; i < last; ++i) {
+					iovecs_[i].iov_base = const_cast<unsigned char*>(datagrams_[i].begin);
+					iovecs_[i].iov_len = datagrams_[i].length;
+					std::memset(&headers_[i], 0, sizeof(headers_[i]));
+					headers_[i].msg_hdr.msg_name = datagrams_[i].endpoint.data();
+					headers_[i].msg_hdr.msg_namelen = static_cast<socklen_t>(datagrams_[i].endpoint.size());
+					headers_[i].msg_hdr.msg_iov = &iovecs_[i];
+					headers_[i].msg_hdr.msg_iovlen = 1;
+				}
+
+				while (first < last) {
+
+					int count = ::sendmmsg(socket.native_handle(), &headers_[first], static_cast<unsigned int>(last - first), MSG_DONTWAIT);
+
+					if (count > 0) {
+						first += count;
+					}
+					else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						unsent += last - first;
+						break;
+					}
+					else {
+						// the datagram cannot be sent to its destination, the others may be
+						++unsent;
+						++first;
+					}
+				}
+#else
+				for (std::size_t i = first; i < last; ++i) {
+
+					boost::system::error_code ec;
+					socket.send_to(boost::asio::buffer(datagrams_[i].begin, datagrams_[i].length), datagrams_[i].endpoint, 0, ec);
+
+					if (ec) {
+						++unsent;
+					}
+				}
+#endif
+				return unsent;
+			}
+
+		private:
+			std::size_t capacity_;
+			std::vector<unsigned char> storage_;
+			std::vector<Datagram> datagrams_;
+#if defined(SARI_HAS_MMSG)
+			std::vector<mmsghdr> headers_;
+			std::vector<iovec> iovecs_;
+#endif
+		};
+
+		struct EndpointHash {
+			std::size_t operator() (const udp::endpoint& endpoint) const
+			{
+				std::size_t hash = endpoint.port();
+
+				if (endpoint.address().is_v4()) {
+					return hash ^ (static_cast<std::size_t>(endpoint.address().to_v4().to_uint()) << 16);
+				}
+
+				for (unsigned char byte : endpoint.address().to_v6().to_bytes()) {
+					hash = hash * 31 + byte;
+				}
+
+				return hash;
+			}
+		};
+
+		void waitForClient()
+		{
+			clientSocket_.async_wait(udp::socket::wait_read, [self = shared_from_this()](const boost::system::error_code& ec) {
+				if (!ec && !self->stopped_) {
+					self->relayFromClient();
+					self->waitForClient();
+				}
+			});
+		}
+
+		void waitForUpstream(std::size_t family)
+		{
+			upstreamSockets_[family].async_wait(udp::socket::wait_read, [self = shared_from_this(), family](const boost::system::error_code& ec) {
+				if (!ec && !self->stopped_) {
+					self->relayFromUpstream(family);
+					self->waitForUpstream(family);
+				}
+			});
+		}
+
+		void relayFromClient()
+		{
+			boost::system::error_code ec;
+			std::size_t count = fromClient_.receive(clientSocket_, ec);
+
+			++stats_.batches;
+
+			auto now = Clock::now();
+			std::size_t relayed = 0;
+
+			for (std::size_t i = 0; i < count; ++i) {
+
+				Datagram& datagram = fromClient_[i];
+				UdpHeader header;
+
+				if (!acceptClient(datagram.endpoint)
+					|| !header.parse(datagram.data, datagram.size)
+					|| header.frag != 0
+					|| header.atyp == AddressType::DomainName
+					|| datagram.size - header.size > options_.maxDatagramSize
+					|| !admit(header.endpoint, now)
+				) {
+					++stats_.dropped;
+					continue;
+				}
+
+				Datagram& out = fromClient_[relayed++];
+
+				out.begin = datagram.data + header.size;
+				out.length = datagram.size - header.size;
+				out.endpoint = header.endpoint;
+			}
+
+			// the runs of datagrams of one address family are sent with one call
+			for (std::size_t first = 0; first < relayed; ) {
+
+				std::size_t family = fromClient_[first].endpoint.address().is_v4() ? 0 : 1;
+				std::size_t last = first + 1;
+
+				while (last < relayed && (fromClient_[last].endpoint.address().is_v4() ? 0 : 1) == family) {
+					++last;
+				}
+
+				// a family the host cannot send to drops its datagrams
+				std::size_t unsent = openUpstream(family) ? fromClient_.send(upstreamSockets_[family], first, last) : last - first;
+
+				stats_.sent += last - first - unsent;
+				stats_.dropped += unsent;
+
+				first = last;
+			}
+		}
+
+		void relayFromUpstream(std::size_t family)
+		{
+			boost::system::error_code ec;
+			std::size_t count = fromUpstream_.receive(upstreamSockets_[family], ec);
+
+			++stats_.batches;
+
+			auto now = Clock::now();
+			std::size_t relayed = 0;
+
+			for (std::size_t i = 0; i < count; ++i) {
+
+				Datagram& datagram = fromUpstream_[i];
+
+				auto entry = nat_.find(datagram.endpoint);
+
+				if (entry == nat_.end() || now - entry->second > options_.idleTimeout || datagram.size > options_.maxDatagramSize) {
+					++stats_.dropped;
+					continue;
+				}
+
+				Datagram& out = fromUpstream_[relayed++];
+				unsigned char* begin = UdpHeader::Prepend(datagram.data, datagram.endpoint);
+
+				out.length = datagram.size + (datagram.data - begin);
+				out.begin = begin;
+				out.endpoint = client_;
+			}
+
+			std::size_t unsent = fromUpstream_.send(clientSocket_, 0, relayed);
+
+			stats_.received += relayed - unsent;
+			stats_.dropped += unsent;
+		}
+
+		// Whether the datagram comes from the client. The port of the client is learnt from
+		// its first datagram unless it was given.
+		bool acceptClient(const udp::endpoint& source)
+		{
+			if (source.address() != client_.address()) {
+				return false;
+			}
+
+			if (client_.port() == 0) {
+				client_.port(source.port());
+			}
+
+			return source.port() == client_.port();
+		}
+
+		// Notes the destination in the NAT table unless the table is full or the access control
+		// denies it.
+		bool admit(const udp::endpoint& destination, Clock::time_point now)
+		{
+			auto entry = nat_.find(destination);
+
+			if (entry != nat_.end()) {
+				entry->second = now;
+				return true;
+			}
+
+			if (nat_.size() >= options_.maxDestinations) {
+				return false;
+			}
+
+			if (options_.accessControl
+				&& options_.accessControl->policy()->evaluate(destination.address()) != AccessPolicy::Action::Allow
+			) {
+				return false;
+			}
+
+			nat_.emplace(destination, now);
+
+			return true;
+		}
+
+		// Opens the socket to the destinations of the family on the first datagram to one of
+		// them. Returns false if it cannot be opened, e.g. on a host without IPv6.
+		bool openUpstream(std::size_t family)
+		{
+			udp::socket& socket = upstreamSockets_[family];
+
+			if (socket.is_open()) {
+				return true;
+			}
+
+			udp protocol = family == 0 ? udp::v4() : udp::v6();
+			boost::system::error_code ec;
+
+			socket.open(protocol, ec);
+
+			if (!ec) {
+				socket.bind(udp::endpoint(protocol, 0), ec);
+			}
+			if (!ec) {
+				socket.non_blocking(true, ec);
+			}
+			if (ec) {
+				socket.close(ec);
+				return false;
+			}
+
+			waitForUpstream(family);
+
+			return true;
+		}
+
+		// Removes the destinations idle for the timeout.
+		void sweep()
+		{
+			sweepTimer_.expires_after(options_.idleTimeout);
+			sweepTimer_.async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+				if (ec || self->stopped_) {
+					return;
+				}
+
+				auto now = Clock::now();
+
+				for (auto it = self->nat_.begin(); it != self->nat_.end(); ) {
+					if (now - it->second > self->options_.idleTimeout) {
+						it = self->nat_.erase(it);
+					}
+					else {
+						++it;
+					}
+				}
+
+				self->sweep();
+			});
+		}
+
+		Options options_;
+		udp::endpoint client_;
+		udp::socket clientSocket_;
+		// the sockets to the IPv4 and the IPv6 destinations, opened on the first datagram
+		std::array<udp::socket, 2> upstreamSockets_;
+		Batch fromClient_;
+		Batch fromUpstream_;
+		std::unordered_map<udp::endpoint, Clock::time_point, EndpointHash> nat_;
+		boost::asio::steady_timer sweepTimer_;
+		Stats stats_;
+		bool stopped_ = false;
+	};
+
+	template<typename Socket>
+	void AsyncWaitClosed(Socket& socket, std::shared_ptr<std::array<char, 512>> junk, Sari::Utils::AnyFunction resolve)
+	{
+		socket.async_read_some(boost::asio::buffer(*junk), [&socket, junk, resolve](const boost::system::error_code& ec, std::size_t) {
+			if (ec) {
+				resolve();
+			}
+			else {
+				AsyncWaitClosed(socket, junk, resolve);
+			}
+		});
+	}
+
+	// Serves a UDP ASSOCIATE request received on the control connection. It opens a relay on
+	// the local address of the connection, sends the reply and relays the datagrams of the
+	// client until it closes the connection, as RFC 1928 defines. Resolves with UdpRelay::Stats.
+	template<typename Socket>
+	Sari::Utils::Promise AsyncUdpAssociate(Socket& control, CommandRequest cmdReq, UdpRelay::Options options = UdpRelay::Options())
+	{
+		using udp = boost::asio::ip::udp;
+
+		// the client tells its port, its address may be the one behind a NAT
+		udp::endpoint client(control.remote_endpoint().address(), cmdReq.dest().getPort());
+
+		auto relay = std::make_shared<UdpRelay>(
+			control.get_executor(), udp::endpoint(control.local_endpoint().address(), 0), client, options
+		);
+
+		relay->start();
+
+		boost::asio::ip::tcp::endpoint bound(relay->localEndpoint().address(), relay->localEndpoint().port());
+
+		Sari::Utils::Promise promise = AsyncSendCommandReply(control, CommandReply{ Reply::Succeeded, bound })
+			.then([&control]() {
+				return Sari::Utils::Promise(
+					control.get_executor(),
+					[&](Sari::Utils::AnyFunction resolve, Sari::Utils::AnyFunction) {
+						AsyncWaitClosed(control, std::make_shared<std::array<char, 512>>(), resolve);
+					},
+					Sari::Utils::Promise::Async
+				);
+			}).then([relay]() {
+				relay->stop();
+				return relay->stats();
+			});
+
+		promise.finalize([relay](Sari::Utils::Promise) {
+			relay->stop();
+		});
+
+		return promise;
+	}
+
+}}
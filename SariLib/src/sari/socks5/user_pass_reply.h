@@ -0,0 +1,37 @@
+#pragma once
+
+#include "raw.h"
+
+namespace Sari { namespace Socks5 {
+
+	class UserPassReply {
+	public:
+
+		// Any status but 0 tells the client the authentication has failed.
+		UserPassReply(bool succeeded)
+		{
+			userPassReply_.ver = UserPassVersion;
+			userPassReply_.status = succeeded ? 0x00 : 0x01;
+		}
+
+		UserPassReply(const RawUserPassReply& userPassReply) :
+			userPassReply_(userPassReply)
+		{}
+
+		const RawUserPassReply& getRaw() const
+		{
+			return userPassReply_;
+		}
+
+		bool succeeded() const
+		{
+			return userPassReply_.status == 0x00;
+		}
+
+	private:
+
+		RawUserPassReply userPassReply_;
+
+	};
+
+}}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+#include "raw.h"
+
+namespace Sari { namespace Socks5 {
+
+	class UserPassRequest {
+	public:
+
+		UserPassRequest(std::string_view username, std::string_view password)
+		{
+			if (username.size() > sizeof(RawUserPassRequest::uname) || password.size() > sizeof(RawUserPassRequest::passwd)) {
+				throw std::out_of_range("too long username or password");
+			}
+
+			userPassReq_.ver = UserPassVersion;
+			userPassReq_.ulen = static_cast<unsigned char>(username.size());
+			userPassReq_.plen = static_cast<unsigned char>(password.size());
+
+			std::memcpy(userPassReq_.uname, username.data(), username.size());
+			std::memcpy(userPassReq_.passwd, password.data(), password.size());
+		}
+
+		UserPassRequest(const RawUserPassRequest& userPassReq) :
+			userPassReq_(userPassReq)
+		{}
+
+		const RawUserPassRequest& getRaw() const
+		{
+			return userPassReq_;
+		}
+
+		std::string_view username() const
+		{
+			return std::string_view(userPassReq_.uname, userPassReq_.ulen);
+		}
+
+		std::string_view password() const
+		{
+			return std::string_view(userPassReq_.passwd, userPassReq_.plen);
+		}
+
+	private:
+
+		RawUserPassRequest userPassReq_;
+
+	};
+
+}}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "transfer_tee.h"
+
+namespace Sari { namespace Stream { namespace Transfer {
+
+	// Writes the data of a tee to a file from a thread of its own, so slow storage never holds
+	// up a relay. Frames are collected in a large buffer and written sequentially, the buffer is
+	// also flushed after the queue has been empty for the flush interval.
+	//
+	// The file starts with the 8 bytes of Magic followed by frames. A frame is a 16 byte header
+	// of little-endian integers and the data:
+	//   u64 the time of the read in microseconds since the Unix epoch
+	//   u32 the transfer, see Finalizer::id()
+	//   u32 the length of the data in bits 0-29, GapFlag and DirectionFlag
+	// A gap frame has no data, its length is the number of bytes the tee has dropped.
+	class CaptureFile : public TeeSink {
+	public:
+
+		static constexpr char Magic[8] = { 'S', 'A', 'R', 'I', 'C', 'A', 'P', '\x01' };
+		static constexpr std::size_t FrameHeaderSize = 16;
+		static constexpr std::uint32_t LengthMask = (1u << 30) - 1;
+		static constexpr std::uint32_t GapFlag = 1u << 30;
+		// set for the second direction of a transfer
+		static constexpr std::uint32_t DirectionFlag = 1u << 31;
+
+		explicit CaptureFile(
+			const std::string& path,
+			std::size_t writeSize = 1024 * 1024,
+			std::chrono::milliseconds flushInterval = std::chrono::milliseconds(100)
+		) :
+			buffer_(writeSize),
+			flushInterval_(flushInterval)
+		{
+			file_.rdbuf()->pubsetbuf(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+			file_.open(path, std::ios::binary | std::ios::trunc);
+
+			if (!file_) {
+				throw std::runtime_error("cannot open the capture file " + path);
+			}
+
+			file_.write(Magic, sizeof(Magic));
+
+			thread_ = std::thread([this]() { run(); });
+		}
+
+		~CaptureFile()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+
+			queueChanged_.notify_one();
+			thread_.join();
+		}
+
+		void write(TeeChunk chunk) override
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				queue_.push_back(Frame{ std::move(chunk), 0, 0, 0, std::chrono::system_clock::time_point() });
+			}
+
+			queueChanged_.notify_one();
+		}
+
+		void dropped(std::uint32_t transfer, std::size_t direction, std::size_t bytes) override
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				queue_.push_back(Frame{ std::nullopt, transfer, direction, bytes, std::chrono::system_clock::now() });
+			}
+
+			queueChanged_.notify_one();
+		}
+
+		// The number of bytes written to the file, including the headers.
+		std::uint64_t bytesWritten() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return bytesWritten_;
+		}
+
+	private:
+
+		struct Frame {
+			// empty for a gap
+			std::optional<TeeChunk> chunk;
+			std::uint32_t transfer;
+			std::size_t direction;
+			std::size_t size;
+			std::chrono::system_clock::time_point time;
+		};
+
+		void run()
+		{
+			std::vector<Frame> frames;
+
+			for (;;) {
+
+				bool stopping;
+
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+
+					if (queue_.empty() && !stopping_) {
+						if (!queueChanged_.wait_for(lock, flushInterval_, [this]() { return !queue_.empty() || stopping_; })) {
+							lock.unlock();
+							file_.flush();
+							continue;
+						}
+					}
+
+					frames.swap(queue_);
+					stopping = stopping_;
+				}
+
+				std::uint64_t bytes = 0;
+
+				for (auto& frame : frames) {
+					bytes += writeFrame(frame);
+				}
+
+				// the chunks return their buffers here
+				frames.clear();
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					bytesWritten_ += bytes;
+				}
+
+				if (stopping) {
+					file_.flush();
+					return;
+				}
+			}
+		}
+
+		std::size_t writeFrame(const Frame& frame)
+		{
+			std::uint32_t transfer = frame.chunk ? frame.chunk->transfer() : frame.transfer;
+			std::size_t direction = frame.chunk ? frame.chunk->direction() : frame.direction;
+			std::size_t size = frame.chunk ? frame.chunk->size() : frame.size;
+			auto time = frame.chunk ? frame.chunk->time() : frame.time;
+
+			std::uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+			std::uint32_t length = static_cast<std::uint32_t>(std::min<std::size_t>(size, LengthMask));
+
+			if (!frame.chunk) {
+				length |= GapFlag;
+			}
+			if (direction != 0) {
+				length |= DirectionFlag;
+			}
+
+			char header[FrameHeaderSize];
+			Put(header, microseconds, 8);
+			Put(header + 8, transfer, 4);
+			Put(header + 12, length, 4);
+
+			file_.write(header, sizeof(header));
+
+			if (frame.chunk) {
+				file_.write(frame.chunk->data(), static_cast<std::streamsize>(size));
+				return sizeof(header) + size;
+			}
+
+			return sizeof(header);
+		}
+
+		// Stores the lowest bytes of the value in little-endian order.
+		static void Put(char* out, std::uint64_t value, std::size_t bytes)
+		{
+			for (std::size_t i = 0; i < bytes; ++i) {
+				out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+			}
+		}
+
+		std::vector<char> buffer_;
+		std::ofstream file_;
+		std::chrono::milliseconds flushInterval_;
+
+		mutable std::mutex mutex_;
+		std::condition_variable queueChanged_;
+		std::vector<Frame> queue_;
+		std::uint64_t bytesWritten_ = 0;
+		bool stopping_ = false;
+		std::thread thread_;
+	};
+
+}}}
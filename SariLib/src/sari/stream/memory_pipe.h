@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+namespace Sari { namespace Stream {
+
+	// One end of a pipe within the process, a drop-in for boost::asio::readable_pipe and
+	// writable_pipe. Ends are connected by ConnectPipe() and may run on different threads.
+	//
+	// A write meeting a pending read copies its data straight into the buffer of the reader,
+	// so the data is copied once and no system call is made. Otherwise the data is queued in
+	// a ring of limited capacity, which is allocated on first use. A write finding the ring
+	// full waits until the reader takes the data, the reader then copies it straight from
+	// the buffer of the writer.
+	class MemoryPipe {
+	public:
+
+		using executor_type = boost::asio::any_io_executor;
+
+		static constexpr std::size_t DefaultCapacity = 64 * 1024;
+
+		explicit MemoryPipe(boost::asio::io_context& ioContext) :
+			executor_(ioContext.get_executor())
+		{}
+
+		explicit MemoryPipe(boost::asio::any_io_executor ioExecutor) :
+			executor_(ioExecutor)
+		{}
+
+		MemoryPipe(const MemoryPipe&) = delete;
+		MemoryPipe& operator= (const MemoryPipe&) = delete;
+
+		~MemoryPipe()
+		{
+			close();
+		}
+
+		executor_type get_executor()
+		{
+			return executor_;
+		}
+
+		bool is_open() const
+		{
+			return channel_ != nullptr;
+		}
+
+		// The number of bytes waiting in the ring.
+		std::size_t available() const
+		{
+			if (!channel_) {
+				return 0;
+			}
+
+			std::lock_guard<std::mutex> lock(channel_->mutex);
+			return channel_->size;
+		}
+
+		template<typename MutableBufferSequence, typename ReadHandler>
+		void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+		{
+			auto operation = MakeOperation(executor_, std::forward<ReadHandler>(handler));
+
+			if (!channel_ || !reads_) {
+				operation->complete(boost::asio::error::bad_descriptor, 0);
+				return;
+			}
+
+			channel_->read(FirstBuffer<boost::asio::mutable_buffer>(buffers), std::move(operation));
+		}
+
+		template<typename ConstBufferSequence, typename WriteHandler>
+		void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+		{
+			auto operation = MakeOperation(executor_, std::forward<WriteHandler>(handler));
+
+			if (!channel_ || reads_) {
+				operation->complete(boost::asio::error::bad_descriptor, 0);
+				return;
+			}
+
+			channel_->write(buffers, std::move(operation));
+		}
+
+		// Closes the end. The reader of a closed write end reads the queued data and then
+		// the end of the stream, the writer of a closed read end gets broken_pipe.
+		void close()
+		{
+			if (channel_) {
+				channel_->close(reads_);
+				channel_.reset();
+			}
+		}
+
+	private:
+
+		friend void ConnectPipe(MemoryPipe& readEnd, MemoryPipe& writeEnd, std::size_t capacity);
+
+		// A pending read or write, it posts the handler to its executor.
+		class Operation {
+		public:
+			virtual ~Operation() = default;
+			virtual void complete(const boost::system::error_code& ec, std::size_t bytes) = 0;
+		};
+
+		template<typename Handler>
+		class HandlerOperation : public Operation {
+		public:
+
+			HandlerOperation(const boost::asio::any_io_executor& ioExecutor, Handler&& handler) :
+				executor_(boost::asio::prefer(
+					boost::asio::get_associated_executor(handler, ioExecutor),
+					boost::asio::execution::outstanding_work.tracked
+				)),
+				handler_(std::move(handler))
+			{}
+
+			void complete(const boost::system::error_code& ec, std::size_t bytes) override
+			{
+				boost::asio::post(executor_, [handler = std::move(handler_), ec, bytes]() mutable {
+					handler(ec, bytes);
+				});
+			}
+
+		private:
+			boost::asio::any_io_executor executor_;
+			Handler handler_;
+		};
+
+		template<typename Handler>
+		static std::unique_ptr<Operation> MakeOperation(const boost::asio::any_io_executor& ioExecutor, Handler&& handler)
+		{
+			using DecayedHandler = typename std::decay<Handler>::type;
+
+			DecayedHandler decayed(std::forward<Handler>(handler));
+			return std::make_unique<HandlerOperation<DecayedHandler>>(ioExecutor, std::move(decayed));
+		}
+
+		// A read fills at most the first non-empty buffer of the sequence, a write takes all of
+		// its buffers, so the gather writes of a relay arrive at once.
+		template<typename Buffer, typename BufferSequence>
+		static Buffer FirstBuffer(const BufferSequence& buffers)
+		{
+			auto end = boost::asio::buffer_sequence_end(buffers);
+
+			for (auto it = boost::asio::buffer_sequence_begin(buffers); it != end; ++it) {
+				Buffer buffer(*it);
+				if (buffer.size() != 0) {
+					return buffer;
+				}
+			}
+
+			return Buffer();
+		}
+
+		struct Channel {
+
+			std::mutex mutex;
+			std::size_t capacity;
+
+			std::vector<char> ring;
+			std::size_t head = 0;
+			std::size_t size = 0;
+
+			std::unique_ptr<Operation> reader;
+			boost::asio::mutable_buffer readBuffer;
+			std::unique_ptr<Operation> writer;
+			// the buffers of the waiting writer, kept to reuse their storage
+			std::vector<boost::asio::const_buffer> writeBuffers;
+
+			bool readClosed = false;
+			bool writeClosed = false;
+
+			explicit Channel(std::size_t capacity) :
+				capacity(std::max<std::size_t>(capacity, 1))
+			{}
+
+			void read(boost::asio::mutable_buffer buffer, std::unique_ptr<Operation> operation)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (buffer.size() == 0) {
+					operation->complete(boost::system::error_code(), 0);
+				}
+				else if (size != 0) {
+
+					std::size_t bytes = takeFromRing(buffer);
+
+					// make room for the waiting writer
+					if (writer) {
+						std::size_t queued = putToRing(writeBuffers);
+						std::exchange(writer, nullptr)->complete(boost::system::error_code(), queued);
+					}
+
+					operation->complete(boost::system::error_code(), bytes);
+				}
+				else if (writer) {
+
+					std::size_t bytes = boost::asio::buffer_copy(buffer, writeBuffers);
+
+					std::exchange(writer, nullptr)->complete(boost::system::error_code(), bytes);
+					operation->complete(boost::system::error_code(), bytes);
+				}
+				else if (writeClosed) {
+					operation->complete(boost::asio::error::eof, 0);
+				}
+				else {
+					reader = std::move(operation);
+					readBuffer = buffer;
+				}
+			}
+
+			template<typename ConstBufferSequence>
+			void write(const ConstBufferSequence& buffers, std::unique_ptr<Operation> operation)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (readClosed) {
+					operation->complete(boost::asio::error::broken_pipe, 0);
+				}
+				else if (boost::asio::buffer_size(buffers) == 0) {
+					operation->complete(boost::system::error_code(), 0);
+				}
+				else if (reader) {
+
+					std::size_t bytes = boost::asio::buffer_copy(readBuffer, buffers);
+
+					std::exchange(reader, nullptr)->complete(boost::system::error_code(), bytes);
+					operation->complete(boost::system::error_code(), bytes);
+				}
+				else if (size < capacity) {
+					operation->complete(boost::system::error_code(), putToRing(buffers));
+				}
+				else {
+					writer = std::move(operation);
+					writeBuffers.assign(
+						boost::asio::buffer_sequence_begin(buffers),
+						boost::asio::buffer_sequence_end(buffers)
+					);
+				}
+			}
+
+			void close(bool readEnd)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (readEnd) {
+					readClosed = true;
+					ring = std::vector<char>();
+					size = 0;
+
+					if (reader) {
+						std::exchange(reader, nullptr)->complete(boost::asio::error::operation_aborted, 0);
+					}
+					if (writer) {
+						std::exchange(writer, nullptr)->complete(boost::asio::error::broken_pipe, 0);
+					}
+				}
+				else {
+					writeClosed = true;
+
+					if (writer) {
+						std::exchange(writer, nullptr)->complete(boost::asio::error::operation_aborted, 0);
+					}
+					if (reader) {
+						std::exchange(reader, nullptr)->complete(boost::asio::error::eof, 0);
+					}
+				}
+			}
+
+			std::size_t takeFromRing(boost::asio::mutable_buffer buffer)
+			{
+				std::size_t bytes = std::min(buffer.size(), size);
+				std::size_t first = std::min(bytes, ring.size() - head);
+
+				std::memcpy(buffer.data(), ring.data() + head, first);
+				std::memcpy(static_cast<char*>(buffer.data()) + first, ring.data(), bytes - first);
+
+				head = (head + bytes) % ring.size();
+				size -= bytes;
+
+				return bytes;
+			}
+
+			template<typename ConstBufferSequence>
+			std::size_t putToRing(const ConstBufferSequence& buffers)
+			{
+				if (ring.empty()) {
+					ring.resize(capacity);
+				}
+
+				std::size_t bytes = 0;
+				auto end = boost::asio::buffer_sequence_end(buffers);
+
+				for (auto it = boost::asio::buffer_sequence_begin(buffers); it != end && size < capacity; ++it) {
+					bytes += putToRing(boost::asio::const_buffer(*it));
+				}
+
+				return bytes;
+			}
+
+			std::size_t putToRing(boost::asio::const_buffer buffer)
+			{
+				std::size_t bytes = std::min(buffer.size(), capacity - size);
+				std::size_t tail = (head + size) % ring.size();
+				std::size_t first = std::min(bytes, ring.size() - tail);
+
+				std::memcpy(ring.data() + tail, buffer.data(), first);
+				std::memcpy(ring.data(), static_cast<const char*>(buffer.data()) + first, bytes - first);
+
+				size += bytes;
+
+				return bytes;
+			}
+
+		};
+
+		boost::asio::any_io_executor executor_;
+		std::shared_ptr<Channel> channel_;
+		// whether this is the read end of the channel
+		bool reads_ = false;
+
+	};
+
+	// Connects the ends so that the data written to the write end is read from the read end,
+	// as boost::asio::connect_pipe does. The pipe queues up to the capacity in bytes.
+	inline void ConnectPipe(MemoryPipe& readEnd, MemoryPipe& writeEnd, std::size_t capacity = MemoryPipe::DefaultCapacity)
+	{
+		readEnd.close();
+		writeEnd.close();
+
+		auto channel = std::make_shared<MemoryPipe::Channel>(capacity);
+
+		readEnd.channel_ = channel;
+		readEnd.reads_ = true;
+		writeEnd.channel_ = channel;
+		writeEnd.reads_ = false;
+	}
+
+}}
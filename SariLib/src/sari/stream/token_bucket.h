@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+namespace Sari { namespace Stream { namespace Transfer {
+
+	// Limits the rate of the data read by relays. Buckets form a hierarchy, e.g. a connection
+	// within a user within the whole proxy, and data passes only while every bucket up the
+	// chain holds tokens. A bucket may be shared by relays running on different threads.
+	//
+	// Relays ask how much may pass, read at most that much and then consume what they have
+	// read. Relays sharing a bucket may overdraw it a little, the debt delays their next reads.
+	class TokenBucket {
+	public:
+
+		using Clock = std::chrono::steady_clock;
+
+		// The rate is in bytes per second, zero means unlimited. The burst is the number of bytes
+		// that may pass at once after the bucket has been idle.
+		TokenBucket(double rate, double burst, std::shared_ptr<TokenBucket> parent = nullptr) :
+			rate_(rate),
+			burst_(std::max(burst, 1.0)),
+			tokens_(burst_),
+			updated_(Clock::now()),
+			started_(updated_),
+			parent_(parent)
+		{}
+
+		// The number of bytes that may pass now.
+		std::size_t available(Clock::time_point now = Clock::now())
+		{
+			std::size_t bytes = std::numeric_limits<std::size_t>::max();
+
+			for (TokenBucket* bucket = this; bucket; bucket = bucket->parent_.get()) {
+
+				std::lock_guard<std::mutex> lock(bucket->mutex_);
+
+				if (bucket->rate_ > 0) {
+					bucket->refill(now);
+					bytes = std::min(bytes, bucket->tokens_ > 0 ? static_cast<std::size_t>(bucket->tokens_) : 0);
+				}
+			}
+
+			return bytes;
+		}
+
+		// Takes the bytes that have passed from every bucket up the chain.
+		void consume(std::size_t bytes, Clock::time_point now = Clock::now())
+		{
+			for (TokenBucket* bucket = this; bucket; bucket = bucket->parent_.get()) {
+
+				std::lock_guard<std::mutex> lock(bucket->mutex_);
+
+				bucket->refill(now);
+				bucket->tokens_ -= static_cast<double>(bytes);
+				bucket->consumed_ += bytes;
+			}
+		}
+
+		// How long it takes until the given number of bytes may pass.
+		Clock::duration delay(std::size_t bytes, Clock::time_point now = Clock::now())
+		{
+			double seconds = 0;
+
+			for (TokenBucket* bucket = this; bucket; bucket = bucket->parent_.get()) {
+
+				std::lock_guard<std::mutex> lock(bucket->mutex_);
+
+				if (bucket->rate_ > 0) {
+					bucket->refill(now);
+
+					double missing = std::min(static_cast<double>(bytes), bucket->burst_) - bucket->tokens_;
+					seconds = std::max(seconds, missing / bucket->rate_);
+				}
+			}
+
+			return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+		}
+
+		void setRate(double rate, double burst)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			refill(Clock::now());
+			rate_ = rate;
+			burst_ = std::max(burst, 1.0);
+			tokens_ = std::min(tokens_, burst_);
+		}
+
+		double rate() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return rate_;
+		}
+
+		// The number of bytes that have passed the bucket.
+		std::uint64_t consumed() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return consumed_;
+		}
+
+		// The average rate of the data that has passed the bucket since it was created.
+		double achievedRate(Clock::time_point now = Clock::now()) const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			double seconds = std::chrono::duration<double>(now - started_).count();
+			return seconds > 0 ? consumed_ / seconds : 0;
+		}
+
+		const std::shared_ptr<TokenBucket>& parent() const
+		{
+			return parent_;
+		}
+
+	private:
+
+		void refill(Clock::time_point now)
+		{
+			if (now > updated_) {
+				double seconds = std::chrono::duration<double>(now - updated_).count();
+				tokens_ = std::min(burst_, tokens_ + seconds * rate_);
+				updated_ = now;
+			}
+		}
+
+		mutable std::mutex mutex_;
+		double rate_;
+		double burst_;
+		double tokens_;
+		Clock::time_point updated_;
+		Clock::time_point started_;
+		std::uint64_t consumed_ = 0;
+		std::shared_ptr<TokenBucket> parent_;
+
+	};
+
+}}}
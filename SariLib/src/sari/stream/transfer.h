@@ -1,223 +1,1276 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <utility>
 #include <memory>
 #include <functional>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include "../asio/config.h"
+#include "../asio/registered_buffers.h"
 #include <boost/asio/buffer.hpp>
 
+#if defined(SARI_HAS_SPLICE)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "../utils/promise.h"
+#include "../utils/buffer_pool.h"
+#include "../utils/timer_wheel.h"
+#include "token_bucket.h"
+#include "transfer_stage.h"
+#include "transfer_stats.h"
+#include "transfer_tee.h"
 
 namespace Sari { namespace Stream { namespace Transfer {
 
 	constexpr std::size_t EndpointBufferSize = 4096;
+	// The most buffers written by one gather write, the limit of Asio on POSIX systems.
+	constexpr std::size_t MaxCoalescedBuffers = 64;
 
+	// Shared by the relays of a transfer, it calls the handler when the last of them finishes.
 	class Finalizer {
 	public:
 
 		using Handler = std::function<void()>;
+		using StatsHandler = std::function<void(const Stats&)>;
 
 		Finalizer(Handler handler) :
-			handler_(handler)
+			handler_(handler),
+			counters_(std::make_shared<Counters>()),
+			id_(NextId())
+		{}
+
+		Finalizer(StatsHandler statsHandler) :
+			statsHandler_(statsHandler),
+			counters_(std::make_shared<Counters>()),
+			id_(NextId())
 		{}
 
 		~Finalizer()
 		{
-			handler_();
+			counters_->finish();
+
+			if (registry_) {
+				registry_->remove(*counters_);
+			}
+
+			if (statsHandler_) {
+				statsHandler_(counters_->snapshot());
+			}
+			else {
+				handler_();
+			}
+		}
+
+		// The counters of the transfer.
+		Counters& counters() { return *counters_; }
+
+		// The number of the transfer, unique within the process until it wraps around.
+		std::uint32_t id() const { return id_; }
+
+		// Publishes the counters to the registry until the transfer finishes.
+		void publish(Registry& registry)
+		{
+			if (!registry_) {
+				registry_ = &registry;
+				registry.add(counters_);
+			}
 		}
 
 	private:
 
+		static std::uint32_t NextId()
+		{
+			static std::atomic<std::uint32_t> lastId{ 0 };
+			return ++lastId;
+		}
+
 		Handler handler_;
+		StatsHandler statsHandler_;
+		std::shared_ptr<Counters> counters_;
+		std::uint32_t id_;
+		Registry* registry_ = nullptr;
 
 	};
 
-	// Holds a readable stream.
-	template<typename ReadbaleStream>
-	struct Source;
+	// Settings of a relay between two streams.
+	struct Options {
 
-	// Holds a writable stream.
-	template<typename WritableStream>
-	struct Sink;
+		// The initial and the smallest size of a buffer in bytes.
+		std::size_t bufferSize = EndpointBufferSize;
+		// The size the buffers grow to while reads keep filling them. Setting it to
+		// bufferSize disables the adaptive sizing.
+		std::size_t maxBufferSize = 256 * 1024;
+		// The number of buffers of the ring. With two or more buffers the next chunk is read
+		// while the previous one is being written.
+		std::size_t numOfBuffers = 2;
+		// Writes up to this many filled buffers with one gather write, at most MaxCoalescedBuffers.
+		// Above one, the relay keeps reading while a write is in flight and flushes what it has
+		// read with the next write, so many small segments cost a single write call. A write
+		// starts as soon as the previous one completes, the data is never held back for more.
+		std::size_t coalescedBuffers = 1;
+		// While coalescing, reading stops until a write completes once the filled buffers
+		// hold this many bytes.
+		std::size_t coalescedBytes = 64 * 1024;
+		// A read that waits at least this long resets the buffer size to bufferSize.
+		std::chrono::steady_clock::duration idleTimeout = std::chrono::seconds(1);
+		// Sockets are read without blocking and awaited to become readable before a buffer
+		// is borrowed, so idle relays hold no buffers.
+		bool waitReadable = true;
+		// Relays between two sockets with splice(2) where it is available (SARI_HAS_SPLICE).
+		// It is on by default, so every socket to socket relay splices unless this is set to
+		// false. A tee or stages turn it off, their data is relayed through buffers. The pipe
+		// between the sockets then holds up to maxBufferSize bytes, and bufferSize, numOfBuffers,
+		// the coalescing, idleTimeout and waitReadable have no effect. A relay holds a pipe only
+		// while data is moving, idle relays hold none.
+		bool splice = true;
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+		// Reads into and writes from the blocks of a pool registered with the io_context of the
+		// streams, so io_uring uses its fixed buffer operations. It is used only by relays that
+		// read with async_read_some, i.e. with waitReadable false and no splice, and that have
+		// no stages and no tee. When all blocks are borrowed a relay uses its ordinary buffers.
+		Asio::RegisteredBuffers* registeredBuffers = nullptr;
+#endif
+		// Publishes the counters of the transfer while it runs, e.g. to Registry::Global().
+		Registry* registry = nullptr;
+		// Limits the rate of each direction (indexed as in Stats) with a token bucket and its
+		// parents. A throttled relay delays its next read rather than buffering more data.
+		std::array<std::shared_ptr<TokenBucket>, 2> buckets;
+		// Wakes the throttled relays running on its executor with one shared timer. Without it
+		// every throttled relay waits on a timer of its own.
+		Utils::TimerWheel* timerWheel = nullptr;
+		// Mirrors the data of both directions to a secondary sink. Mirrored transfers are relayed
+		// through buffers, which the relays share with the sink.
+		std::shared_ptr<Tee> tee;
 
-	// Holds a readable stream.
-	template<typename ReadableStream>
-	struct Source : std::enable_shared_from_this<Source<ReadableStream>> {
+	};
 
-		char readBuff_[EndpointBufferSize] = { 0 };
-		std::size_t bytesRead_ = 0;
-		ReadableStream& readableStream_;
-		std::shared_ptr<Finalizer> finalizer_;
+	// Delays the reads of a relay according to its token bucket.
+	class Throttle {
+	public:
 
-		Source(ReadableStream& readableStream, std::shared_ptr<Finalizer> finalizer) :
-			readableStream_(readableStream),
-			finalizer_(finalizer)
+		Throttle(std::shared_ptr<TokenBucket> bucket, Utils::TimerWheel* timerWheel) :
+			bucket_(bucket),
+			timerWheel_(timerWheel)
 		{}
 
-		template<typename WritableStream>
-		void transfer(std::shared_ptr<Sink<WritableStream>> sink)
+		explicit operator bool() const { return bucket_ != nullptr; }
+
+		// The number of bytes the next read may take, up to the limit. It is zero when fewer
+		// than the wanted bytes may pass, the relay then has to wait before reading. Buckets
+		// with a burst below the wanted bytes let through what they hold once they are full.
+		std::size_t allowance(std::size_t wanted, std::size_t limit)
 		{
+			auto now = TokenBucket::Clock::now();
+			std::size_t available = bucket_->available(now);
+
+			if (available >= wanted) {
+				return std::min(available, limit);
+			}
+
+			delay_ = bucket_->delay(wanted, now);
+
+			if (available > 0 && delay_ <= TokenBucket::Clock::duration::zero()) {
+				return std::min(available, limit);
+			}
+
+			return 0;
+		}
+
+		void consume(std::size_t bytes)
+		{
+			bucket_->consume(bytes);
+		}
+
+		// Calls the handler once the bucket has refilled.
+		template<typename Executor>
+		void wait(const Executor& executor, std::function<void()> handler)
+		{
+			if (timerWheel_) {
+				timerWheel_->schedule(delay_, handler);
+				return;
+			}
+
+			if (!timer_) {
+				timer_ = std::make_unique<boost::asio::steady_timer>(executor);
+			}
+
+			timer_->expires_after(delay_);
+			timer_->async_wait([handler](const boost::system::error_code&) {
+				handler();
+			});
+		}
+
+	private:
+
+		std::shared_ptr<TokenBucket> bucket_;
+		Utils::TimerWheel* timerWheel_;
+		std::unique_ptr<boost::asio::steady_timer> timer_;
+		TokenBucket::Clock::duration delay_{};
+
+	};
+
+	// Whether the stream is an Asio stream socket.
+	template<typename Stream>
+	struct IsSocket : std::false_type {};
+
+	template<typename Protocol, typename Executor>
+	struct IsSocket<boost::asio::basic_stream_socket<Protocol, Executor>> : std::true_type {};
+
+	// Moves data from a readable stream to a writable stream through a ring of buffers.
+	// A filled buffer is handed over to the writer by advancing the ring, nothing is copied.
+	// A read is pending whenever there is a free slot and a write is pending whenever
+	// there is a filled one, so reading a chunk overlaps writing the previous chunks.
+	//
+	// Buffers are borrowed from the thread's BufferPool when a read starts and returned
+	// as soon as they have been written. Sockets are read without blocking and awaited
+	// to become readable when they have no data, so a waiting relay holds no buffer.
+	// The size of the next buffer doubles when a read fills the whole buffer, halves when
+	// a read fills less than a quarter of it and drops back to the minimum after an idle period.
+	//
+	// Filled buffers are run through the stages of the pipeline before they are written.
+	// At the end of the stream the data held by the stages is written as it is.
+	template<typename ReadableStream, typename WritableStream, typename Stages = Pipeline<>>
+	class Relay : public std::enable_shared_from_this<Relay<ReadableStream, WritableStream, Stages>> {
+	public:
+
+		Relay(
+			ReadableStream& readableStream,
+			WritableStream& writableStream,
+			std::shared_ptr<Finalizer> finalizer,
+			const Options& options,
+			std::size_t direction,
+			Stages stages = Stages()
+		) :
+			readableStream_(readableStream),
+			writableStream_(writableStream),
+			finalizer_(finalizer),
+			counters_(finalizer->counters().direction(direction)),
+			throttle_(options.buckets[direction], options.timerWheel),
+			minBufferSize_(Utils::BufferPool::ClassSize(options.bufferSize)),
+			maxBufferSize_(std::max(minBufferSize_, Utils::BufferPool::ClassSize(options.maxBufferSize))),
+			bufferSize_(minBufferSize_),
+			idleTimeout_(options.idleTimeout),
+			waitReadable_(options.waitReadable),
+			ring_(std::max<std::size_t>(options.numOfBuffers, 1)),
+			stages_(std::move(stages)),
+			tee_(options.tee),
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+			registeredBuffers_(Stages::IsEmpty && !options.tee ? options.registeredBuffers : nullptr),
+#endif
+			transfer_(finalizer->id()),
+			direction_(direction)
+		{
+			std::size_t coalesced = std::min(options.coalescedBuffers, MaxCoalescedBuffers);
+
+			if (coalesced > 1) {
+				// half of the ring is read while the other half is being written
+				ring_.resize(std::max(ring_.size(), coalesced * 2));
+				gather_.resize(coalesced);
+				coalescedBytes_ = options.coalescedBytes;
+			}
+		}
+
+		void start()
+		{
+			if constexpr (IsSocket<ReadableStream>::value) {
+				if (waitReadable_) {
+					boost::system::error_code ec;
+					readableStream_.non_blocking(true, ec);
+					waitReadable_ = !ec;
+				}
+
+				if (waitReadable_) {
+					reading_ = true;
+					readStarted_ = std::chrono::steady_clock::now();
+					waitUntilReadable();
+					return;
+				}
+			}
+
+			read();
+		}
+
+	private:
+
+		struct Chunk {
+			Utils::BufferPool::Buffer buffer;
+			// the buffer once it has been shared with the tee
+			std::shared_ptr<const Utils::BufferPool::Buffer> shared;
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+			// the registered block used instead of the buffer
+			Asio::RegisteredBuffers::Block registered;
+#endif
+			// the number of bytes held by the buffer
+			std::size_t size = 0;
+
+			const char* data() const
+			{
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+				if (registered) {
+					return registered.data();
+				}
+#endif
+				return shared ? shared->data() : buffer.data();
+			}
+
+			std::size_t capacity() const
+			{
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+				if (registered) {
+					return registered.size();
+				}
+#endif
+				return buffer.size();
+			}
+
+			// Returns the buffer to its pool.
+			void release()
+			{
+				buffer.reset();
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+				registered.reset();
+#endif
+			}
+		};
+
+		// A view of the first buffers of gather_, Asio copies buffer sequences with the operation.
+		struct GatherBuffers {
+
+			using value_type = boost::asio::const_buffer;
+			using const_iterator = const boost::asio::const_buffer*;
+
+			const boost::asio::const_buffer* buffers;
+			std::size_t count;
+
+			const_iterator begin() const { return buffers; }
+			const_iterator end() const { return buffers + count; }
+		};
+
+		void read()
+		{
+			if (reading_ || eof_ || stopped_) {
+				return;
+			}
+
+			// all buffers wait to be written, reading stalls until a write completes
+			if (filled_ == ring_.size() || filledBytes_ >= coalescedBytes_) {
+				if (!stalled_) {
+					stalled_ = true;
+					stallStarted_ = std::chrono::steady_clock::now();
+				}
+				return;
+			}
+
+			// the tee sink lags behind and the tee blocks the relays until it catches up
+			if (tee_ && tee_->blocking()) {
+				if (!teeWaiting_) {
+					teeWaiting_ = true;
+					tee_->wait([relay = this->shared_from_this()]() {
+						boost::asio::post(relay->readableStream_.get_executor(), [relay]() {
+							relay->teeWaiting_ = false;
+							relay->read();
+						});
+					});
+				}
+				return;
+			}
+
+			reading_ = true;
+			readStarted_ = std::chrono::steady_clock::now();
+
+			if constexpr (IsSocket<ReadableStream>::value) {
+				if (waitReadable_) {
+					readReady(boost::system::error_code());
+					return;
+				}
+			}
+
+			std::size_t length = readLength();
+
+			if (length == 0) {
+				return;
+			}
+
+			std::size_t tail = (head_ + filled_) % ring_.size();
+
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+			if (readRegistered(tail, length)) {
+				return;
+			}
+#endif
+
+			Chunk& chunk = prepare(tail, length);
+
+			length = std::min(length, chunk.buffer.size() - chunk.size);
+			counters_.read();
+
 			readableStream_.async_read_some(
-				boost::asio::buffer(readBuff_),
-				[source = this->shared_from_this(), sink](const boost::system::error_code& err, std::size_t bytesRead) {
+				boost::asio::buffer(chunk.buffer.data() + chunk.size, length),
+				[relay = this->shared_from_this(), tail](const boost::system::error_code& err, std::size_t bytesRead) {
+					relay->completeRead(tail, err, bytesRead);
+				}
+			);
+		}
+
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+		// Reads into a block of the registered buffers. Returns false when the relay has no
+		// pool or all its blocks are borrowed.
+		bool readRegistered(std::size_t tail, std::size_t length)
+		{
+			if (!registeredBuffers_) {
+				return false;
+			}
 
-					source->bytesRead_ = bytesRead;
+			Chunk& chunk = ring_[tail];
+			chunk.registered = registeredBuffers_->acquire();
 
-					if (err) {
+			if (!chunk.registered) {
+				return false;
+			}
 
-						source->close();
+			// the blocks have a fixed size, only the token bucket reads less than a block
+			length = throttle_ ? std::min(length, chunk.registered.size()) : chunk.registered.size();
+			counters_.read();
 
-						if (sink->bytesToWrite_ == 0) {
-							sink->close();
-						}
-						else {
-							sink->closeAfterWrite_ = true;
-						}
+			readableStream_.async_read_some(
+				chunk.registered.buffer(0, length),
+				[relay = this->shared_from_this(), tail](const boost::system::error_code& err, std::size_t bytesRead) {
+					relay->completeRead(tail, err, bytesRead);
+				}
+			);
+
+			return true;
+		}
+#endif
+
+		// Waits for the data without holding a buffer.
+		void waitUntilReadable()
+		{
+			readableStream_.async_wait(
+				boost::asio::socket_base::wait_read,
+				[relay = this->shared_from_this()](const boost::system::error_code& err) {
+					relay->readReady(err);
+				}
+			);
+		}
+
+		// Reads the available data without blocking, or waits for the socket to become
+		// readable when there is none.
+		void readReady(const boost::system::error_code& err)
+		{
+			std::size_t tail = (head_ + filled_) % ring_.size();
+
+			if (err || stopped_) {
+				completeRead(tail, err, 0);
+				return;
+			}
+
+			std::size_t length = readLength();
+
+			if (length == 0) {
+				return;
+			}
+
+			Chunk& chunk = prepare(tail, length);
+
+			length = std::min(length, chunk.buffer.size() - chunk.size);
+			counters_.read();
+
+			boost::system::error_code ec;
+			std::size_t bytesRead = readableStream_.read_some(
+				boost::asio::buffer(chunk.buffer.data() + chunk.size, length), ec
+			);
+
+			if (ec == boost::asio::error::would_block) {
+				// the buffer is kept only when the stages hold data in it
+				if (chunk.size == 0) {
+					chunk.buffer.reset();
+				}
+				waitUntilReadable();
+				return;
+			}
+
+			completeRead(tail, ec, bytesRead);
+		}
+
+		// The number of bytes the next read may take. When the token bucket is empty it is zero
+		// and the read is resumed once the bucket has refilled.
+		std::size_t readLength()
+		{
+			if (!throttle_) {
+				return bufferSize_;
+			}
+
+			std::size_t length = throttle_.allowance(std::min(minBufferSize_, bufferSize_), bufferSize_);
+
+			if (length == 0) {
+				throttle_.wait(readableStream_.get_executor(), [relay = this->shared_from_this()]() {
+					relay->reading_ = false;
+					relay->read();
+				});
+			}
+
+			return length;
+		}
+
+		// Returns the chunk the next read fills. Data held by the stages stays at the start
+		// of the chunk, its buffer grows when the held data fills it.
+		Chunk& prepare(std::size_t tail, std::size_t length)
+		{
+			Chunk& chunk = ring_[tail];
+
+			if constexpr (!Stages::IsEmpty) {
+				if (chunk.buffer && chunk.size == chunk.buffer.size()) {
 
+					auto buffer = Utils::BufferPool::Local().acquire(chunk.size + length);
+					std::memcpy(buffer.data(), chunk.buffer.data(), chunk.size);
+					chunk.buffer = std::move(buffer);
+				}
+
+				if (chunk.buffer) {
+					return chunk;
+				}
+			}
+
+			chunk.buffer = Utils::BufferPool::Local().acquire(length);
+
+			return chunk;
+		}
+
+		void completeRead(std::size_t tail, const boost::system::error_code& err, std::size_t bytesRead)
+		{
+			reading_ = false;
+
+			if (stopped_) {
+				return;
+			}
+
+			Chunk& chunk = ring_[tail];
+
+			if (err) {
+
+				// the data held by the stages is written as it is
+				if (chunk.size != 0) {
+					++filled_;
+					filledBytes_ += chunk.size;
+					mirror(chunk);
+					write();
+				}
+				else {
+					chunk.release();
+				}
+
+				eof_ = true;
+				readableStream_.close();
+
+				if (filled_ == 0) {
+					stop();
+				}
+
+				return;
+			}
+
+			if (throttle_) {
+				throttle_.consume(bytesRead);
+			}
+
+			adapt(bytesRead, chunk.capacity() - chunk.size);
+
+			if (bytesRead != 0) {
+
+				chunk.size += bytesRead;
+
+				if constexpr (!Stages::IsEmpty) {
+					if (!stagesDone_ && !runStages(chunk)) {
 						return;
 					}
-				 
-					if (sink->bytesToWrite_ == 0) {
-						sink->transfer(source);
-						source->transfer(sink);
-					}
+				}
+
+				++filled_;
+				filledBytes_ += chunk.size;
+				mirror(chunk);
+			}
+			else if (chunk.size == 0) {
+				chunk.release();
+			}
+
+			write();
+			read();
+		}
+
+		// Shares the filled chunk with the tee.
+		void mirror(Chunk& chunk)
+		{
+			if (tee_) {
+				chunk.shared = std::make_shared<const Utils::BufferPool::Buffer>(std::move(chunk.buffer));
+				tee_->mirror(chunk.shared, chunk.size, transfer_, direction_);
+			}
+		}
+
+		// Runs the filled chunk through the stages. Returns false when the relay must not
+		// pass the chunk on: it is held by a stage, or the relay has failed.
+		bool runStages(Chunk& chunk)
+		{
+			Verdict verdict = stages_.process(chunk.buffer.data(), chunk.size);
+
+			if (verdict == Verdict::Done) {
+				stagesDone_ = true;
+			}
+
+			if (verdict != Verdict::Hold) {
+				return true;
+			}
 
+			// the stages may hold no more than the largest buffer
+			if (chunk.size >= maxBufferSize_) {
+
+				chunk.buffer.reset();
+				chunk.size = 0;
+				eof_ = true;
+				readableStream_.close();
+
+				if (filled_ == 0) {
+					stop();
 				}
-			);
+
+				return false;
+			}
+
+			read();
+
+			return false;
 		}
 
-		void close()
+		void write()
 		{
-			readableStream_.close();
+			if (writing_ || stopped_ || filled_ == 0) {
+				return;
+			}
+
+			writing_ = true;
+
+			auto handler = [relay = this->shared_from_this()](const boost::system::error_code& err, std::size_t bytesWritten) {
+				relay->completeWrite(err, bytesWritten);
+			};
+
+			Chunk& chunk = ring_[head_];
+
+			if (filled_ == 1 || gather_.size() < 2) {
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+				if (chunk.registered) {
+					writableStream_.async_write_some(
+						chunk.registered.buffer(bytesWritten_, chunk.size - bytesWritten_),
+						handler
+					);
+					return;
+				}
+#endif
+				writableStream_.async_write_some(
+					boost::asio::buffer(chunk.data() + bytesWritten_, chunk.size - bytesWritten_),
+					handler
+				);
+				return;
+			}
+
+			std::size_t count = std::min(filled_, gather_.size());
+
+			for (std::size_t i = 0; i < count; ++i) {
+
+				Chunk& filled = ring_[(head_ + i) % ring_.size()];
+				std::size_t offset = i == 0 ? bytesWritten_ : 0;
+
+				gather_[i] = boost::asio::const_buffer(filled.data() + offset, filled.size - offset);
+			}
+
+			writableStream_.async_write_some(GatherBuffers{ gather_.data(), count }, handler);
 		}
 
-	};
+		void completeWrite(const boost::system::error_code& err, std::size_t bytesWritten)
+		{
+			writing_ = false;
+
+			if (stopped_) {
+				return;
+			}
+
+			if (err) {
+				stop();
+				readableStream_.close();
+				return;
+			}
+
+			bytesWritten_ += bytesWritten;
+			counters_.wrote(bytesWritten);
 
-	// Holds a writable stream.
-	template<typename WritableStream>
-	struct Sink : std::enable_shared_from_this<Sink<WritableStream>> {
+			// return the buffers that have been written whole to the pool
+			while (filled_ != 0 && bytesWritten_ >= ring_[head_].size) {
 
-		char writeBuff_[EndpointBufferSize] = { 0 };
-		std::size_t bytesToWrite_ = 0;
-		bool closeAfterWrite_ = false;
+				Chunk& chunk = ring_[head_];
+
+				bytesWritten_ -= chunk.size;
+				filledBytes_ -= chunk.size;
+				chunk.release();
+				chunk.shared.reset();
+				chunk.size = 0;
+				head_ = (head_ + 1) % ring_.size();
+				--filled_;
+			}
+
+			if (stalled_ && filled_ < ring_.size() && filledBytes_ < coalescedBytes_) {
+				stalled_ = false;
+				counters_.stalled(std::chrono::steady_clock::now() - stallStarted_);
+			}
+
+			if (eof_ && filled_ == 0) {
+				stop();
+				return;
+			}
+
+			write();
+			read();
+		}
+
+		// Chooses the size of the next buffer.
+		void adapt(std::size_t bytesRead, std::size_t capacity)
+		{
+			if (std::chrono::steady_clock::now() - readStarted_ >= idleTimeout_) {
+				bufferSize_ = minBufferSize_;
+			}
+			else if (bytesRead == capacity) {
+				bufferSize_ = std::min(capacity * 2, maxBufferSize_);
+			}
+			else if (bytesRead < capacity / 4) {
+				bufferSize_ = std::max(capacity / 2, minBufferSize_);
+			}
+		}
+
+		void stop()
+		{
+			stopped_ = true;
+			writableStream_.close();
+		}
+
+		ReadableStream& readableStream_;
 		WritableStream& writableStream_;
 		std::shared_ptr<Finalizer> finalizer_;
+		Counters::Direction& counters_;
+		Throttle throttle_;
+
+		std::size_t minBufferSize_;
+		std::size_t maxBufferSize_;
+		// the size of the buffer of the next read
+		std::size_t bufferSize_;
+		std::chrono::steady_clock::duration idleTimeout_;
+		std::chrono::steady_clock::time_point readStarted_;
+		bool waitReadable_;
+
+		std::vector<Chunk> ring_;
+		// the oldest filled chunk, it is being written
+		std::size_t head_ = 0;
+		std::size_t filled_ = 0;
+		std::size_t bytesWritten_ = 0;
+
+		bool reading_ = false;
+		bool writing_ = false;
+		bool eof_ = false;
+		bool stopped_ = false;
+		bool stalled_ = false;
+		std::chrono::steady_clock::time_point stallStarted_;
+
+		Stages stages_;
+		bool stagesDone_ = false;
+
+		// the filled buffers written by one gather write, empty unless coalescing
+		std::vector<boost::asio::const_buffer> gather_;
+		// the bytes held by the filled buffers
+		std::size_t filledBytes_ = 0;
+		std::size_t coalescedBytes_ = std::numeric_limits<std::size_t>::max();
+
+		std::shared_ptr<Tee> tee_;
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+		Asio::RegisteredBuffers* registeredBuffers_;
+#endif
+		std::uint32_t transfer_;
+		std::size_t direction_;
+		bool teeWaiting_ = false;
+
+	};
+
+#if defined(SARI_HAS_SPLICE)
+
+	// The empty pipes of the splice relays of a thread. A relay takes a pipe when its socket
+	// becomes readable and gives it back once it has emptied it, so the relays waiting for data
+	// hold no pipes and the busy ones reuse them without creating new ones.
+	class PipeCache {
+	public:
 
-		Sink(WritableStream& writableStream, std::shared_ptr<Finalizer> finalizer) :
+		struct Pipe {
+			int fds[2] = { -1, -1 };
+			// the size the pipe has been asked for and the bytes it holds
+			std::size_t size = 0;
+			std::size_t capacity = 0;
+
+			explicit operator bool() const { return fds[0] >= 0; }
+		};
+
+		// the pipes kept for reuse, the others are closed
+		static constexpr std::size_t MaxCachedPipes = 16;
+
+		static PipeCache& Local()
+		{
+			static thread_local PipeCache cache;
+			return cache;
+		}
+
+		PipeCache() = default;
+		PipeCache(const PipeCache&) = delete;
+		PipeCache& operator= (const PipeCache&) = delete;
+
+		~PipeCache()
+		{
+			for (Pipe& pipe : pipes_) {
+				Close(pipe);
+			}
+		}
+
+		// A pipe of the size, up to 1 MiB, a cached one or a new one. Returns an empty pipe
+		// if no pipe can be created.
+		Pipe acquire(std::size_t size)
+		{
+			for (std::size_t i = pipes_.size(); i > 0; --i) {
+				if (pipes_[i - 1].size == size) {
+					Pipe pipe = pipes_[i - 1];
+					pipes_.erase(pipes_.begin() + (i - 1));
+					return pipe;
+				}
+			}
+
+			Pipe pipe;
+
+			if (::pipe2(pipe.fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+				pipe.fds[0] = pipe.fds[1] = -1;
+				return pipe;
+			}
+
+			// the default size of the pipe is kept if it cannot be changed
+			::fcntl(pipe.fds[1], F_SETPIPE_SZ, static_cast<int>(std::min<std::size_t>(size, 1024 * 1024)));
+
+			int capacity = ::fcntl(pipe.fds[1], F_GETPIPE_SZ);
+
+			pipe.size = size;
+			pipe.capacity = capacity > 0 ? static_cast<std::size_t>(capacity) : EndpointBufferSize;
+
+			return pipe;
+		}
+
+		// Takes back an empty pipe.
+		void release(Pipe& pipe)
+		{
+			if (!pipe) {
+				return;
+			}
+
+			if (pipes_.size() < MaxCachedPipes) {
+				pipes_.push_back(pipe);
+			}
+			else {
+				Close(pipe);
+			}
+
+			pipe = Pipe();
+		}
+
+		static void Close(Pipe& pipe)
+		{
+			for (int& fd : pipe.fds) {
+				if (fd >= 0) {
+					::close(fd);
+					fd = -1;
+				}
+			}
+		}
+
+	private:
+		std::vector<Pipe> pipes_;
+	};
+
+	// Moves data from a readable socket to a writable socket through a pipe with splice(2),
+	// so the data never leaves the kernel. The sockets are polled for readiness with async_wait
+	// and spliced without blocking. The pipe is borrowed from the PipeCache of the thread while
+	// there is data to move. It closes the streams in the same way as Relay does.
+	template<typename ReadableStream, typename WritableStream>
+	class SpliceRelay : public std::enable_shared_from_this<SpliceRelay<ReadableStream, WritableStream>> {
+	public:
+
+		SpliceRelay(
+			ReadableStream& readableStream,
+			WritableStream& writableStream,
+			std::shared_ptr<Finalizer> finalizer,
+			const Options& options,
+			std::size_t direction
+		) :
+			readableStream_(readableStream),
 			writableStream_(writableStream),
-			finalizer_(finalizer)
+			finalizer_(finalizer),
+			counters_(finalizer->counters().direction(direction)),
+			throttle_(options.buckets[direction], options.timerWheel),
+			pipeSize_(options.maxBufferSize)
 		{}
 
-		template<typename ReadableStream>
-		void transfer(std::shared_ptr<Source<ReadableStream>> source)
+		~SpliceRelay()
 		{
-			bytesToWrite_ = std::exchange(source->bytesRead_, 0);
-			std::copy(source->readBuff_, source->readBuff_ + bytesToWrite_, writeBuff_);
+			// a pipe which may still hold data is not reused
+			PipeCache::Close(pipe_);
+		}
 
-			writableStream_.async_write_some(
-				boost::asio::buffer(writeBuff_, bytesToWrite_),
-				[sink = this->shared_from_this(), source](const boost::system::error_code& err, std::size_t bytesWritten) {
+		// Checks that a pipe can be created, returns false if the relay cannot be used.
+		bool open()
+		{
+			pipe_ = PipeCache::Local().acquire(pipeSize_);
 
-					sink->bytesToWrite_ = 0;
+			if (!pipe_) {
+				return false;
+			}
 
-					if (err) {
-						sink->close();
-						source->close();
-						return;
+			PipeCache::Local().release(pipe_);
+
+			boost::system::error_code ec;
+
+			readableStream_.native_non_blocking(true, ec);
+
+			if (!ec) {
+				writableStream_.native_non_blocking(true, ec);
+			}
+
+			return !ec;
+		}
+
+		void start()
+		{
+			wait(readableStream_, boost::asio::socket_base::wait_read);
+		}
+
+	private:
+
+		// The number of rounds spliced in a row before the relay yields to other handlers.
+		static constexpr int MaxRounds = 16;
+
+		static bool WouldBlock()
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+
+		// Splices as long as both sides are ready, then waits for the side that blocked.
+		// A read is awaited only when the pipe is empty, a pipe that is full by its slots
+		// rather than by its bytes would report a readable socket forever.
+		void pump()
+		{
+			if (stalled_) {
+				stalled_ = false;
+				counters_.stalled(std::chrono::steady_clock::now() - stallStarted_);
+			}
+
+			if (!pipe_) {
+
+				pipe_ = PipeCache::Local().acquire(pipeSize_);
+
+				// out of descriptors, the transfer ends as on a socket error
+				if (!pipe_) {
+					stop();
+					readableStream_.close();
+					return;
+				}
+			}
+
+			bool throttled = false;
+
+			for (int round = 0; round < MaxRounds; ++round) {
+
+				bool progress = false;
+
+				std::size_t length = pipe_.capacity - pipeBytes_;
+
+				if (!eof_ && length > 0 && throttle_) {
+					length = throttle_.allowance(std::min<std::size_t>(EndpointBufferSize, length), length);
+					throttled = length == 0;
+				}
+
+				if (!eof_ && length > 0) {
+
+					ssize_t bytesRead = ::splice(
+						readableStream_.native_handle(), nullptr, pipe_.fds[1], nullptr,
+						length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+					);
+
+					counters_.read();
+
+					if (bytesRead > 0) {
+						pipeBytes_ += static_cast<std::size_t>(bytesRead);
+						progress = true;
+
+						if (throttle_) {
+							throttle_.consume(static_cast<std::size_t>(bytesRead));
+						}
+					}
+					else if (bytesRead == 0 || (!WouldBlock() && errno != EINTR)) {
+						eof_ = true;
+						readableStream_.close();
 					}
+				}
+
+				if (pipeBytes_ > 0) {
+
+					ssize_t bytesWritten = ::splice(
+						pipe_.fds[0], nullptr, writableStream_.native_handle(), nullptr,
+						pipeBytes_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+					);
 
-					if (sink->closeAfterWrite_) {
-						sink->close();
+					counters_.wrote(bytesWritten > 0 ? static_cast<std::size_t>(bytesWritten) : 0);
+
+					if (bytesWritten > 0) {
+						pipeBytes_ -= static_cast<std::size_t>(bytesWritten);
+						progress = true;
+					}
+					else if (!WouldBlock() && errno != EINTR) {
+						stop();
+						readableStream_.close();
 						return;
 					}
+				}
+
+				if (eof_ && pipeBytes_ == 0) {
+					PipeCache::Local().release(pipe_);
+					stop();
+					return;
+				}
 
-					if (source->bytesRead_ != 0) {
-						sink->transfer(source);
-						source->transfer(sink);
+				if (!progress) {
+					break;
+				}
+			}
+
+			if (pipeBytes_ > 0) {
+
+				// a full pipe stalls reading until the writable socket drains it
+				if (pipeBytes_ >= pipe_.capacity) {
+					stalled_ = true;
+					stallStarted_ = std::chrono::steady_clock::now();
+				}
+
+				wait(writableStream_, boost::asio::socket_base::wait_write);
+				return;
+			}
+
+			// the relay waits with an empty pipe, another one may use it meanwhile
+			PipeCache::Local().release(pipe_);
+
+			if (throttled) {
+				throttle_.wait(readableStream_.get_executor(), [relay = this->shared_from_this()]() {
+					if (!relay->stopped_) {
+						relay->pump();
 					}
+				});
+			}
+			else {
+				wait(readableStream_, boost::asio::socket_base::wait_read);
+			}
+		}
+
+		template<typename Socket>
+		void wait(Socket& socket, boost::asio::socket_base::wait_type type)
+		{
+			socket.async_wait(type, [relay = this->shared_from_this()](const boost::system::error_code& err) {
 
+				if (relay->stopped_) {
+					return;
 				}
-			);
+
+				if (err) {
+					relay->stop();
+					relay->readableStream_.close();
+					return;
+				}
+
+				relay->pump();
+			});
 		}
 
-		void close()
+		void stop()
 		{
+			stopped_ = true;
 			writableStream_.close();
 		}
 
+		ReadableStream& readableStream_;
+		WritableStream& writableStream_;
+		std::shared_ptr<Finalizer> finalizer_;
+		Counters::Direction& counters_;
+		Throttle throttle_;
+
+		std::size_t pipeSize_;
+		// held while it has data or the relay is splicing
+		PipeCache::Pipe pipe_;
+		// the number of bytes in the pipe
+		std::size_t pipeBytes_ = 0;
+
+		bool eof_ = false;
+		bool stopped_ = false;
+		bool stalled_ = false;
+		std::chrono::steady_clock::time_point stallStarted_;
+
 	};
 
+#endif
+
+	// Starts relaying one direction of a transfer. Data that runs through stages or a tee is
+	// relayed through buffers, splicing passes it by.
+	template<typename ReadableStream, typename WritableStream, typename Stages = Pipeline<>>
+	static void StartRelay(
+		ReadableStream& readableStream,
+		WritableStream& writableStream,
+		std::shared_ptr<Finalizer> finalizer,
+		const Options& options,
+		std::size_t direction,
+		Stages stages = Stages()
+	) {
+		if (options.registry) {
+			finalizer->publish(*options.registry);
+		}
+
+#if defined(SARI_HAS_SPLICE)
+		if constexpr (Stages::IsEmpty && IsSocket<ReadableStream>::value && IsSocket<WritableStream>::value) {
+			if (options.splice && !options.tee) {
+
+				auto relay = std::make_shared<SpliceRelay<ReadableStream, WritableStream>>(
+					readableStream, writableStream, finalizer, options, direction
+				);
+
+				if (relay->open()) {
+					relay->start();
+					return;
+				}
+			}
+		}
+#endif
+
+		auto relay = std::make_shared<Relay<ReadableStream, WritableStream, Stages>>(
+			readableStream, writableStream, finalizer, options, direction, std::move(stages)
+		);
+
+		relay->start();
+	}
+
 	// Redirect a readable stream to a writable stream so that all data read from the readable stream
 	// will be written to the writable stream.
-	template<typename ReadableStream, typename WritableStream>
-	static void Redirect(ReadableStream& readableStream, WritableStream& writableStream, std::shared_ptr<Finalizer> finalizer)
-	{
-		auto source = std::make_shared<Source<ReadableStream>>(readableStream, finalizer);
-		auto sink = std::make_shared<Sink<WritableStream>>(writableStream, finalizer);
-
-		source->transfer(sink);
+	// The data is run through the stages, if any, on its way.
+	template<typename ReadableStream, typename WritableStream, typename Stages = Pipeline<>>
+	static void Redirect(
+		ReadableStream& readableStream,
+		WritableStream& writableStream,
+		std::shared_ptr<Finalizer> finalizer,
+		const Options& options = Options(),
+		Stages stages = Stages()
+	) {
+		StartRelay(readableStream, writableStream, finalizer, options, 0, std::move(stages));
 	}
 
 	// Redirect a readable stream to a writable stream so that all data read from the readable stream
 	// will be written to the writable stream.
 	template<typename ReadableStream, typename WritableStream>
-	static void Redirect(ReadableStream& readableStream, WritableStream& writableStream, Finalizer::Handler handler)
-	{
+	static void Redirect(
+		ReadableStream& readableStream,
+		WritableStream& writableStream,
+		Finalizer::Handler handler,
+		const Options& options = Options()
+	) {
 		auto finalizer = std::make_shared<Finalizer>(handler);
-		Redirect(readableStream, writableStream, finalizer);
+		Redirect(readableStream, writableStream, finalizer, options);
 	}
 
 	// Redirect a readable stream to a writable stream so that all data read from the readable stream
-	// will be written to the writable stream.
-	template<typename ReadableStream, typename WritableStream>
-	static Utils::Promise Redirect(ReadableStream& readableStream, WritableStream& writableStream)
-	{
+	// will be written to the writable stream. The promise is resolved with the Stats of the transfer.
+	template<typename ReadableStream, typename WritableStream, typename Stages = Pipeline<>>
+	static Utils::Promise Redirect(
+		ReadableStream& readableStream,
+		WritableStream& writableStream,
+		const Options& options = Options(),
+		Stages stages = Stages()
+	) {
 		return Utils::Promise(
 			readableStream.get_executor(),
 			[&](Utils::AnyFunction resolve, Utils::AnyFunction reject) {
 
-				Finalizer::Handler handler = [=]() {
-					resolve();
+				Finalizer::StatsHandler handler = [=](const Stats& stats) {
+					resolve(stats);
 				};
 
-				Redirect(readableStream, writableStream);
+				Redirect(readableStream, writableStream, std::make_shared<Finalizer>(handler), options, std::move(stages));
 			},
 			Utils::Promise::Async
 		);
 	}
 
 	// Forward the first stream to the second stream so that any data read from the first stream
-	// is written to the second stream and vice versa.
-	template<typename FirstStream, typename SecondStream>
-	static void Forward(FirstStream& firstStream, SecondStream& secondStream, std::shared_ptr<Finalizer> finalizer)
-	{
-		Redirect(firstStream, secondStream, finalizer);
-		Redirect(secondStream, firstStream, finalizer);
+	// is written to the second stream and vice versa. The data of each direction is run through
+	// its stages, if any, on its way.
+	template<typename FirstStream, typename SecondStream, typename ForwardStages = Pipeline<>, typename BackwardStages = Pipeline<>>
+	static void Forward(
+		FirstStream& firstStream,
+		SecondStream& secondStream,
+		std::shared_ptr<Finalizer> finalizer,
+		const Options& options = Options(),
+		ForwardStages forwardStages = ForwardStages(),
+		BackwardStages backwardStages = BackwardStages()
+	) {
+		StartRelay(firstStream, secondStream, finalizer, options, 0, std::move(forwardStages));
+		StartRelay(secondStream, firstStream, finalizer, options, 1, std::move(backwardStages));
 	}
 
 	// Forward the first stream to the second stream so that any data read from the first stream
 	// is written to the second stream and vice versa.
 	template<typename FirstStream, typename SecondStream>
-	static void Forward(FirstStream& firstStream, SecondStream& secondStream, Finalizer::Handler handler)
-	{
+	static void Forward(
+		FirstStream& firstStream,
+		SecondStream& secondStream,
+		Finalizer::Handler handler,
+		const Options& options = Options()
+	) {
 		auto finalizer = std::make_shared<Finalizer>(handler);
-		Forward(firstStream, secondStream, finalizer);
+		Forward(firstStream, secondStream, finalizer, options);
 	}
 
 	// Forward the first stream to the second stream so that any data read from the first stream
-	// is written to the second stream and vice versa.
-	template<typename FirstStream, typename SecondStream>
-	static Utils::Promise Forward(FirstStream& firstStream, SecondStream& secondStream)
-	{
+	// is written to the second stream and vice versa. The promise is resolved with the Stats
+	// of the transfer.
+	template<typename FirstStream, typename SecondStream, typename ForwardStages = Pipeline<>, typename BackwardStages = Pipeline<>>
+	static Utils::Promise Forward(
+		FirstStream& firstStream,
+		SecondStream& secondStream,
+		const Options& options = Options(),
+		ForwardStages forwardStages = ForwardStages(),
+		BackwardStages backwardStages = BackwardStages()
+	) {
 		return Utils::Promise(
 			firstStream.get_executor(),
 			[&](Utils::AnyFunction resolve, Utils::AnyFunction reject) {
 
-				Finalizer::Handler handler = [=]() {
-					resolve();
+				Finalizer::StatsHandler handler = [=](const Stats& stats) {
+					resolve(stats);
 				};
 
-				Forward(firstStream, secondStream, handler);
+				Forward(
+					firstStream, secondStream, std::make_shared<Finalizer>(handler), options,
+					std::move(forwardStages), std::move(backwardStages)
+				);
 			},
 			Utils::Promise::Async
 		);
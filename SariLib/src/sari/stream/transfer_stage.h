@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+namespace Sari { namespace Stream { namespace Transfer {
+
+	// What a stage does with the data it has been given.
+	enum class Verdict {
+		// pass the data on to the next stage
+		Pass,
+		// keep the data and wait for more bytes to follow it
+		Hold,
+		// pass the data on and leave the relay path, the stage is not called again
+		Done
+	};
+
+	// The data given to a stage. It starts with the bytes the stage has held before, followed
+	// by the bytes read since. A stage may rewrite any of the bytes in place.
+	struct Segment {
+		char* data;
+		std::size_t size;
+		// the number of bytes the stage has already seen while holding them
+		std::size_t seen;
+	};
+
+	// The stages a relay runs the data through after reading it and before writing it.
+	// A stage is any class with a `Verdict process(Segment&)` method, stages are chained
+	// at compile time so their calls can be inlined. A relay with an empty pipeline does not
+	// touch the data at all.
+	//
+	// Data held by a stage does not reach the stages after it until the stage passes it.
+	// The relay then reads more bytes behind the held ones, so held data keeps the buffer
+	// of the relay. A pipeline whose stages are all done is left for good.
+	template<typename... Stages>
+	class Pipeline;
+
+	template<>
+	class Pipeline<> {
+	public:
+
+		static constexpr bool IsEmpty = true;
+
+		Verdict process(char*, std::size_t)
+		{
+			return Verdict::Done;
+		}
+
+	};
+
+	template<typename First, typename... Rest>
+	class Pipeline<First, Rest...> {
+	public:
+
+		static constexpr bool IsEmpty = false;
+
+		explicit Pipeline(First first, Rest... rest) :
+			first_(std::move(first)),
+			rest_(std::move(rest)...)
+		{}
+
+		Verdict process(char* data, std::size_t size)
+		{
+			if (!firstDone_) {
+
+				Segment segment{ data, size, seen_ };
+				Verdict verdict = first_.process(segment);
+
+				if (verdict == Verdict::Hold) {
+					seen_ = size;
+					return Verdict::Hold;
+				}
+
+				firstDone_ = verdict == Verdict::Done;
+			}
+
+			Verdict verdict = rest_.process(data, size);
+
+			// the data stays with a later stage, the first one must not see it again
+			seen_ = verdict == Verdict::Hold ? size : 0;
+
+			if (verdict == Verdict::Hold) {
+				return Verdict::Hold;
+			}
+
+			return firstDone_ && verdict == Verdict::Done ? Verdict::Done : Verdict::Pass;
+		}
+
+	private:
+
+		First first_;
+		Pipeline<Rest...> rest_;
+		std::size_t seen_ = 0;
+		bool firstDone_ = false;
+
+	};
+
+	template<typename... Stages>
+	Pipeline(Stages...) -> Pipeline<Stages...>;
+
+	// Hands the first bytes of a stream to the handler, e.g. to choose a route by the protocol
+	// or by the TLS SNI, and then steps out of the relay path. The handler is called with all
+	// bytes received so far, up to the limit, and returns whether it needs more of them.
+	// The data is held until the handler has enough or the limit is reached, so the handler
+	// must not wait for bytes the peer sends only after it gets a reply.
+	template<typename Handler>
+	class Sniffer {
+	public:
+
+		Sniffer(std::size_t limit, Handler handler) :
+			limit_(limit),
+			handler_(std::move(handler))
+		{}
+
+		Verdict process(Segment& segment)
+		{
+			std::size_t size = std::min(segment.size, limit_);
+
+			if (handler_(static_cast<const char*>(segment.data), size) && size < limit_) {
+				return Verdict::Hold;
+			}
+
+			return Verdict::Done;
+		}
+
+	private:
+
+		std::size_t limit_;
+		Handler handler_;
+
+	};
+
+}}}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Sari { namespace Stream { namespace Transfer {
+
+	// The number of buckets of the stall time histogram. Bucket i counts stalls shorter than
+	// 10^(i+1) microseconds, the last bucket counts stalls of a second or more.
+	constexpr std::size_t NumOfStallBuckets = 7;
+
+	// What happened in one direction of a transfer.
+	struct DirectionStats {
+
+		std::uint64_t bytes = 0;
+		// the number of read and write calls
+		std::uint64_t reads = 0;
+		std::uint64_t writes = 0;
+		// The time spent with reading blocked because all buffers were waiting to be written.
+		std::uint64_t stallMicroseconds = 0;
+		std::array<std::uint64_t, NumOfStallBuckets> stalls = {};
+
+	};
+
+	// What happened in a transfer. A redirect uses the first direction only, a forward uses
+	// the first direction from the first stream to the second and the second direction back.
+	struct Stats {
+
+		std::array<DirectionStats, 2> directions;
+		std::chrono::system_clock::time_point start;
+		// the default value while the transfer is running
+		std::chrono::system_clock::time_point end;
+
+		bool isRunning() const
+		{
+			return end == std::chrono::system_clock::time_point();
+		}
+
+		std::chrono::duration<double> duration() const
+		{
+			return (isRunning() ? std::chrono::system_clock::now() : end) - start;
+		}
+
+		// Bytes per second in both directions.
+		double throughput() const
+		{
+			double seconds = duration().count();
+			return seconds > 0 ? (directions[0].bytes + directions[1].bytes) / seconds : 0;
+		}
+
+	};
+
+	// The live counters of a transfer. Relays update them with relaxed atomic increments,
+	// snapshots can be taken from any thread.
+	class Counters {
+	public:
+
+		class Direction {
+		public:
+
+			void read() { reads_.fetch_add(1, std::memory_order_relaxed); }
+
+			void wrote(std::size_t bytes)
+			{
+				writes_.fetch_add(1, std::memory_order_relaxed);
+				bytes_.fetch_add(bytes, std::memory_order_relaxed);
+			}
+
+			void stalled(std::chrono::steady_clock::duration duration)
+			{
+				auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+
+				std::size_t bucket = 0;
+				for (long long bound = 10; bucket + 1 < NumOfStallBuckets && microseconds >= bound; bound *= 10) {
+					++bucket;
+				}
+
+				stallMicroseconds_.fetch_add(static_cast<std::uint64_t>(microseconds), std::memory_order_relaxed);
+				stalls_[bucket].fetch_add(1, std::memory_order_relaxed);
+			}
+
+			DirectionStats snapshot() const
+			{
+				DirectionStats stats;
+
+				stats.bytes = bytes_.load(std::memory_order_relaxed);
+				stats.reads = reads_.load(std::memory_order_relaxed);
+				stats.writes = writes_.load(std::memory_order_relaxed);
+				stats.stallMicroseconds = stallMicroseconds_.load(std::memory_order_relaxed);
+
+				for (std::size_t i = 0; i < NumOfStallBuckets; ++i) {
+					stats.stalls[i] = stalls_[i].load(std::memory_order_relaxed);
+				}
+
+				return stats;
+			}
+
+		private:
+			std::atomic<std::uint64_t> bytes_{ 0 };
+			std::atomic<std::uint64_t> reads_{ 0 };
+			std::atomic<std::uint64_t> writes_{ 0 };
+			std::atomic<std::uint64_t> stallMicroseconds_{ 0 };
+			std::array<std::atomic<std::uint64_t>, NumOfStallBuckets> stalls_ = {};
+		};
+
+		Counters() :
+			start_(std::chrono::system_clock::now())
+		{}
+
+		Direction& direction(std::size_t index) { return directions_[index]; }
+
+		void finish()
+		{
+			end_.store(std::chrono::system_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+		}
+
+		Stats snapshot() const
+		{
+			Stats stats;
+
+			stats.directions[0] = directions_[0].snapshot();
+			stats.directions[1] = directions_[1].snapshot();
+			stats.start = start_;
+			stats.end = std::chrono::system_clock::time_point(
+				std::chrono::system_clock::duration(end_.load(std::memory_order_relaxed))
+			);
+
+			return stats;
+		}
+
+	private:
+		std::array<Direction, 2> directions_;
+		std::chrono::system_clock::time_point start_;
+		std::atomic<std::chrono::system_clock::rep> end_{ 0 };
+	};
+
+	// Keeps the counters of the running transfers that publish to it (see Options::registry)
+	// and the sums of the finished ones, e.g. for live dashboards.
+	class Registry {
+	public:
+
+		static Registry& Global()
+		{
+			static Registry registry;
+			return registry;
+		}
+
+		void add(std::shared_ptr<const Counters> counters)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_.emplace(counters.get(), counters);
+		}
+
+		void remove(const Counters& counters)
+		{
+			Stats stats = counters.snapshot();
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			running_.erase(&counters);
+
+			++finished_;
+			for (std::size_t i = 0; i < finishedDirections_.size(); ++i) {
+				Add(finishedDirections_[i], stats.directions[i]);
+			}
+		}
+
+		// Snapshots of the running transfers.
+		std::vector<Stats> running() const
+		{
+			std::vector<std::shared_ptr<const Counters>> counters;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				counters.reserve(running_.size());
+				for (const auto& entry : running_) {
+					counters.push_back(entry.second);
+				}
+			}
+
+			std::vector<Stats> stats;
+			stats.reserve(counters.size());
+
+			for (const auto& c : counters) {
+				stats.push_back(c->snapshot());
+			}
+
+			return stats;
+		}
+
+		// The number of finished transfers.
+		std::uint64_t finished() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return finished_;
+		}
+
+		// The sums of the finished transfers per direction.
+		std::array<DirectionStats, 2> finishedTotals() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return finishedDirections_;
+		}
+
+	private:
+
+		static void Add(DirectionStats& sum, const DirectionStats& stats)
+		{
+			sum.bytes += stats.bytes;
+			sum.reads += stats.reads;
+			sum.writes += stats.writes;
+			sum.stallMicroseconds += stats.stallMicroseconds;
+
+			for (std::size_t i = 0; i < NumOfStallBuckets; ++i) {
+				sum.stalls[i] += stats.stalls[i];
+			}
+		}
+
+		mutable std::mutex mutex_;
+		std::unordered_map<const Counters*, std::shared_ptr<const Counters>> running_;
+		std::uint64_t finished_ = 0;
+		std::array<DirectionStats, 2> finishedDirections_ = {};
+	};
+
+}}}
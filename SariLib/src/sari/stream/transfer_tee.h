@@ -0,0 +1,227 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../utils/buffer_pool.h"
+
+namespace Sari { namespace Stream { namespace Transfer {
+
+	// What a tee does with the data while its sink lags behind by more than the backlog limit.
+	enum class TeePolicy {
+		// the data is not mirrored
+		Drop,
+		// every n-th chunk is mirrored until the backlog reaches twice the limit, the others
+		// are dropped
+		Sample,
+		// the relays stop reading until the sink catches up
+		Block
+	};
+
+	class Tee;
+
+	// The bytes of one read of a relay handed to a tee sink. The chunk shares the buffer
+	// of the relay, which returns to the pool once the relay has written it and the sink has
+	// destroyed the chunk. The sink should destroy it as soon as it no longer needs the data,
+	// the tee counts the bytes of the living chunks as its backlog.
+	class TeeChunk {
+	public:
+
+		TeeChunk(
+			std::shared_ptr<const Utils::BufferPool::Buffer> buffer,
+			std::size_t size,
+			std::uint32_t transfer,
+			std::size_t direction,
+			std::shared_ptr<Tee> tee
+		) :
+			buffer_(std::move(buffer)),
+			size_(size),
+			transfer_(transfer),
+			direction_(direction),
+			time_(std::chrono::system_clock::now()),
+			tee_(std::move(tee))
+		{}
+
+		TeeChunk(TeeChunk&&) = default;
+		TeeChunk& operator= (TeeChunk&&) = default;
+
+		~TeeChunk();
+
+		const char* data() const { return buffer_->data(); }
+		std::size_t size() const { return size_; }
+		// the transfer the data belongs to, see Finalizer::id()
+		std::uint32_t transfer() const { return transfer_; }
+		// the direction of the transfer, as in Stats
+		std::size_t direction() const { return direction_; }
+		// when the relay read the data
+		std::chrono::system_clock::time_point time() const { return time_; }
+
+	private:
+		std::shared_ptr<const Utils::BufferPool::Buffer> buffer_;
+		std::size_t size_;
+		std::uint32_t transfer_;
+		std::size_t direction_;
+		std::chrono::system_clock::time_point time_;
+		std::shared_ptr<Tee> tee_;
+	};
+
+	// The secondary destination of relayed data, e.g. a CaptureFile or an analysis socket.
+	// Relays of different threads may call it at the same time.
+	class TeeSink {
+	public:
+
+		virtual ~TeeSink() = default;
+
+		// Takes a chunk of relayed data. It must not block, a slow sink queues the chunks.
+		virtual void write(TeeChunk chunk) = 0;
+
+		// Notes the bytes the tee has not mirrored because the sink lagged behind.
+		virtual void dropped(std::uint32_t /*transfer*/, std::size_t /*direction*/, std::size_t /*bytes*/) {}
+
+	};
+
+	// Mirrors the data of the relays it is set to (see Options::tee) to a sink. The relays share
+	// their buffers with the sink, the data is not copied. A tee may be shared by many transfers.
+	class Tee : public std::enable_shared_from_this<Tee> {
+	public:
+
+		struct Stats {
+			std::uint64_t mirroredBytes;
+			std::uint64_t droppedBytes;
+			std::uint64_t droppedChunks;
+			// the number of times a relay stopped reading under the Block policy
+			std::uint64_t blocks;
+			// the bytes held by the sink
+			std::size_t backlog;
+		};
+
+		Tee(
+			std::shared_ptr<TeeSink> sink,
+			TeePolicy policy = TeePolicy::Drop,
+			std::size_t maxBacklog = 4 * 1024 * 1024,
+			std::size_t sampleEvery = 16
+		) :
+			sink_(std::move(sink)),
+			policy_(policy),
+			maxBacklog_(maxBacklog),
+			sampleEvery_(std::max<std::size_t>(sampleEvery, 1))
+		{}
+
+		// Hands the data of a relay to the sink unless the policy drops it.
+		void mirror(std::shared_ptr<const Utils::BufferPool::Buffer> buffer, std::size_t size, std::uint32_t transfer, std::size_t direction)
+		{
+			if (!admit(size)) {
+				droppedBytes_.fetch_add(size, std::memory_order_relaxed);
+				droppedChunks_.fetch_add(1, std::memory_order_relaxed);
+				sink_->dropped(transfer, direction, size);
+				return;
+			}
+
+			backlog_.fetch_add(size, std::memory_order_relaxed);
+			mirroredBytes_.fetch_add(size, std::memory_order_relaxed);
+
+			sink_->write(TeeChunk(std::move(buffer), size, transfer, direction, shared_from_this()));
+		}
+
+		// Whether a relay has to stop reading. It then calls wait() to be resumed.
+		bool blocking() const
+		{
+			return policy_ == TeePolicy::Block && backlog_.load(std::memory_order_relaxed) >= maxBacklog_;
+		}
+
+		// Calls the handler once the backlog falls below the limit. The handler may be called
+		// on the thread of the sink.
+		void wait(std::function<void()> handler)
+		{
+			blocks_.fetch_add(1, std::memory_order_relaxed);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				if (blocking()) {
+					waiting_.push_back(std::move(handler));
+					return;
+				}
+			}
+
+			handler();
+		}
+
+		Stats stats() const
+		{
+			return {
+				mirroredBytes_.load(std::memory_order_relaxed),
+				droppedBytes_.load(std::memory_order_relaxed),
+				droppedChunks_.load(std::memory_order_relaxed),
+				blocks_.load(std::memory_order_relaxed),
+				backlog_.load(std::memory_order_relaxed)
+			};
+		}
+
+	private:
+
+		friend class TeeChunk;
+
+		bool admit(std::size_t size)
+		{
+			std::size_t backlog = backlog_.load(std::memory_order_relaxed);
+
+			if (policy_ == TeePolicy::Block || backlog + size <= maxBacklog_) {
+				return true;
+			}
+
+			if (policy_ == TeePolicy::Sample && backlog + size <= maxBacklog_ * 2) {
+				return sampled_.fetch_add(1, std::memory_order_relaxed) % sampleEvery_ == 0;
+			}
+
+			return false;
+		}
+
+		void release(std::size_t size)
+		{
+			std::size_t backlog = backlog_.fetch_sub(size, std::memory_order_relaxed) - size;
+
+			if (policy_ != TeePolicy::Block || backlog >= maxBacklog_) {
+				return;
+			}
+
+			std::vector<std::function<void()>> waiting;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				waiting.swap(waiting_);
+			}
+
+			for (auto& handler : waiting) {
+				handler();
+			}
+		}
+
+		std::shared_ptr<TeeSink> sink_;
+		TeePolicy policy_;
+		std::size_t maxBacklog_;
+		std::size_t sampleEvery_;
+
+		std::atomic<std::size_t> backlog_{ 0 };
+		std::atomic<std::uint64_t> mirroredBytes_{ 0 };
+		std::atomic<std::uint64_t> droppedBytes_{ 0 };
+		std::atomic<std::uint64_t> droppedChunks_{ 0 };
+		std::atomic<std::uint64_t> blocks_{ 0 };
+		std::atomic<std::uint64_t> sampled_{ 0 };
+
+		std::mutex mutex_;
+		std::vector<std::function<void()>> waiting_;
+	};
+
+	inline TeeChunk::~TeeChunk()
+	{
+		if (tee_) {
+			tee_->release(size_);
+		}
+	}
+
+}}}
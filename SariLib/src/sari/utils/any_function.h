@@ -2,11 +2,27 @@
 
 #include <any>
 #include <functional>
+#include <memory>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
 namespace Sari { namespace Utils {
 
+	// Packs the arguments of a call into a vector. A single vector of arguments is taken as the
+	// arguments themselves, compilers differ in whether a braced list holding only that vector
+	// copies it or wraps it.
+	template<typename... Args>
+	std::vector<std::any> PackArguments(Args&&... args)
+	{
+		if constexpr (sizeof...(Args) == 1 && (std::is_same_v<std::decay_t<Args>, std::vector<std::any>> && ...)) {
+			return std::vector<std::any>(args...);
+		}
+		else {
+			return std::vector<std::any>{ std::any(args)... };
+		}
+	}
+
 	class AnyFunction {
 	public:
 
@@ -22,7 +38,7 @@ namespace Sari { namespace Utils {
 		template<typename... Args>
 		std::any operator() (Args&&... args) const
 		{
-			std::vector<std::any> vargs = { args... };
+			std::vector<std::any> vargs = PackArguments(args...);
 			return (*caller_)(vargs);
 		}
 
@@ -67,7 +83,7 @@ namespace Sari { namespace Utils {
 		static FuncResult call(const FuncType& f, const std::vector<std::any>& args, std::index_sequence<I...>)
 		{
 			return f(
-				ForwardArgument<std::tuple_element<I, FuncParams>::type>(args[I])...
+				ForwardArgument<typename std::tuple_element<I, FuncParams>::type>(args[I])...
 			);
 		}
 
@@ -76,12 +92,12 @@ namespace Sari { namespace Utils {
 		static void callVoid(const FuncType& f, const std::vector<std::any>& args, std::index_sequence<I...>)
 		{
 			f(
-				ForwardArgument<std::tuple_element<I, FuncParams>::type>(args[I])...
+				ForwardArgument<typename std::tuple_element<I, FuncParams>::type>(args[I])...
 			);
 		}
 
-		// creates wrapper for a function with a return value 
-		template<typename R>
+		// creates wrapper for a function, with a return value or without one
+		template<typename Result>
 		static AnyFunction create_(const FuncType& f)
 		{
 			auto caller = [f](const std::vector<std::any>& args) {
@@ -90,29 +106,18 @@ namespace Sari { namespace Utils {
 					throw std::bad_any_cast();
 				}
 
-				// call the captured function and converts its return value to std::any
-				return std::any{
-					call(f, args,  std::make_index_sequence<NumOfFuncParams>{})
-				};
-			};
-
-			return AnyFunction{std::move(caller)};
-		}
-
-		// explicit specialization for wrapping a function with no return value
-		template<>
-		static AnyFunction create_<void>(const FuncType& f)
-		{
-			auto caller = [f](const std::vector<std::any>& args) {
-
-				if (args.size() < NumOfFuncParams) {
-					throw std::bad_any_cast();
+				if constexpr (std::is_void_v<Result>) {
+					// call the captured function with no return value
+					callVoid(f, args, std::make_index_sequence<NumOfFuncParams>{});
+					// return empty std::any value
+					return std::any{};
+				}
+				else {
+					// call the captured function and converts its return value to std::any
+					return std::any{
+						call(f, args, std::make_index_sequence<NumOfFuncParams>{})
+					};
 				}
-
-				// call the captured function with no return value
-				callVoid(f, args, std::make_index_sequence<NumOfFuncParams>{});
-				// return empty std::any value
-				return std::any{};
 			};
 
 			return AnyFunction{std::move(caller)};
@@ -125,7 +130,7 @@ namespace Sari { namespace Utils {
 	template<typename F>
 	static AnyFunction MakeAnyFunc(const F& f)
 	{
-		return AnyFunctionWrapper<decltype(std::function{f})>::template create(f);
+		return AnyFunctionWrapper<decltype(std::function{f})>::create(f);
 	}
 
 }}
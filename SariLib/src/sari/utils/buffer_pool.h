@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Sari { namespace Utils {
+
+    // A per-thread cache of buffers in power-of-two size classes from MinBufferSize
+    // to MaxPooledBufferSize. Larger buffers are allocated and freed directly.
+    // A buffer is returned to the pool of the thread that releases it, so buffers
+    // may migrate between threads but no pool is ever touched by two threads.
+    // Each pool counts its own usage, the counters of all pools are summed up in
+    // process-wide statistics when they are asked for.
+    class BufferPool {
+    public:
+
+        // The usage of the pools of all threads in bytes. A high-water mark is the sum of
+        // the ones of the threads, so it may be above the actual peak of the process.
+        struct Stats {
+            // held by borrowed buffers
+            std::size_t bytesInUse;
+            std::size_t bytesInUseHighWater;
+            // held by free buffers cached for later use
+            std::size_t cachedBytes;
+            std::size_t cachedBytesHighWater;
+        };
+
+        static constexpr std::size_t MinBufferSize = 4096;
+        static constexpr std::size_t MaxPooledBufferSize = 1024 * 1024;
+        static constexpr std::size_t DefaultMaxCachedBytes = 4 * 1024 * 1024;
+
+        // A block of memory borrowed from the pool, it is released when destroyed.
+        class Buffer {
+        public:
+
+            Buffer() = default;
+
+            Buffer(Buffer&& other) noexcept :
+                data_(std::exchange(other.data_, nullptr)),
+                size_(std::exchange(other.size_, 0))
+            {}
+
+            Buffer& operator= (Buffer&& other) noexcept
+            {
+                if (this != &other) {
+                    reset();
+                    data_ = std::exchange(other.data_, nullptr);
+                    size_ = std::exchange(other.size_, 0);
+                }
+                return *this;
+            }
+
+            Buffer(const Buffer&) = delete;
+            Buffer& operator= (const Buffer&) = delete;
+
+            ~Buffer()
+            {
+                reset();
+            }
+
+            char* data() const { return data_; }
+            std::size_t size() const { return size_; }
+            explicit operator bool() const { return data_ != nullptr; }
+
+            void reset()
+            {
+                if (data_) {
+                    BufferPool::Release(data_, size_);
+                    data_ = nullptr;
+                    size_ = 0;
+                }
+            }
+
+        private:
+
+            friend class BufferPool;
+
+            Buffer(char* data, std::size_t size) :
+                data_(data),
+                size_(size)
+            {}
+
+            char* data_ = nullptr;
+            std::size_t size_ = 0;
+
+        };
+
+        BufferPool()
+        {
+            Threads& threads = AllThreads();
+            std::lock_guard<std::mutex> lock(threads.mutex);
+            threads.counters.push_back(&counters_);
+        }
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator= (const BufferPool&) = delete;
+
+        ~BufferPool()
+        {
+            trim();
+
+            {
+                Threads& threads = AllThreads();
+                std::lock_guard<std::mutex> lock(threads.mutex);
+
+                threads.counters.erase(std::find(threads.counters.begin(), threads.counters.end(), &counters_));
+                threads.exited.bytesInUse += counters_.bytesInUse.load(std::memory_order_relaxed);
+                threads.exited.bytesInUseHighWater += counters_.bytesInUseHighWater.load(std::memory_order_relaxed);
+                threads.exited.cachedBytesHighWater += counters_.cachedBytesHighWater.load(std::memory_order_relaxed);
+            }
+
+            Destroyed() = true;
+        }
+
+        // The pool of the calling thread.
+        static BufferPool& Local()
+        {
+            thread_local BufferPool pool;
+            return pool;
+        }
+
+        // Returns a buffer of at least the given size. The size of the buffer
+        // is rounded up to its size class.
+        Buffer acquire(std::size_t size)
+        {
+            std::size_t classSize = ClassSize(size);
+
+            RaiseHighWater(counters_.bytesInUseHighWater, Add(counters_.bytesInUse, static_cast<std::ptrdiff_t>(classSize)));
+
+            if (classSize > MaxPooledBufferSize) {
+                return Buffer(new char[classSize], classSize);
+            }
+
+            auto& freeList = freeLists_[ClassIndex(classSize)];
+
+            if (!freeList.empty()) {
+                char* data = freeList.back();
+                freeList.pop_back();
+                cachedBytes_ -= classSize;
+                Add(counters_.cachedBytes, -static_cast<std::ptrdiff_t>(classSize));
+                return Buffer(data, classSize);
+            }
+
+            return Buffer(new char[classSize], classSize);
+        }
+
+        // Limits the memory kept by the pool for later use, buffers released
+        // above the limit are freed.
+        void setMaxCachedBytes(std::size_t maxCachedBytes)
+        {
+            maxCachedBytes_ = maxCachedBytes;
+
+            if (cachedBytes_ > maxCachedBytes_) {
+                trim();
+            }
+        }
+
+        // The number of bytes held by free buffers.
+        std::size_t cachedBytes() const
+        {
+            return cachedBytes_;
+        }
+
+        // Frees all cached buffers.
+        void trim()
+        {
+            for (auto& freeList : freeLists_) {
+                for (char* data : freeList) {
+                    delete[] data;
+                }
+                freeList.clear();
+            }
+            Add(counters_.cachedBytes, -static_cast<std::ptrdiff_t>(cachedBytes_));
+            cachedBytes_ = 0;
+        }
+
+        static Stats GlobalStats()
+        {
+            Threads& threads = AllThreads();
+            std::lock_guard<std::mutex> lock(threads.mutex);
+
+            Usage sum = threads.exited;
+
+            for (const Counters* counters : threads.counters) {
+                sum.bytesInUse += counters->bytesInUse.load(std::memory_order_relaxed);
+                sum.bytesInUseHighWater += counters->bytesInUseHighWater.load(std::memory_order_relaxed);
+                sum.cachedBytes += counters->cachedBytes.load(std::memory_order_relaxed);
+                sum.cachedBytesHighWater += counters->cachedBytesHighWater.load(std::memory_order_relaxed);
+            }
+
+            // a buffer released by another thread than the one which has borrowed it lowers
+            // the usage of the releasing thread, only the sum over all threads is meaningful
+            auto bytes = [](std::ptrdiff_t value) {
+                return static_cast<std::size_t>(std::max<std::ptrdiff_t>(value, 0));
+            };
+
+            return {
+                bytes(sum.bytesInUse),
+                bytes(std::max(sum.bytesInUseHighWater, sum.bytesInUse)),
+                bytes(sum.cachedBytes),
+                bytes(std::max(sum.cachedBytesHighWater, sum.cachedBytes))
+            };
+        }
+
+        // Starts the high-water marks over from the current usage.
+        static void ResetHighWaterMarks()
+        {
+            Threads& threads = AllThreads();
+            std::lock_guard<std::mutex> lock(threads.mutex);
+
+            threads.exited.bytesInUseHighWater = 0;
+            threads.exited.cachedBytesHighWater = 0;
+
+            for (Counters* counters : threads.counters) {
+                counters->bytesInUseHighWater.store(counters->bytesInUse.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                counters->cachedBytesHighWater.store(counters->cachedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        }
+
+        // The size class of a buffer of the given size.
+        static std::size_t ClassSize(std::size_t size)
+        {
+            std::size_t classSize = MinBufferSize;
+
+            while (classSize < size) {
+                classSize <<= 1;
+            }
+
+            return classSize;
+        }
+
+    private:
+
+        static constexpr std::size_t NumOfClasses = 9; // 4 KiB .. 1 MiB
+
+        // The usage of the pool of one thread. Only the thread itself changes it, with relaxed
+        // loads and stores rather than read-modify-writes, on a cache line of its own.
+        // GlobalStats() reads it from any thread.
+        struct alignas(64) Counters {
+            std::atomic<std::ptrdiff_t> bytesInUse{ 0 };
+            std::atomic<std::ptrdiff_t> bytesInUseHighWater{ 0 };
+            std::atomic<std::ptrdiff_t> cachedBytes{ 0 };
+            std::atomic<std::ptrdiff_t> cachedBytesHighWater{ 0 };
+        };
+
+        struct Usage {
+            std::ptrdiff_t bytesInUse = 0;
+            std::ptrdiff_t bytesInUseHighWater = 0;
+            std::ptrdiff_t cachedBytes = 0;
+            std::ptrdiff_t cachedBytesHighWater = 0;
+        };
+
+        // The counters of the pools of the running threads and the usage left by the exited ones.
+        struct Threads {
+            std::mutex mutex;
+            std::vector<Counters*> counters;
+            Usage exited;
+        };
+
+        static Threads& AllThreads()
+        {
+            static Threads threads;
+            return threads;
+        }
+
+        static std::ptrdiff_t Add(std::atomic<std::ptrdiff_t>& counter, std::ptrdiff_t delta)
+        {
+            std::ptrdiff_t value = counter.load(std::memory_order_relaxed) + delta;
+            counter.store(value, std::memory_order_relaxed);
+            return value;
+        }
+
+        static void RaiseHighWater(std::atomic<std::ptrdiff_t>& highWater, std::ptrdiff_t value)
+        {
+            if (value > highWater.load(std::memory_order_relaxed)) {
+                highWater.store(value, std::memory_order_relaxed);
+            }
+        }
+
+        static std::size_t ClassIndex(std::size_t classSize)
+        {
+            std::size_t index = 0;
+
+            while ((MinBufferSize << index) < classSize) {
+                ++index;
+            }
+
+            return index;
+        }
+
+        // Set when the pool of the thread has been destroyed during the thread exit,
+        // buffers released after that are freed directly.
+        static bool& Destroyed()
+        {
+            thread_local bool destroyed = false;
+            return destroyed;
+        }
+
+        static void Release(char* data, std::size_t size)
+        {
+            if (Destroyed()) {
+                {
+                    Threads& threads = AllThreads();
+                    std::lock_guard<std::mutex> lock(threads.mutex);
+                    threads.exited.bytesInUse -= static_cast<std::ptrdiff_t>(size);
+                }
+
+                delete[] data;
+                return;
+            }
+
+            Local().release(data, size);
+        }
+
+        void release(char* data, std::size_t size)
+        {
+            Add(counters_.bytesInUse, -static_cast<std::ptrdiff_t>(size));
+
+            if (size > MaxPooledBufferSize || cachedBytes_ + size > maxCachedBytes_) {
+                delete[] data;
+                return;
+            }
+
+            freeLists_[ClassIndex(size)].push_back(data);
+            cachedBytes_ += size;
+
+            RaiseHighWater(counters_.cachedBytesHighWater, Add(counters_.cachedBytes, static_cast<std::ptrdiff_t>(size)));
+        }
+
+        Counters counters_;
+        std::array<std::vector<char*>, NumOfClasses> freeLists_;
+        std::size_t cachedBytes_ = 0;
+        std::size_t maxCachedBytes_ = DefaultMaxCachedBytes;
+
+    };
+
+}}
@@ -83,14 +83,14 @@ namespace Sari { namespace Utils {
         template<typename... Args>
         Sari::Utils::Promise asyncConsume(Transaction& trans, Args&&... args)
         {
-            std::vector<std::any> vargs = { args... };
+            std::vector<std::any> vargs = PackArguments(args...);
             return exchange(trans, vargs, consumeHandlers_, produceHandlers_);
         }
 
         template<typename... Args>
         Sari::Utils::Promise asyncProduce(Transaction& trans, Args&&... args)
         {
-            std::vector<std::any> vargs = { args... };
+            std::vector<std::any> vargs = PackArguments(args...);
             return exchange(trans, vargs, produceHandlers_, consumeHandlers_);
         }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <any>
 #include <cassert>
 #include <typeinfo>
 #include <typeindex>
@@ -7,6 +8,8 @@
 #include <memory>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include "../asio/config.h"
 #include <boost/asio.hpp>
 
 #include "function_signature.h"
@@ -162,7 +165,7 @@ namespace Sari { namespace Utils {
                 break;
             }
 
-            impl_->failHandlers_[std::type_index(typeid(FuncSign::Params::Type))] = MakeAnyFunc(failHandler);
+            impl_->failHandlers_[std::type_index(typeid(typename FuncSign::Params::Type))] = MakeAnyFunc(failHandler);
 
             return *this;
         }
@@ -189,7 +192,7 @@ namespace Sari { namespace Utils {
         template<typename... Args>
         static Promise Resolve(boost::asio::any_io_executor ioExecutor, Args&&... args)
         {
-            std::vector<std::any> vargs = { args... };
+            std::vector<std::any> vargs = PackArguments(args...);
 
             return Promise(
                 ioExecutor,
@@ -210,7 +213,7 @@ namespace Sari { namespace Utils {
         template<typename... Args>
         static Promise Reject(boost::asio::any_io_executor ioExecutor, Args&&... args)
         {
-            std::vector<std::any> vargs = { args... };
+            std::vector<std::any> vargs = PackArguments(args...);
 
             return Promise(
                 ioExecutor,
@@ -230,7 +233,7 @@ namespace Sari { namespace Utils {
         template<typename F, typename... Args>
         static Promise Repeat(boost::asio::any_io_executor ioExecutor, F task, Args&&... args)
         {
-            std::vector<std::any> vargs = { args... };
+            std::vector<std::any> vargs = PackArguments(args...);
 
             return Promise(
                 ioExecutor,
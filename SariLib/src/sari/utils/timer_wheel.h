@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "../asio/config.h"
+#include <boost/asio.hpp>
+
+namespace Sari { namespace Utils {
+
+    // Runs many timed handlers on a single Asio timer. Deadlines are rounded up to whole ticks
+    // and kept in a ring of slots, so scheduling and expiring a handler costs the same no matter
+    // how many handlers are waiting. A handler runs after at least the requested delay.
+    // The wheel must be used from the thread running its executor. Handlers still waiting when
+    // the wheel is destroyed are dropped without being called.
+    class TimerWheel {
+    public:
+
+        using Handler = std::function<void()>;
+        using Clock = std::chrono::steady_clock;
+
+        TimerWheel(
+            boost::asio::any_io_executor ioExecutor,
+            Clock::duration tick = std::chrono::milliseconds(1),
+            std::size_t numOfSlots = 1024
+        ) :
+            state_(std::make_shared<State>(ioExecutor, tick, numOfSlots))
+        {}
+
+        TimerWheel(boost::asio::io_context& ioContext, Clock::duration tick = std::chrono::milliseconds(1)) :
+            TimerWheel(ioContext.get_executor(), tick)
+        {}
+
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator= (const TimerWheel&) = delete;
+
+        ~TimerWheel()
+        {
+            state_->closed = true;
+            state_->timer.cancel();
+
+            for (auto& slot : state_->slots) {
+                slot.clear();
+            }
+        }
+
+        // Calls the handler once the delay has passed.
+        void schedule(Clock::duration delay, Handler handler)
+        {
+            State& state = *state_;
+
+            std::size_t ticks = delay > Clock::duration::zero()
+                ? static_cast<std::size_t>((delay + state.tick - Clock::duration(1)) / state.tick)
+                : 0;
+
+            // the next tick may be less than a whole tick away
+            ++ticks;
+
+            std::size_t numOfSlots = state.slots.size();
+
+            state.slots[(state.cursor + ticks) % numOfSlots].push_back({ (ticks - 1) / numOfSlots, std::move(handler) });
+            ++state.size;
+
+            if (!state.running) {
+                state.running = true;
+                state.next = Clock::now() + state.tick;
+                Wait(state_);
+            }
+        }
+
+        // The number of waiting handlers.
+        std::size_t size() const
+        {
+            return state_->size;
+        }
+
+        Clock::duration tick() const
+        {
+            return state_->tick;
+        }
+
+        boost::asio::any_io_executor get_executor()
+        {
+            return state_->timer.get_executor();
+        }
+
+    private:
+
+        struct Entry {
+            // the number of turns of the wheel before the handler is due
+            std::size_t rounds;
+            Handler handler;
+        };
+
+        struct State {
+
+            boost::asio::steady_timer timer;
+            Clock::duration tick;
+            std::vector<std::vector<Entry>> slots;
+            std::size_t cursor = 0;
+            std::size_t size = 0;
+            Clock::time_point next;
+            bool running = false;
+            bool closed = false;
+
+            State(boost::asio::any_io_executor ioExecutor, Clock::duration tick, std::size_t numOfSlots) :
+                timer(ioExecutor),
+                tick(tick > Clock::duration::zero() ? tick : std::chrono::milliseconds(1)),
+                slots(numOfSlots > 0 ? numOfSlots : 1)
+            {}
+
+        };
+
+        static void Wait(std::shared_ptr<State> state)
+        {
+            state->timer.expires_at(state->next);
+            state->timer.async_wait([state](const boost::system::error_code& ec) {
+
+                if (ec || state->closed) {
+                    return;
+                }
+
+                Advance(state);
+            });
+        }
+
+        // Moves the cursor over all ticks that have passed and calls the handlers that are due.
+        static void Advance(std::shared_ptr<State> state)
+        {
+            auto now = Clock::now();
+            std::size_t ticks = 1 + static_cast<std::size_t>(std::max(Clock::duration::zero(), now - state->next) / state->tick);
+
+            std::vector<Handler> due;
+
+            for (std::size_t i = 0; i < ticks && state->size > due.size(); ++i) {
+
+                state->cursor = (state->cursor + 1) % state->slots.size();
+
+                auto& slot = state->slots[state->cursor];
+                std::vector<Entry> waiting;
+
+                for (auto& entry : slot) {
+                    if (entry.rounds == 0) {
+                        due.push_back(std::move(entry.handler));
+                    }
+                    else {
+                        --entry.rounds;
+                        waiting.push_back(std::move(entry));
+                    }
+                }
+
+                slot = std::move(waiting);
+            }
+
+            state->size -= due.size();
+            state->next += state->tick * static_cast<Clock::rep>(ticks);
+
+            for (auto& handler : due) {
+
+                handler();
+
+                if (state->closed) {
+                    return;
+                }
+            }
+
+            if (state->size > 0) {
+                Wait(state);
+            }
+            else {
+                state->running = false;
+            }
+        }
+
+        std::shared_ptr<State> state_;
+
+    };
+
+}}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sari/net/multi_server.h"
+
+// Measures how many connections per second Net::MultiServer accepts over loopback
+// with 1 to N threads in both modes.
+//
+// Usage: Benchmark accept [max threads] [seconds per run] [client threads]
+class AcceptBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        namespace Net = Sari::Net;
+
+        std::size_t maxThreads = argc > 0 ? std::stoul(argv[0]) : std::thread::hardware_concurrency();
+        int seconds = argc > 1 ? std::stoi(argv[1]) : 3;
+        std::size_t numOfClients = argc > 2 ? std::stoul(argv[2]) : std::max<std::size_t>(2, maxThreads);
+
+        std::vector<Net::MultiServer::Mode> modes = { Net::MultiServer::Mode::RoundRobin };
+
+        if (Net::ReusePortSupported) {
+            modes.insert(modes.begin(), Net::MultiServer::Mode::ReusePort);
+        }
+
+        std::cout << "mode        threads   conn/s\n";
+
+        for (auto mode : modes) {
+            for (std::size_t numOfThreads = 1; numOfThreads <= maxThreads; numOfThreads *= 2) {
+                Measure(mode, numOfThreads, numOfClients, std::chrono::seconds(seconds));
+            }
+        }
+
+        return 0;
+    }
+
+private:
+
+    static void Measure(
+        Sari::Net::MultiServer::Mode mode,
+        std::size_t numOfThreads, std::size_t numOfClients,
+        std::chrono::seconds duration
+    )
+    {
+        namespace Net = Sari::Net;
+        using boost::asio::ip::tcp;
+
+        std::atomic<std::size_t> accepted{0};
+
+        Net::MultiServer server(
+            0,
+            [&accepted](const boost::system::error_code& ec, tcp::socket) {
+                if (!ec) {
+                    // The peer is closed right away, the client waits for the end of stream.
+                    accepted.fetch_add(1, std::memory_order_relaxed);
+                }
+            },
+            numOfThreads, mode
+        );
+
+        server.start();
+
+        tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), server.localEndpoint().port());
+
+        std::atomic<bool> stopped{false};
+        std::atomic<std::size_t> completed{0};
+        std::vector<std::thread> clients;
+
+        for (std::size_t i = 0; i < numOfClients; i++) {
+            clients.emplace_back([&]() {
+                boost::asio::io_context ioContext;
+
+                while (!stopped.load(std::memory_order_relaxed)) {
+
+                    tcp::socket sock(ioContext);
+                    boost::system::error_code ec;
+
+                    sock.connect(endpoint, ec);
+
+                    if (ec) {
+                        continue;
+                    }
+
+                    char c;
+                    sock.read_some(boost::asio::buffer(&c, 1), ec);
+
+                    completed.fetch_add(1, std::memory_order_relaxed);
+                }
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(duration);
+        stopped = true;
+
+        for (auto& client : clients) {
+            client.join();
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        server.stop();
+        server.join();
+
+        std::cout
+            << (mode == Net::MultiServer::Mode::ReusePort ? "ReusePort " : "RoundRobin")
+            << "  " << numOfThreads
+            << "         " << static_cast<std::size_t>(completed / elapsed.count())
+            << '\n';
+    }
+
+};
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sari/net/server.h"
+#include "sari/stream/transfer.h"
+#include "Memory.h"
+
+// Runs bulk and interactive flows through Transfer::Forward relays at the same time and reports
+// the socket operations per relayed megabyte and the resident memory of the process. Every
+// read or write of a relay is one recv or send call on the reactor backends, so the operation
+// counts stand in for syscall counts. Run it once with the maximum buffer size equal to 4096
+// to get the fixed size baseline.
+//
+// Usage: Benchmark adaptive [max buffer size] [bulk flows] [interactive flows] [megabytes per bulk flow]
+class AdaptiveBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        Sari::Stream::Transfer::Options options;
+        options.maxBufferSize = argc > 0 ? std::stoul(argv[0]) : options.maxBufferSize;
+
+        std::size_t bulkFlows = argc > 1 ? std::stoul(argv[1]) : 4;
+        std::size_t interactiveFlows = argc > 2 ? std::stoul(argv[2]) : 1000;
+        std::size_t megabytes = argc > 3 ? std::stoul(argv[3]) : 256;
+
+        long residentBefore = ResidentKiB();
+
+        Upstream upstream;
+        Relays relays(upstream, options);
+
+        // the interactive clients send a short message every 100 ms and wait for its echo
+        boost::asio::io_context clientContext;
+        std::vector<std::shared_ptr<Interactive>> interactive;
+        std::atomic<bool> stopping = false;
+
+        for (std::size_t i = 0; i < interactiveFlows; ++i) {
+            interactive.push_back(std::make_shared<Interactive>(clientContext, relays.interactiveEndpoint(), stopping));
+            interactive.back()->start();
+        }
+
+        std::thread clientThread([&clientContext]() {
+            clientContext.run();
+        });
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> bulk;
+
+        for (std::size_t i = 0; i < bulkFlows; ++i) {
+            bulk.emplace_back([&relays, megabytes]() {
+                boost::asio::io_context context;
+                tcp::socket client(context);
+                client.connect(relays.bulkEndpoint());
+
+                std::vector<char> buff(64 * 1024);
+                std::size_t total = megabytes * 1024 * 1024;
+
+                for (std::size_t sent = 0; sent < total; ) {
+                    sent += boost::asio::write(client, boost::asio::buffer(buff));
+                }
+
+                client.shutdown(tcp::socket::shutdown_send);
+            });
+        }
+
+        for (auto& thread : bulk) {
+            thread.join();
+        }
+
+        while (upstream.finishedBulkFlows() < bulkFlows) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        long residentBusy = ResidentKiB();
+
+        // the interactive flows keep running, their buffers should shrink back after being idle
+        std::this_thread::sleep_for(options.idleTimeout + std::chrono::milliseconds(500));
+        long residentAfter = ResidentKiB();
+
+        stopping = true;
+        clientContext.stop();
+        clientThread.join();
+
+        double bulkMegabytes = relays.bulk.bytes / (1024.0 * 1024.0);
+        double interactiveMegabytes = relays.interactive.bytes / (1024.0 * 1024.0);
+
+        std::cout << "buffers           " << options.bufferSize << " .. " << options.maxBufferSize << '\n';
+        std::cout << "bulk MB/s         " << static_cast<long>(bulkFlows * megabytes / elapsed.count()) << '\n';
+        std::cout << "bulk ops/MB       " << (relays.bulk.reads + relays.bulk.writes) / bulkMegabytes << '\n';
+        std::cout << "interactive ops/MB " << (relays.interactive.reads + relays.interactive.writes) / interactiveMegabytes << '\n';
+
+        if (residentBefore >= 0) {
+            std::cout << "RSS busy KiB      " << residentBusy - residentBefore << '\n';
+            std::cout << "RSS idle KiB      " << residentAfter - residentBefore << '\n';
+        }
+        else {
+            std::cout << "RSS               not measured on this platform\n";
+        }
+
+        return 0;
+    }
+
+private:
+
+    using tcp = boost::asio::ip::tcp;
+
+    // Counts the operations and the bytes written by the relays of one kind of flows.
+    struct Counters {
+        std::atomic<std::size_t> reads = 0;
+        std::atomic<std::size_t> writes = 0;
+        std::atomic<std::size_t> bytes = 0;
+    };
+
+    // Wraps a socket of a relay and counts its operations.
+    class CountingStream {
+    public:
+
+        using executor_type = tcp::socket::executor_type;
+
+        CountingStream(tcp::socket socket, Counters& counters) :
+            socket_(std::move(socket)),
+            counters_(counters)
+        {}
+
+        executor_type get_executor() { return socket_.get_executor(); }
+
+        template<typename MutableBufferSequence, typename ReadHandler>
+        void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+        {
+            ++counters_.reads;
+            socket_.async_read_some(buffers, std::forward<ReadHandler>(handler));
+        }
+
+        template<typename ConstBufferSequence, typename WriteHandler>
+        void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+        {
+            ++counters_.writes;
+            socket_.async_write_some(
+                buffers,
+                [this, handler = std::forward<WriteHandler>(handler)](const boost::system::error_code& ec, std::size_t bytes) mutable {
+                    counters_.bytes += bytes;
+                    handler(ec, bytes);
+                }
+            );
+        }
+
+        void close()
+        {
+            boost::system::error_code ec;
+            socket_.close(ec);
+        }
+
+    private:
+        tcp::socket socket_;
+        Counters& counters_;
+    };
+
+    // Discards the bulk flows and echoes the interactive flows.
+    class Upstream {
+    public:
+
+        Upstream() :
+            sink_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this](const boost::system::error_code& ec, tcp::socket peer) {
+                    if (!ec) {
+                        discard(std::make_shared<tcp::socket>(std::move(peer)), std::make_shared<std::vector<char>>(256 * 1024));
+                    }
+                }
+            ),
+            echo_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this](const boost::system::error_code& ec, tcp::socket peer) {
+                    if (!ec) {
+                        peer.set_option(tcp::no_delay(true));
+                        echo(std::make_shared<tcp::socket>(std::move(peer)), std::make_shared<std::array<char, 64>>());
+                    }
+                }
+            ),
+            thread_([this]() { context_.run(); })
+        {}
+
+        ~Upstream()
+        {
+            context_.stop();
+            thread_.join();
+        }
+
+        tcp::endpoint sinkEndpoint() const { return sink_.localEndpoint(); }
+        tcp::endpoint echoEndpoint() const { return echo_.localEndpoint(); }
+        std::size_t finishedBulkFlows() const { return finished_; }
+
+    private:
+
+        void discard(std::shared_ptr<tcp::socket> peer, std::shared_ptr<std::vector<char>> buff)
+        {
+            peer->async_read_some(boost::asio::buffer(*buff), [this, peer, buff](const boost::system::error_code& ec, std::size_t) {
+                if (ec) {
+                    ++finished_;
+                    return;
+                }
+                discard(peer, buff);
+            });
+        }
+
+        void echo(std::shared_ptr<tcp::socket> peer, std::shared_ptr<std::array<char, 64>> buff)
+        {
+            peer->async_read_some(boost::asio::buffer(*buff), [this, peer, buff](const boost::system::error_code& ec, std::size_t bytes) {
+                if (ec) {
+                    return;
+                }
+                boost::asio::async_write(*peer, boost::asio::buffer(*buff, bytes), [this, peer, buff](const boost::system::error_code& ec, std::size_t) {
+                    if (!ec) {
+                        echo(peer, buff);
+                    }
+                });
+            });
+        }
+
+        boost::asio::io_context context_;
+        Sari::Net::Server sink_;
+        Sari::Net::Server echo_;
+        std::atomic<std::size_t> finished_ = 0;
+        std::thread thread_;
+    };
+
+    // Relays the bulk flows to the sink and the interactive flows to the echo.
+    class Relays {
+    public:
+
+        Relays(const Upstream& upstream, const Sari::Stream::Transfer::Options& options) :
+            bulkServer_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this, target = upstream.sinkEndpoint(), options](const boost::system::error_code& ec, tcp::socket peer) {
+                    if (!ec) {
+                        relay(std::move(peer), target, bulk, options);
+                    }
+                }
+            ),
+            interactiveServer_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this, target = upstream.echoEndpoint(), options](const boost::system::error_code& ec, tcp::socket peer) {
+                    if (!ec) {
+                        relay(std::move(peer), target, interactive, options);
+                    }
+                }
+            ),
+            thread_([this]() { context_.run(); })
+        {}
+
+        ~Relays()
+        {
+            context_.stop();
+            thread_.join();
+        }
+
+        tcp::endpoint bulkEndpoint() const { return bulkServer_.localEndpoint(); }
+        tcp::endpoint interactiveEndpoint() const { return interactiveServer_.localEndpoint(); }
+
+        Counters bulk;
+        Counters interactive;
+
+    private:
+
+        void relay(tcp::socket peer, const tcp::endpoint& target, Counters& counters, const Sari::Stream::Transfer::Options& options)
+        {
+            tcp::socket out(context_);
+            out.connect(target);
+            out.set_option(tcp::no_delay(true));
+            peer.set_option(tcp::no_delay(true));
+
+            auto first = std::make_shared<CountingStream>(std::move(peer), counters);
+            auto second = std::make_shared<CountingStream>(std::move(out), counters);
+
+            Sari::Stream::Transfer::Forward(*first, *second, options)
+                .then([first, second]() {});
+        }
+
+        boost::asio::io_context context_;
+        Sari::Net::Server bulkServer_;
+        Sari::Net::Server interactiveServer_;
+        std::thread thread_;
+    };
+
+    // A client of an interactive flow.
+    class Interactive : public std::enable_shared_from_this<Interactive> {
+    public:
+
+        Interactive(boost::asio::io_context& context, const tcp::endpoint& endpoint, const std::atomic<bool>& stopping) :
+            socket_(context),
+            timer_(context),
+            stopping_(stopping)
+        {
+            socket_.connect(endpoint);
+            socket_.set_option(tcp::no_delay(true));
+        }
+
+        void start()
+        {
+            timer_.expires_after(std::chrono::milliseconds(100));
+            timer_.async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+
+                if (ec || self->stopping_) {
+                    return;
+                }
+
+                boost::asio::async_write(self->socket_, boost::asio::buffer(self->buff_), [self](const boost::system::error_code& ec, std::size_t) {
+                    if (ec) {
+                        return;
+                    }
+                    boost::asio::async_read(self->socket_, boost::asio::buffer(self->buff_), [self](const boost::system::error_code& ec, std::size_t) {
+                        if (!ec) {
+                            self->start();
+                        }
+                    });
+                });
+            });
+        }
+
+    private:
+        tcp::socket socket_;
+        boost::asio::steady_timer timer_;
+        const std::atomic<bool>& stopping_;
+        std::array<char, 32> buff_ = {};
+    };
+
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+#include "sari/socks5/auth.h"
+
+// Measures the username/password authentication: how long the credential index of a file of
+// users takes to load, how many authentications it serves per second and how a slow blocking
+// authenticator behind a session cache performs, the first time and once the users are cached.
+//
+// Usage: Benchmark auth [users] [authentications]
+class AuthBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        namespace Socks5 = Sari::Socks5;
+
+        std::size_t users = argc > 0 ? std::stoul(argv[0]) : 100000;
+        std::size_t authentications = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+        auto path = std::filesystem::temp_directory_path() / "sari-auth-bench.txt";
+
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+            for (std::size_t i = 0; i < users; ++i) {
+                file << "user" << i << ":password" << i << '\n';
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Socks5::CredentialStore store(path.string());
+
+        std::cout << "loaded " << store.index()->size() << " users in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+
+        std::cout << "authenticator                 authentications/s\n";
+
+        boost::asio::io_context ioContext;
+        Socks5::IndexAuthenticator index(store);
+
+        Measure("index", ioContext, index, users, authentications, true);
+
+        // a directory answering in a millisecond
+        boost::asio::thread_pool workers(4);
+
+        auto blocking = std::make_shared<Socks5::BlockingAuthenticator>(
+            [&store](std::string_view username, std::string_view password) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return store.index()->verify(username, password);
+            },
+            workers.get_executor(),
+            4
+        );
+
+        Socks5::CachingAuthenticator cached(blocking);
+        std::size_t slowUsers = std::min<std::size_t>(users, 2000);
+
+        // rejected credentials are never cached, so all passwords are right
+        Measure("blocking 1 ms, 4 at once", ioContext, cached, slowUsers, slowUsers, false);
+        Measure("blocking 1 ms, cached", ioContext, cached, slowUsers, authentications, false);
+
+        workers.join();
+        std::filesystem::remove(path);
+
+        return 0;
+    }
+
+private:
+
+    // Keeps batches of authentications in flight, every tenth one with a wrong password if
+    // asked to.
+    static void Measure(
+        const char* name,
+        boost::asio::io_context& ioContext,
+        Sari::Socks5::Authenticator& authenticator,
+        std::size_t users,
+        std::size_t authentications,
+        bool wrongPasswords
+    )
+    {
+        namespace Socks5 = Sari::Socks5;
+
+        constexpr std::size_t Batch = 64;
+
+        std::size_t started = 0;
+        std::size_t accepted = 0;
+        std::size_t completed = 0;
+
+        // the next batch starts once the previous one has completed
+        std::function<void()> startBatch = [&]() {
+
+            std::size_t batch = std::min(Batch, authentications - started);
+
+            for (std::size_t i = 0; i < batch; ++i, ++started) {
+
+                std::string user = std::to_string(started % users);
+                bool wrong = wrongPasswords && started % 10 == 9;
+
+                authenticator.authenticate(ioContext.get_executor(), Socks5::UserPassRequest{ "user" + user, (wrong ? "wrong" : "password") + user })
+                    .then([&](bool valid) {
+                        accepted += valid ? 1 : 0;
+                        if (++completed == started && started < authentications) {
+                            startBatch();
+                        }
+                    });
+            }
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        startBatch();
+        ioContext.restart();
+        ioContext.run();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::left << std::setw(30) << name << static_cast<long>(completed / seconds)
+            << (accepted == authentications - (wrongPasswords ? authentications / 10 : 0) ? "" : "  (unexpected results)") << '\n';
+    }
+
+};
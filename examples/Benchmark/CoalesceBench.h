@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+#include "sari/stream/transfer.h"
+
+// Relays small messages with Transfer::Redirect, with and without write coalescing, from
+// a source that yields one message per read call to a sink whose write calls take a while
+// to complete, like a socket whose peer reads slowly. Reports the read and write calls
+// of the relay per message, i.e. its system calls when relaying between sockets.
+//
+// Usage: Benchmark coalesce [messages] [message size] [write microseconds] [coalesced buffers]
+class CoalesceBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        std::size_t messages = argc > 0 ? std::stoul(argv[0]) : 100000;
+        std::size_t messageSize = argc > 1 ? std::stoul(argv[1]) : 64;
+        auto writeTime = std::chrono::microseconds(argc > 2 ? std::stoul(argv[2]) : 20);
+        std::size_t coalescedBuffers = argc > 3 ? std::stoul(argv[3]) : 16;
+
+        std::cout << "messages      " << messages << " x " << messageSize << " bytes, writes take " << writeTime.count() << " us\n";
+        std::cout << "mode          msgs/s      reads/msg   writes/msg  bytes/write\n";
+
+        for (std::size_t buffers : { std::size_t(1), coalescedBuffers }) {
+
+            Sari::Stream::Transfer::Options options;
+            options.coalescedBuffers = buffers;
+
+            boost::asio::io_context ioContext;
+            Source source(ioContext, messages, messageSize);
+            Sink sink(ioContext, writeTime);
+            Sari::Stream::Transfer::Stats stats;
+
+            auto start = std::chrono::steady_clock::now();
+
+            Sari::Stream::Transfer::Redirect(source, sink, options)
+                .then([&stats](const Sari::Stream::Transfer::Stats& result) {
+                    stats = result;
+                });
+
+            ioContext.run();
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const auto& direction = stats.directions[0];
+
+            std::cout << std::left << std::setw(14) << (buffers > 1 ? "coalesce " + std::to_string(buffers) : "one by one")
+                << std::setw(12) << static_cast<long long>(messages / seconds)
+                << std::setw(12) << std::setprecision(3) << static_cast<double>(direction.reads) / messages
+                << std::setw(12) << static_cast<double>(direction.writes) / messages
+                << (direction.writes ? direction.bytes / direction.writes : 0) << '\n';
+        }
+
+        return 0;
+    }
+
+private:
+
+    // Yields one message per read, then the end of the stream.
+    class Source {
+    public:
+
+        using executor_type = boost::asio::io_context::executor_type;
+
+        Source(boost::asio::io_context& ioContext, std::size_t messages, std::size_t messageSize) :
+            ioContext_(ioContext),
+            messages_(messages),
+            messageSize_(messageSize)
+        {}
+
+        executor_type get_executor() { return ioContext_.get_executor(); }
+
+        template<typename MutableBuffers, typename Handler>
+        void async_read_some(const MutableBuffers& buffers, Handler&& handler)
+        {
+            std::size_t bytes = 0;
+            boost::system::error_code ec;
+
+            if (messages_ == 0) {
+                ec = boost::asio::error::eof;
+            }
+            else {
+                --messages_;
+                bytes = std::min(messageSize_, boost::asio::buffer_size(buffers));
+            }
+
+            boost::asio::post(ioContext_, [handler = std::forward<Handler>(handler), ec, bytes]() mutable {
+                handler(ec, bytes);
+            });
+        }
+
+        void close() {}
+
+    private:
+        boost::asio::io_context& ioContext_;
+        std::size_t messages_;
+        std::size_t messageSize_;
+    };
+
+    // Takes any number of bytes with each write, which completes after the write time.
+    class Sink {
+    public:
+
+        using executor_type = boost::asio::io_context::executor_type;
+
+        Sink(boost::asio::io_context& ioContext, std::chrono::microseconds writeTime) :
+            ioContext_(ioContext),
+            timer_(ioContext),
+            writeTime_(writeTime)
+        {}
+
+        executor_type get_executor() { return ioContext_.get_executor(); }
+
+        template<typename ConstBuffers, typename Handler>
+        void async_write_some(const ConstBuffers& buffers, Handler&& handler)
+        {
+            std::size_t bytes = boost::asio::buffer_size(buffers);
+
+            timer_.expires_after(writeTime_);
+            timer_.async_wait([handler = std::forward<Handler>(handler), bytes](const boost::system::error_code&) mutable {
+                handler(boost::system::error_code(), bytes);
+            });
+        }
+
+        void close() {}
+
+    private:
+        boost::asio::io_context& ioContext_;
+        boost::asio::steady_timer timer_;
+        std::chrono::microseconds writeTime_;
+    };
+
+};
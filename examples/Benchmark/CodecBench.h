@@ -0,0 +1,242 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "sari/socks5/socks5.h"
+#include "sari/stream/memory_pipe.h"
+#include "CodecFuzz.h"
+#include "Memory.h"
+
+// Drives the encoding and the decoding of SOCKS5 messages over Stream::MemoryPipe. Every
+// message is sent by its AsyncSend function and must arrive as CodecFuzz::Encode has it, the
+// send resolving with the message, and is received by its AsyncRecv function from the bytes split at every boundary, in two
+// writes. Then it measures the parses per second and the allocations per parse of the parser
+// alone and of the receive over the pipe, and runs the checks of CodecFuzz on mutations of
+// the messages.
+//
+// Usage: Benchmark codec [parses] [fuzzed inputs]
+class CodecBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        namespace Socks5 = Sari::Socks5;
+        using Socks5::RecvBuffer;
+        using tcp = boost::asio::ip::tcp;
+
+        std::size_t parses = argc > 0 ? std::stoul(argv[0]) : 1000000;
+        std::size_t fuzzedInputs = argc > 1 ? std::stoul(argv[1]) : 100000;
+
+        std::vector<Socks5::Method> allMethods;
+        for (int i = 0; i < 255; ++i) {
+            allMethods.push_back(static_cast<Socks5::Method>(i));
+        }
+
+        auto v4 = tcp::endpoint(boost::asio::ip::make_address("192.0.2.1"), 1080);
+        auto v6 = tcp::endpoint(boost::asio::ip::make_address("2001:db8::1"), 1080);
+        std::string longName(255, 'a');
+
+        std::cout << "message              splits  parser parses/s  allocs/parse  stream parses/s  allocs/parse\n";
+
+        std::vector<std::string> samples;
+
+        auto methodRequest = [](auto& stream, const Socks5::MethodRequest& methReq) { return Socks5::AsyncSendMethodRequest(stream, methReq); };
+        auto recvMethodRequest = [](auto& stream, RecvBuffer& buffer) { return Socks5::AsyncRecvMethodRequest(stream, buffer); };
+        auto userPassRequest = [](auto& stream, const Socks5::UserPassRequest& userPassReq) { return Socks5::AsyncSendUserPassRequest(stream, userPassReq); };
+        auto recvUserPassRequest = [](auto& stream, RecvBuffer& buffer) { return Socks5::AsyncRecvUserPassRequest(stream, buffer); };
+        auto commandRequest = [](auto& stream, const Socks5::CommandRequest& cmdReq) { return Socks5::AsyncSendCommandRequest(stream, cmdReq); };
+        auto recvCommandRequest = [](auto& stream, RecvBuffer& buffer) { return Socks5::AsyncRecvCommandRequest(stream, buffer); };
+        auto commandReply = [](auto& stream, const Socks5::CommandReply& cmdReply) { return Socks5::AsyncSendCommandReply(stream, cmdReply); };
+        auto recvCommandReply = [](auto& stream, RecvBuffer& buffer) { return Socks5::AsyncRecvCommandReply(stream, buffer); };
+
+        samples.push_back(Measure<Socks5::MethodRequestParser>("method request 1", Socks5::MethodRequest{ { Socks5::Method::NoAuthRequired } }, methodRequest, recvMethodRequest, parses));
+        samples.push_back(Measure<Socks5::MethodRequestParser>("method request 255", Socks5::MethodRequest{ allMethods }, methodRequest, recvMethodRequest, parses));
+        samples.push_back(Measure<Socks5::UserPassRequestParser>("user/pass request", Socks5::UserPassRequest{ "user", "password" }, userPassRequest, recvUserPassRequest, parses));
+        samples.push_back(Measure<Socks5::UserPassRequestParser>("user/pass 255", Socks5::UserPassRequest{ longName, longName }, userPassRequest, recvUserPassRequest, parses));
+        samples.push_back(Measure<Socks5::CommandRequestParser>("connect IPv4", Socks5::CommandRequest{ Socks5::Command::Connect, v4 }, commandRequest, recvCommandRequest, parses));
+        samples.push_back(Measure<Socks5::CommandRequestParser>("connect IPv6", Socks5::CommandRequest{ Socks5::Command::Connect, v6 }, commandRequest, recvCommandRequest, parses));
+        samples.push_back(Measure<Socks5::CommandRequestParser>("connect domain", Socks5::CommandRequest{ Socks5::Command::Connect, "www.example.com", 443 }, commandRequest, recvCommandRequest, parses));
+        samples.push_back(Measure<Socks5::CommandRequestParser>("connect domain 255", Socks5::CommandRequest{ Socks5::Command::Connect, longName, 443 }, commandRequest, recvCommandRequest, parses));
+        samples.push_back(Measure<Socks5::CommandReplyParser>("reply IPv4", Socks5::CommandReply{ Socks5::Reply::Succeeded, v4 }, commandReply, recvCommandReply, parses));
+        samples.push_back(Measure<Socks5::CommandReplyParser>("reply IPv6", Socks5::CommandReply{ Socks5::Reply::Succeeded, v6 }, commandReply, recvCommandReply, parses));
+
+        // mutations of the messages: changed bytes, cut off or extended
+        std::mt19937 random(1);
+
+        for (std::size_t i = 0; i < fuzzedInputs; ++i) {
+
+            std::string input = samples[random() % samples.size()];
+
+            for (std::size_t mutations = 1 + random() % 4; mutations > 0; --mutations) {
+                switch (random() % 3) {
+                    case 0:
+                        input[random() % input.size()] = static_cast<char>(random() % 4 == 0 ? random() % 5 : random());
+                        break;
+                    case 1:
+                        input.resize(random() % (input.size() + 1));
+                        break;
+                    default:
+                        input.append(random() % 8, static_cast<char>(random()));
+                        break;
+                }
+                if (input.empty()) {
+                    input.push_back(static_cast<char>(random()));
+                }
+            }
+
+            CodecFuzz::Run(reinterpret_cast<const std::uint8_t*>(input.data()), input.size());
+        }
+
+        std::cout << "fuzzed " << fuzzedInputs << " mutated messages\n";
+
+        return 0;
+    }
+
+private:
+
+    using MemoryPipe = Sari::Stream::MemoryPipe;
+
+    // Sends the message through a pipe and returns the bytes which have arrived, or an empty
+    // string if the send has not resolved with the message.
+    template<typename Message, typename Send>
+    static std::string SendBytes(boost::asio::io_context& ioContext, const Message& message, Send send)
+    {
+        MemoryPipe readEnd(ioContext), writeEnd(ioContext);
+        Sari::Stream::ConnectPipe(readEnd, writeEnd);
+
+        std::string sent;
+
+        send(writeEnd, message)
+            .then([&sent](Message message) {
+                sent = CodecFuzz::Encode(message);
+            }).fail([]() {});
+
+        ioContext.restart();
+        ioContext.poll();
+
+        if (sent != CodecFuzz::Encode(message)) {
+            return std::string();
+        }
+
+        std::string bytes(readEnd.available(), '\0');
+
+        readEnd.async_read_some(boost::asio::buffer(bytes), [](const boost::system::error_code&, std::size_t) {});
+        ioContext.restart();
+        ioContext.poll();
+
+        return bytes;
+    }
+
+    // Receives a message from the bytes written in two pieces, split at the position, and
+    // returns it encoded or an empty string if it has not arrived.
+    template<typename Message, typename Recv>
+    static std::string ReceiveSplit(boost::asio::io_context& ioContext, const std::string& bytes, std::size_t split, Recv recv)
+    {
+        MemoryPipe readEnd(ioContext), writeEnd(ioContext);
+        Sari::Stream::ConnectPipe(readEnd, writeEnd);
+        Sari::Socks5::RecvBuffer buffer;
+
+        std::string received;
+
+        recv(readEnd, buffer)
+            .then([&received](Message message) {
+                received = CodecFuzz::Encode(message);
+            }).fail([]() {});
+
+        for (std::string piece : { bytes.substr(0, split), bytes.substr(split) }) {
+            boost::asio::async_write(writeEnd, boost::asio::buffer(piece), [](const boost::system::error_code&, std::size_t) {});
+            ioContext.restart();
+            ioContext.poll();
+        }
+
+        return received;
+    }
+
+    template<typename Parser, typename Message, typename Send, typename Recv>
+    static std::string Measure(const char* name, const Message& message, Send send, Recv recv, std::size_t parses)
+    {
+        boost::asio::io_context ioContext;
+
+        const std::string expected = CodecFuzz::Encode(message);
+
+        if (SendBytes(ioContext, message, send) != expected) {
+            std::cout << name << ": the sent bytes differ from the encoded message\n";
+            return expected;
+        }
+
+        std::size_t splits = 0;
+
+        for (std::size_t split = 1; split < expected.size(); ++split, ++splits) {
+            if (ReceiveSplit<Message>(ioContext, expected, split, recv) != expected) {
+                std::cout << name << ": the message split at " << split << " is received wrong\n";
+                return expected;
+            }
+        }
+
+        const auto* data = reinterpret_cast<const unsigned char*>(expected.data());
+        std::size_t received = 0;
+
+        // the parser alone
+        Allocations = 0;
+        CountAllocations = true;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < parses; ++i) {
+            Parser parser;
+            boost::system::error_code ec;
+            parser.parse(data, expected.size(), ec);
+            received += parser.done() && parser.message().getRaw().ver == expected[0] ? 1 : 0;
+        }
+
+        double parserSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::size_t parserAllocations = Allocations;
+
+        // the whole receive, the message arriving in one write
+        std::size_t streamParses = parses / 10;
+
+        MemoryPipe readEnd(ioContext), writeEnd(ioContext);
+        Sari::Stream::ConnectPipe(readEnd, writeEnd);
+        Sari::Socks5::RecvBuffer buffer;
+
+        Allocations = 0;
+        start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < streamParses; ++i) {
+
+            boost::asio::async_write(writeEnd, boost::asio::buffer(expected), [](const boost::system::error_code&, std::size_t) {});
+
+            recv(readEnd, buffer)
+                .then([&received](Message) {
+                    ++received;
+                });
+
+            ioContext.restart();
+            ioContext.poll();
+        }
+
+        double streamSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::size_t streamAllocations = Allocations;
+
+        CountAllocations = false;
+
+        std::cout << std::left << std::fixed << std::setprecision(2)
+            << std::setw(21) << name
+            << std::setw(8) << splits
+            << std::setw(17) << static_cast<long>(parses / parserSeconds)
+            << std::setw(14) << static_cast<double>(parserAllocations) / parses
+            << std::setw(17) << static_cast<long>(streamParses / streamSeconds)
+            << static_cast<double>(streamAllocations) / streamParses
+            << (received == parses + streamParses ? "" : "  (unexpected results)") << '\n';
+        std::cout.unsetf(std::ios::fixed);
+
+        return expected;
+    }
+
+};
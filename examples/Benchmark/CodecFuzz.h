@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "sari/socks5/parser.h"
+
+// Checks the parsers of the messages a SOCKS5 server receives against arbitrary bytes. Each
+// parser is given the bytes at once and then byte by byte, both must consume the same bytes
+// with the same outcome, and a parsed message must be encoded back to exactly the bytes it
+// was parsed from. A failed check aborts, which is what fuzzers report as a crash.
+namespace CodecFuzz {
+
+    // The messages as they are sent.
+    inline std::string Encode(const Sari::Socks5::MethodRequest& methReq)
+    {
+        const auto& raw = methReq.getRaw();
+
+        std::string bytes{ static_cast<char>(raw.ver), static_cast<char>(raw.nmethods) };
+        bytes.append(reinterpret_cast<const char*>(raw.methods), raw.nmethods);
+
+        return bytes;
+    }
+
+    inline std::string Encode(const Sari::Socks5::UserPassRequest& userPassReq)
+    {
+        const auto& raw = userPassReq.getRaw();
+
+        std::string bytes{ static_cast<char>(raw.ver), static_cast<char>(raw.ulen) };
+        bytes.append(raw.uname, raw.ulen);
+        bytes.push_back(static_cast<char>(raw.plen));
+        bytes.append(raw.passwd, raw.plen);
+
+        return bytes;
+    }
+
+    inline std::string Encode(unsigned char ver, unsigned char code, unsigned char rsv, const Sari::Socks5::RawAddress& addr)
+    {
+        std::string bytes{ static_cast<char>(ver), static_cast<char>(code), static_cast<char>(rsv), static_cast<char>(addr.atyp) };
+        bytes.append(reinterpret_cast<const char*>(addr.data()), addr.size());
+        bytes.append(reinterpret_cast<const char*>(&addr.port), sizeof(addr.port));
+
+        return bytes;
+    }
+
+    inline std::string Encode(const Sari::Socks5::CommandRequest& cmdReq)
+    {
+        const auto& raw = cmdReq.getRaw();
+        return Encode(raw.ver, static_cast<unsigned char>(raw.cmd), raw.rsv, raw.dest);
+    }
+
+    inline std::string Encode(const Sari::Socks5::CommandReply& cmdReply)
+    {
+        const auto& raw = cmdReply.getRaw();
+        return Encode(raw.ver, static_cast<unsigned char>(raw.rep), raw.rsv, raw.bind);
+    }
+
+    inline void Fail(const char* parser, const char* what)
+    {
+        std::cerr << parser << ": " << what << '\n';
+        std::abort();
+    }
+
+    template<typename Parser>
+    void Check(const char* name, const std::uint8_t* data, std::size_t size)
+    {
+        Parser whole;
+        boost::system::error_code wholeEc;
+        std::size_t wholeConsumed = whole.parse(data, size, wholeEc);
+
+        Parser pieces;
+        boost::system::error_code piecesEc;
+        std::size_t piecesConsumed = 0;
+
+        while (piecesConsumed < size && !pieces.done() && !piecesEc) {
+            std::size_t consumed = pieces.parse(data + piecesConsumed, 1, piecesEc);
+            if (consumed > 1) {
+                Fail(name, "consumed more than it was given");
+            }
+            piecesConsumed += consumed;
+        }
+
+        if (wholeConsumed > size) {
+            Fail(name, "consumed more than it was given");
+        }
+        if (wholeConsumed != piecesConsumed || wholeEc != piecesEc || whole.done() != pieces.done()) {
+            Fail(name, "the outcome depends on how the bytes are split");
+        }
+        if (!whole.done() && !wholeEc && wholeConsumed != size) {
+            Fail(name, "stopped before the end of an incomplete message");
+        }
+        if (whole.done()) {
+            std::string expected(reinterpret_cast<const char*>(data), wholeConsumed);
+            if (Encode(whole.message()) != expected || Encode(pieces.message()) != expected) {
+                Fail(name, "the message is not encoded back to its bytes");
+            }
+        }
+    }
+
+    // Runs the checks of all parsers on the bytes.
+    inline void Run(const std::uint8_t* data, std::size_t size)
+    {
+        namespace Socks5 = Sari::Socks5;
+
+        Check<Socks5::MethodRequestParser>("method request", data, size);
+        Check<Socks5::UserPassRequestParser>("username/password request", data, size);
+        Check<Socks5::CommandRequestParser>("command request", data, size);
+        Check<Socks5::CommandReplyParser>("command reply", data, size);
+    }
+
+}
@@ -0,0 +1,16 @@
+// The libFuzzer entry point of the SOCKS5 parsers, see CodecFuzz.h. It is not a part of the
+// Benchmark build, build it on its own, e.g.
+//
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -I../../SariLib/src CodecFuzzer.cpp -o CodecFuzzer
+//
+// or with /fsanitize=fuzzer /fsanitize=address by MSVC.
+
+#include <cstddef>
+#include <cstdint>
+#include "CodecFuzz.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+    CodecFuzz::Run(data, size);
+    return 0;
+}
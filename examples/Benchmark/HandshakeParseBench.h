@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "sari/socks5/socks5.h"
+
+// Compares the reception of SOCKS5 handshakes by the chains of exact reads with the parsers
+// reading through Socks5::RecvBuffer. A loopback client repeats the method and the command
+// request, one after the other or both in one write, and the server replies to them. Reports
+// handshakes per second and the read calls of the server per handshake.
+//
+// Usage: Benchmark handshake [handshakes]
+class HandshakeParseBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        std::size_t handshakes = argc > 0 ? std::stoul(argv[0]) : 50000;
+
+        std::cout << "server        client      handshakes/s  reads/handshake\n";
+
+        for (bool buffered : { false, true }) {
+            for (bool pipelined : { false, true }) {
+                Measure(buffered, pipelined, handshakes);
+            }
+        }
+
+        return 0;
+    }
+
+private:
+
+    using tcp = boost::asio::ip::tcp;
+
+    // Counts the read calls made on the socket.
+    class CountingStream {
+    public:
+
+        using executor_type = tcp::socket::executor_type;
+
+        explicit CountingStream(tcp::socket& socket) :
+            socket_(socket)
+        {}
+
+        executor_type get_executor() { return socket_.get_executor(); }
+
+        template<typename MutableBuffers, typename Handler>
+        void async_read_some(const MutableBuffers& buffers, Handler&& handler)
+        {
+            ++reads;
+            socket_.async_read_some(buffers, std::forward<Handler>(handler));
+        }
+
+        template<typename ConstBuffers, typename Handler>
+        void async_write_some(const ConstBuffers& buffers, Handler&& handler)
+        {
+            socket_.async_write_some(buffers, std::forward<Handler>(handler));
+        }
+
+        std::size_t reads = 0;
+
+    private:
+        tcp::socket& socket_;
+    };
+
+    static void Measure(bool buffered, bool pipelined, std::size_t handshakes)
+    {
+        namespace Socks5 = Sari::Socks5;
+
+        boost::asio::io_context ioContext;
+
+        tcp::acceptor acceptor(ioContext, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        tcp::socket client(ioContext);
+        tcp::socket server(ioContext);
+
+        client.connect(acceptor.local_endpoint());
+        acceptor.accept(server);
+        client.set_option(tcp::no_delay(true));
+        server.set_option(tcp::no_delay(true));
+
+        CountingStream stream(server);
+        Socks5::RecvBuffer buffer;
+
+        const std::vector<unsigned char> methodRequest = { 0x05, 0x01, 0x00 };
+        const std::vector<unsigned char> commandRequest = { 0x05, 0x01, 0x00, 0x01, 127, 0, 0, 1, 0x00, 0x50 };
+        std::vector<unsigned char> replies(12);
+        std::size_t completed = 0;
+
+        // ends the run at the first error of the client or the server
+        auto failed = [&](const boost::system::error_code& ec) {
+            if (!ec) {
+                return false;
+            }
+            std::cerr << "error: " << ec.message() << '\n';
+            ioContext.stop();
+            return true;
+        };
+
+        // the client
+        std::function<void()> handshake = [&]() {
+
+            if (completed == handshakes) {
+                return;
+            }
+
+            auto done = [&](const boost::system::error_code& ec, std::size_t) {
+                if (!failed(ec)) {
+                    ++completed;
+                    handshake();
+                }
+            };
+
+            if (pipelined) {
+                std::vector<boost::asio::const_buffer> requests = {
+                    boost::asio::buffer(methodRequest), boost::asio::buffer(commandRequest)
+                };
+
+                boost::asio::async_write(client, requests, [&, done](const boost::system::error_code& ec, std::size_t) {
+                    if (!failed(ec)) {
+                        boost::asio::async_read(client, boost::asio::buffer(replies, 12), done);
+                    }
+                });
+                return;
+            }
+
+            boost::asio::async_write(client, boost::asio::buffer(methodRequest), [&, done](const boost::system::error_code& ec, std::size_t) {
+                if (failed(ec)) {
+                    return;
+                }
+                boost::asio::async_read(client, boost::asio::buffer(replies, 2), [&, done](const boost::system::error_code& ec, std::size_t) {
+                    if (failed(ec)) {
+                        return;
+                    }
+                    boost::asio::async_write(client, boost::asio::buffer(commandRequest), [&, done](const boost::system::error_code& ec, std::size_t) {
+                        if (!failed(ec)) {
+                            boost::asio::async_read(client, boost::asio::buffer(replies, 10), done);
+                        }
+                    });
+                });
+            });
+        };
+
+        // the server, each handshake is served by a new chain started by the previous one
+        std::function<void(std::size_t)> serve = [&](std::size_t remaining) {
+
+            if (remaining == 0) {
+                return;
+            }
+
+            (buffered ? Socks5::AsyncRecvMethodRequest(stream, buffer) : Socks5::AsyncRecvMethodRequest(stream))
+                .then([&](Socks5::MethodRequest) {
+                    return Socks5::AsyncSendMethodReply(stream, Socks5::MethodReply{ Socks5::Method::NoAuthRequired });
+                }).then([&]() {
+                    return buffered ? Socks5::AsyncRecvCommandRequest(stream, buffer) : Socks5::AsyncRecvCommandRequest(stream);
+                }).then([&](Socks5::CommandRequest cmdReq) {
+                    return Socks5::AsyncSendCommandReply(
+                        stream, Socks5::CommandReply{ Socks5::Reply::Succeeded, cmdReq.dest().getAddr() }
+                    );
+                }).then([&serve, remaining]() {
+                    serve(remaining - 1);
+                }).fail([&failed](const boost::system::error_code ec) {
+                    failed(ec);
+                });
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        serve(handshakes);
+        handshake();
+        ioContext.run();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::left
+            << std::setw(14) << (buffered ? "buffered" : "read chain")
+            << std::setw(12) << (pipelined ? "pipelined" : "one by one")
+            << std::setw(14) << static_cast<long>(completed / seconds)
+            << std::setprecision(3) << static_cast<double>(stream.reads) / std::max<std::size_t>(completed, 1)
+            << (completed == handshakes ? "" : "  (stopped after " + std::to_string(completed) + ")") << '\n';
+    }
+
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sari/net/server.h"
+#include "sari/stream/transfer.h"
+#include "sari/utils/buffer_pool.h"
+#include "Memory.h"
+
+// Opens many connections through Transfer::Forward relays, exchanges one message on each of
+// them and leaves them idle. Reports the memory and the file descriptors held per idle
+// connection and the high-water marks of the buffer pools. Pass 0 as the second argument to
+// read with a buffer held by every pending read instead of waiting for the sockets to become
+// readable, and 0 as the third one to relay through buffers rather than splice(2) pipes.
+//
+// Usage: Benchmark idle [connections] [wait readable] [splice]
+class IdleBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        using Sari::Utils::BufferPool;
+
+        std::size_t connections = argc > 0 ? std::stoul(argv[0]) : 2000;
+
+        Sari::Stream::Transfer::Options options;
+        options.waitReadable = argc > 1 ? std::stoul(argv[1]) != 0 : options.waitReadable;
+        options.splice = argc > 2 ? std::stoul(argv[2]) != 0 : options.splice;
+
+#if !defined(SARI_HAS_SPLICE)
+        options.splice = false;
+#endif
+
+        long residentBefore = ResidentKiB();
+        long descriptorsBefore = OpenDescriptors();
+        BufferPool::ResetHighWaterMarks();
+
+        Echo echo;
+        Relay relay(echo.localEndpoint(), options);
+
+        boost::asio::io_context clientContext;
+        std::vector<tcp::socket> clients;
+        std::array<char, 32> message = {};
+
+        for (std::size_t i = 0; i < connections; ++i) {
+            clients.emplace_back(clientContext);
+            clients.back().connect(relay.localEndpoint());
+            boost::asio::write(clients.back(), boost::asio::buffer(message));
+            boost::asio::read(clients.back(), boost::asio::buffer(message));
+        }
+
+        // let the relays settle into their idle state
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        long residentIdle = ResidentKiB();
+        long descriptorsIdle = OpenDescriptors();
+        BufferPool::Stats stats = BufferPool::GlobalStats();
+
+        std::cout << "connections             " << connections << '\n';
+        std::cout << "wait readable           " << (options.waitReadable ? "yes" : "no") << '\n';
+        std::cout << "splice                  " << (options.splice ? "yes" : "no") << '\n';
+        std::cout << "pool in use KiB         " << stats.bytesInUse / 1024 << '\n';
+        std::cout << "pool in use peak KiB    " << stats.bytesInUseHighWater / 1024 << '\n';
+        std::cout << "pool cached KiB         " << stats.cachedBytes / 1024 << '\n';
+        std::cout << "pool cached peak KiB    " << stats.cachedBytesHighWater / 1024 << '\n';
+        std::cout << "pool bytes/connection   " << stats.bytesInUse / connections << '\n';
+
+        if (residentBefore >= 0) {
+            std::cout << "RSS bytes/connection    " << (residentIdle - residentBefore) * 1024 / static_cast<long>(connections) << '\n';
+        }
+        else {
+            std::cout << "RSS                     not measured on this platform\n";
+        }
+
+        // the client, the accepted and the upstream socket and the echo's one are 4 per connection
+        if (descriptorsBefore >= 0) {
+            std::cout << "descriptors/connection  " << static_cast<double>(descriptorsIdle - descriptorsBefore) / connections << '\n';
+        }
+
+        return 0;
+    }
+
+private:
+
+    using tcp = boost::asio::ip::tcp;
+
+    // The file descriptors open in the process, -1 where they cannot be listed.
+    static long OpenDescriptors()
+    {
+        std::error_code ec;
+        std::filesystem::directory_iterator it("/proc/self/fd", ec);
+
+        if (ec) {
+            return -1;
+        }
+
+        long descriptors = 0;
+
+        for (; it != std::filesystem::directory_iterator(); it.increment(ec)) {
+            ++descriptors;
+        }
+
+        return descriptors;
+    }
+
+    // Echoes everything it receives.
+    class Echo {
+    public:
+
+        Echo() :
+            server_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this](const boost::system::error_code& ec, tcp::socket peer) {
+                    if (!ec) {
+                        echo(std::make_shared<tcp::socket>(std::move(peer)), std::make_shared<std::array<char, 64>>());
+                    }
+                }
+            ),
+            thread_([this]() { context_.run(); })
+        {}
+
+        ~Echo()
+        {
+            context_.stop();
+            thread_.join();
+        }
+
+        tcp::endpoint localEndpoint() const { return server_.localEndpoint(); }
+
+    private:
+
+        void echo(std::shared_ptr<tcp::socket> peer, std::shared_ptr<std::array<char, 64>> buff)
+        {
+            peer->async_read_some(boost::asio::buffer(*buff), [this, peer, buff](const boost::system::error_code& ec, std::size_t bytes) {
+                if (ec) {
+                    return;
+                }
+                boost::asio::async_write(*peer, boost::asio::buffer(*buff, bytes), [this, peer, buff](const boost::system::error_code& ec, std::size_t) {
+                    if (!ec) {
+                        echo(peer, buff);
+                    }
+                });
+            });
+        }
+
+        boost::asio::io_context context_;
+        Sari::Net::Server server_;
+        std::thread thread_;
+    };
+
+    // Forwards each accepted connection to the upstream endpoint.
+    class Relay {
+    public:
+
+        Relay(const tcp::endpoint& upstream, const Sari::Stream::Transfer::Options& options) :
+            server_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this, upstream, options](const boost::system::error_code& ec, tcp::socket peer) {
+
+                    if (ec) {
+                        return;
+                    }
+
+                    auto in = std::make_shared<tcp::socket>(std::move(peer));
+                    auto out = std::make_shared<tcp::socket>(context_);
+
+                    out->connect(upstream);
+
+                    Sari::Stream::Transfer::Forward(*in, *out, options)
+                        .then([in, out]() {});
+                }
+            ),
+            thread_([this]() { context_.run(); })
+        {}
+
+        ~Relay()
+        {
+            context_.stop();
+            thread_.join();
+        }
+
+        tcp::endpoint localEndpoint() const { return server_.localEndpoint(); }
+
+    private:
+        boost::asio::io_context context_;
+        Sari::Net::Server server_;
+        std::thread thread_;
+    };
+
+};
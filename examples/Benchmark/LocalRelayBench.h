@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sari/net/server.h"
+#include "sari/stream/transfer.h"
+
+// Compares the throughput of a Transfer::Forward relay between two loopback TCP
+// connections with the same relay between two Unix domain socket connections.
+//
+// Usage: Benchmark local [megabytes]
+class LocalRelayBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        using boost::asio::ip::tcp;
+
+        std::size_t megabytes = argc > 0 ? std::stoul(argv[0]) : 1024;
+
+        tcp::endpoint loopback(boost::asio::ip::address_v4::loopback(), 0);
+
+        std::cout << "transport     MB/s\n";
+        std::cout << "tcp           " << static_cast<long>(Measure(loopback, loopback, megabytes)) << '\n';
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && defined(__linux__)
+        std::string suffix = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+        double throughput = Measure(
+            Sari::Net::AbstractLocalEndpoint("sari-bench-relay-" + suffix),
+            Sari::Net::AbstractLocalEndpoint("sari-bench-upstream-" + suffix),
+            megabytes
+        );
+
+        std::cout << "unix          " << static_cast<long>(throughput) << '\n';
+#else
+        std::cout << "unix          not measured on this platform\n";
+#endif
+
+        return 0;
+    }
+
+private:
+
+    // The client writes through the relay to the upstream which discards everything.
+    template<typename Endpoint>
+    static double Measure(const Endpoint& relayEndpoint, const Endpoint& upstreamEndpoint, std::size_t megabytes)
+    {
+        namespace Net = Sari::Net;
+        namespace Transfer = Sari::Stream::Transfer;
+
+        using Protocol = typename Endpoint::protocol_type;
+        using Socket = typename Protocol::socket;
+
+        const std::size_t total = megabytes * 1024 * 1024;
+
+        boost::asio::io_context upstreamContext;
+        auto upstreamAcceptor = Net::Listen(upstreamContext, upstreamEndpoint);
+        Endpoint upstreamAddress = upstreamAcceptor.local_endpoint();
+
+        std::thread upstream([&upstreamAcceptor]() {
+            Socket peer = upstreamAcceptor.accept();
+            std::vector<char> buff(256 * 1024);
+            boost::system::error_code ec;
+            while (!ec) {
+                peer.read_some(boost::asio::buffer(buff), ec);
+            }
+        });
+
+        boost::asio::io_context relayContext;
+
+        Net::BasicServer<Protocol> relay(
+            Net::Listen(relayContext, relayEndpoint),
+            [&relayContext, upstreamAddress](const boost::system::error_code& ec, Socket peer) {
+
+                if (ec) {
+                    return;
+                }
+
+                auto in = std::make_shared<Socket>(std::move(peer));
+                auto out = std::make_shared<Socket>(relayContext);
+
+                out->connect(upstreamAddress);
+
+                Transfer::Forward(*in, *out)
+                    .then([in, out]() {});
+            }
+        );
+
+        Endpoint relayAddress = relay.localEndpoint();
+
+        std::thread relayThread([&relayContext]() {
+            relayContext.run();
+        });
+
+        boost::asio::io_context clientContext;
+        Socket client(clientContext);
+        client.connect(relayAddress);
+
+        std::vector<char> buff(64 * 1024);
+        std::size_t sent = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        while (sent < total) {
+            sent += boost::asio::write(client, boost::asio::buffer(buff));
+        }
+
+        client.shutdown(Socket::shutdown_send);
+        upstream.join();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        relayContext.stop();
+        relayThread.join();
+
+        return megabytes / elapsed.count();
+    }
+
+};
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <string>
+#include "AcceptBench.h"
+#include "AdaptiveBench.h"
+#include "AuthBench.h"
+#include "CodecBench.h"
+#include "CoalesceBench.h"
+#include "HandshakeParseBench.h"
+#include "IdleBench.h"
+#include "LocalRelayBench.h"
+#include "MetricsBench.h"
+#include "PipeBench.h"
+#include "PolicyBench.h"
+#include "RelayBench.h"
+#include "ShapingBench.h"
+#include "Socks5Bench.h"
+#include "SocketBench.h"
+#include "UdpBench.h"
+
+int main(int argc, char* argv[])
+{
+    std::string name = argc > 1 ? argv[1] : "";
+
+    try {
+
+        if (name == "accept") {
+            return AcceptBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "sockopt") {
+            return SocketBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "local") {
+            return LocalRelayBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "relay") {
+            return RelayBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "adaptive") {
+            return AdaptiveBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "idle") {
+            return IdleBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "shaping") {
+            return ShapingBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "coalesce") {
+            return CoalesceBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "pipe") {
+            return PipeBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "handshake") {
+            return HandshakeParseBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "codec") {
+            return CodecBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "auth") {
+            return AuthBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "policy") {
+            return PolicyBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "socks5") {
+            return Socks5Bench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "metrics") {
+            return MetricsBench::Run(argc - 2, argv + 2);
+        }
+        else if (name == "udp") {
+            return UdpBench::Run(argc - 2, argv + 2);
+        }
+
+        std::cerr
+            << "usage: Benchmark accept [max threads] [seconds] [client threads]\n"
+            << "       Benchmark sockopt [round trips] [megabytes]\n"
+            << "       Benchmark local [megabytes]\n"
+            << "       Benchmark relay [megabytes] [round trips] [message size] [buffers] [buffer size]\n"
+            << "       Benchmark adaptive [max buffer size] [bulk flows] [interactive flows] [megabytes per bulk flow]\n"
+            << "       Benchmark idle [connections] [wait readable] [splice]\n"
+            << "       Benchmark shaping [connections] [connection KiB/s] [user KiB/s] [global KiB/s] [seconds]\n"
+            << "       Benchmark coalesce [messages] [message size] [write microseconds] [coalesced buffers]\n"
+            << "       Benchmark pipe [megabytes] [message size]\n"
+            << "       Benchmark handshake [handshakes]\n"
+            << "       Benchmark socks5 [handshakes] [concurrent clients] [payload size] [ip | domain] [steps | via | pipelined]\n"
+            << "       Benchmark codec [parses] [fuzzed inputs]\n"
+            << "       Benchmark udp [datagrams] [datagram size] [batch size]\n"
+            << "       Benchmark auth [users] [authentications]\n"
+            << "       Benchmark policy [networks] [domains] [lookups]\n"
+            << "       Benchmark metrics [destinations] [connections] [capacity] [top]\n";
+    }
+    catch (std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+    }
+
+    return 1;
+}
@@ -0,0 +1,30 @@
+// The replacements of the global operator new and delete, which count the allocations of the
+// threads which have asked for it, see Memory.h. The array forms keep their defaults, which
+// call these.
+
+#include <cstdlib>
+#include <new>
+#include "Memory.h"
+
+void* operator new(std::size_t size)
+{
+    if (CountAllocations) {
+        Allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (void* p = std::malloc(size > 0 ? size : 1)) {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <string>
+
+// The resident set size of the process in KiB or -1 when it is not available.
+inline long ResidentKiB()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            return std::stol(line.substr(6));
+        }
+    }
+
+    return -1;
+}
+
+// The number of allocations made by the threads which count them, counted by the global
+// operator new of the program in Memory.cpp.
+inline std::atomic<std::size_t> Allocations{ 0 };
+
+// Whether the allocations of the current thread are counted.
+inline thread_local bool CountAllocations = false;
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sari/socks5/cmd_req.h"
+#include "sari/socks5/metrics.h"
+
+// Measures the recording of connections in the destination metrics and how well their top
+// destinations match the exact counts. The destinations, domain names and IPv4 and IPv6
+// addresses, are drawn from a Zipf distribution, so a few of them take most connections.
+//
+// Usage: Benchmark metrics [destinations] [connections] [capacity] [top]
+class MetricsBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        namespace Socks5 = Sari::Socks5;
+
+        std::size_t numOfDestinations = argc > 0 ? std::stoul(argv[0]) : 100000;
+        std::size_t connections = argc > 1 ? std::stoul(argv[1]) : 2000000;
+        std::size_t capacity = argc > 2 ? std::stoul(argv[2]) : 1024;
+        std::size_t k = argc > 3 ? std::stoul(argv[3]) : 20;
+
+        // a /24 or a /48 network of its own for each address
+        std::vector<Socks5::CommandRequest> destinations;
+        std::vector<double> weights;
+
+        for (std::size_t i = 0; i < numOfDestinations; ++i) {
+
+            if (i % 3 == 0) {
+                destinations.emplace_back(Socks5::Command::Connect, "host" + std::to_string(i) + ".example.com", 443);
+            }
+            else if (i % 3 == 1) {
+                auto ip = static_cast<unsigned int>(0x0a000000 + (i << 8) + 1);
+                destinations.emplace_back(Socks5::Command::Connect, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4(ip), 443));
+            }
+            else {
+                boost::asio::ip::address_v6::bytes_type bytes{ 0x20, 0x01, 0x0d, 0xb8 };
+                bytes[4] = static_cast<unsigned char>(i >> 8);
+                bytes[5] = static_cast<unsigned char>(i);
+                bytes[15] = 1;
+                destinations.emplace_back(Socks5::Command::Connect, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v6(bytes), 443));
+            }
+
+            weights.push_back(1.0 / (i + 1));
+        }
+
+        std::mt19937 random(1);
+        std::discrete_distribution<std::size_t> zipf(weights.begin(), weights.end());
+        std::vector<std::size_t> picks(connections);
+
+        for (auto& pick : picks) {
+            pick = zipf(random);
+        }
+
+        Socks5::DestinationMetrics metrics(capacity);
+        Socks5::DestinationMetrics::Connection connection;
+        connection.connectTime = std::chrono::milliseconds(1);
+        connection.bytesSent = 1000;
+        connection.bytesReceived = 10000;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t pick : picks) {
+            metrics.record(destinations[pick].getRaw().dest, connection);
+        }
+
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / connections;
+
+        // the exact top destinations are the first ones, as their weights are
+        std::vector<std::size_t> exact(numOfDestinations);
+
+        for (std::size_t pick : picks) {
+            ++exact[pick];
+        }
+
+        auto top = metrics.top(k);
+        std::size_t hits = 0;
+        double maxRelativeError = 0;
+
+        std::unordered_map<std::string, std::size_t> topExact;
+
+        std::vector<std::size_t> order(numOfDestinations);
+        for (std::size_t i = 0; i < numOfDestinations; ++i) {
+            order[i] = i;
+        }
+        std::partial_sort(order.begin(), order.begin() + std::min(k, order.size()), order.end(), [&exact](std::size_t a, std::size_t b) {
+            return exact[a] > exact[b];
+        });
+        for (std::size_t i = 0; i < std::min(k, order.size()); ++i) {
+            topExact.emplace(Name(destinations[order[i]]), exact[order[i]]);
+        }
+
+        for (const auto& entry : top) {
+            auto it = topExact.find(entry.destination);
+            if (it != topExact.end()) {
+                ++hits;
+                maxRelativeError = std::max(maxRelativeError, static_cast<double>(entry.connections - it->second) / it->second);
+            }
+        }
+
+        std::cout << "recorded " << connections << " connections to " << numOfDestinations
+            << " destinations in " << capacity << " slots, " << std::setprecision(3) << ns << " ns/connection\n"
+            << "top " << k << " found " << hits << ", largest overestimate " << maxRelativeError * 100 << "%\n";
+
+        return 0;
+    }
+
+private:
+
+    // The destination as the metrics show it.
+    static std::string Name(Sari::Socks5::CommandRequest& cmdReq)
+    {
+        auto addr = cmdReq.dest();
+
+        if (addr.getAddrType() == Sari::Socks5::AddressType::DomainName) {
+            return addr.getDomainName();
+        }
+
+        auto address = addr.getEndpoint().address();
+
+        if (address.is_v4()) {
+            auto bytes = address.to_v4().to_bytes();
+            return std::to_string(bytes[0]) + "." + std::to_string(bytes[1]) + "." + std::to_string(bytes[2]) + ".0/24";
+        }
+
+        auto bytes = address.to_v6().to_bytes();
+        std::fill(bytes.begin() + 6, bytes.end(), 0);
+
+        return boost::asio::ip::address_v6(bytes).to_string() + "/48";
+    }
+
+};
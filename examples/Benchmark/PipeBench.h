@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/version.hpp>
+#include <boost/asio.hpp>
+
+#if BOOST_VERSION < 108000 && defined(BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#include "sari/stream/twowaystream.h"
+#include "sari/stream/memory_pipe.h"
+#include "sari/stream/transfer.h"
+
+// Compares Stream::MemoryPipe with kernel pipes as the ends of the TwoWayStream pairs the
+// Proxy example couples its clients with. A client writes messages to its end, they are
+// relayed by Transfer::Forward to the end of the other pair and read from there. Kernel pipes
+// are opened as readable_pipe and writable_pipe, or as posix::stream_descriptor before
+// Boost 1.80.
+//
+// Usage: Benchmark pipe [megabytes] [message size]
+class PipeBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        std::size_t megabytes = argc > 0 ? std::stoul(argv[0]) : 256;
+        std::size_t messageSize = argc > 1 ? std::stoul(argv[1]) : 4096;
+
+        std::cout << "messages      " << messageSize << " bytes, " << megabytes << " MB\n";
+        std::cout << "pipe          MB/s        msgs/s\n";
+
+        Measure<Sari::Stream::MemoryPipe>("memory", megabytes, messageSize, [](auto& readEnd, auto& writeEnd) {
+            Sari::Stream::ConnectPipe(readEnd, writeEnd);
+        });
+
+#if BOOST_VERSION >= 108000
+        Measure<boost::asio::readable_pipe, boost::asio::writable_pipe>("kernel", megabytes, messageSize, [](auto& readEnd, auto& writeEnd) {
+            boost::asio::connect_pipe(readEnd, writeEnd);
+        });
+#elif defined(BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+        Measure<boost::asio::posix::stream_descriptor>("kernel", megabytes, messageSize, [](auto& readEnd, auto& writeEnd) {
+            int fds[2];
+            if (::pipe(fds) != 0) {
+                throw boost::system::system_error(errno, boost::system::system_category(), "pipe");
+            }
+            readEnd.assign(fds[0]);
+            writeEnd.assign(fds[1]);
+        });
+#else
+        std::cout << "kernel        not measured on this platform\n";
+#endif
+
+        return 0;
+    }
+
+private:
+
+    template<typename ReadableEnd, typename WritableEnd = ReadableEnd, typename Connect>
+    static void Measure(const std::string& name, std::size_t megabytes, std::size_t messageSize, Connect connect)
+    {
+        using TwoWayPipe = Sari::Stream::TwoWayStream<ReadableEnd, WritableEnd>;
+
+        const std::size_t total = megabytes * 1024 * 1024;
+
+        boost::asio::io_context ioContext;
+
+        // the client pipe is forwarded to the server pipe, like the clients of the proxy
+        TwoWayPipe clientSide(ioContext), relaySource(ioContext);
+        TwoWayPipe relaySink(ioContext), serverSide(ioContext);
+
+        connect(relaySource.writable_end(), clientSide.readable_end());
+        connect(clientSide.writable_end(), relaySource.readable_end());
+        connect(serverSide.writable_end(), relaySink.readable_end());
+        connect(relaySink.writable_end(), serverSide.readable_end());
+
+        Sari::Stream::Transfer::Forward(relaySource, relaySink)
+            .then([]() {});
+
+        std::vector<char> message(messageSize, 'x');
+        std::vector<char> buff(64 * 1024);
+        std::size_t sent = 0;
+        std::size_t received = 0;
+
+        std::function<void()> write = [&]() {
+            if (sent >= total) {
+                clientSide.close();
+                return;
+            }
+
+            boost::asio::async_write(clientSide, boost::asio::buffer(message),
+                [&](const boost::system::error_code& ec, std::size_t bytes) {
+                    sent += bytes;
+                    if (!ec) {
+                        write();
+                    }
+                });
+        };
+
+        std::function<void()> read = [&]() {
+            serverSide.async_read_some(boost::asio::buffer(buff),
+                [&](const boost::system::error_code& ec, std::size_t bytes) {
+                    received += bytes;
+                    if (!ec && received < total) {
+                        read();
+                    }
+                    else {
+                        serverSide.close();
+                    }
+                });
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        write();
+        read();
+        ioContext.run();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::left << std::setw(14) << name
+            << std::setw(12) << static_cast<long>(received / (1024.0 * 1024.0) / seconds)
+            << static_cast<long long>(received / messageSize / seconds) << '\n';
+    }
+
+};
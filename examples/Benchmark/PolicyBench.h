@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "sari/socks5/access_policy.h"
+#include "sari/socks5/cmd_req.h"
+
+// Measures the compilation of access rules and the evaluation of request destinations against
+// them: random IPv4 and IPv6 networks and domain names, half of the lookups hitting a rule.
+//
+// Usage: Benchmark policy [networks] [domains] [lookups]
+class PolicyBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        namespace Socks5 = Sari::Socks5;
+        using Action = Socks5::AccessPolicy::Action;
+
+        std::size_t numOfNetworks = argc > 0 ? std::stoul(argv[0]) : 10000;
+        std::size_t numOfDomains = argc > 1 ? std::stoul(argv[1]) : 10000;
+        std::size_t lookups = argc > 2 ? std::stoul(argv[2]) : 2000000;
+
+        std::mt19937 random(1);
+        std::vector<Socks5::AccessPolicy::Rule> rules;
+
+        for (std::size_t i = 0; i < numOfNetworks; ++i) {
+
+            Action action = i / 4 % 2 ? Action::Allow : Action::Deny;
+
+            if (i % 4 == 3) {
+                boost::asio::ip::address_v6::bytes_type bytes{};
+                for (std::size_t j = 0; j < 8; ++j) {
+                    bytes[j] = static_cast<unsigned char>(random());
+                }
+                rules.push_back({ action, boost::asio::ip::address_v6(bytes).to_string() + "/" + std::to_string(16 + random() % 49) });
+            }
+            else {
+                rules.push_back({ action, boost::asio::ip::address_v4(random()).to_string() + "/" + std::to_string(8 + random() % 25) });
+            }
+        }
+
+        std::vector<std::string> domains;
+
+        for (std::size_t i = 0; i < numOfDomains; ++i) {
+            domains.push_back("host" + std::to_string(random() % 1000) + ".domain" + std::to_string(i) + (i % 3 ? ".com" : ".net"));
+            rules.push_back({ i % 2 ? Action::Allow : Action::Deny, domains.back().substr(domains.back().find('.') + 1) });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Socks5::AccessPolicy policy(rules, Action::Allow);
+
+        std::cout << "compiled " << rules.size() << " rules in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+
+        // the destinations of requests, half of them covered by rules
+        std::vector<Socks5::CommandRequest> v4, v6, names;
+
+        for (std::size_t i = 0; i < 1024; ++i) {
+
+            const std::string& network = rules[random() % numOfNetworks].pattern;
+            auto address = boost::asio::ip::make_address(network.substr(0, network.find('/')));
+
+            if (address.is_v4()) {
+                auto ip = i % 2 ? address.to_v4().to_uint() | (random() & 0xff) : random();
+                v4.emplace_back(Socks5::Command::Connect, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4(ip), 80));
+            }
+            else {
+                auto bytes = address.to_v6().to_bytes();
+                bytes[15] = static_cast<unsigned char>(random());
+                if (i % 2) {
+                    bytes[0] ^= 0x80;
+                }
+                v6.emplace_back(Socks5::Command::Connect, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v6(bytes), 80));
+            }
+
+            names.emplace_back(Socks5::Command::Connect, i % 2 ? domains[random() % domains.size()] : "www.example" + std::to_string(i) + ".org", 80);
+        }
+
+        std::cout << "destination   ns/lookup\n";
+
+        Measure("IPv4", policy, v4, lookups);
+        Measure("IPv6", policy, v6, lookups);
+        Measure("domain", policy, names, lookups);
+
+        return 0;
+    }
+
+private:
+
+    static void Measure(const char* name, const Sari::Socks5::AccessPolicy& policy, const std::vector<Sari::Socks5::CommandRequest>& requests, std::size_t lookups)
+    {
+        std::size_t denied = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < lookups; ++i) {
+            denied += policy.check(requests[i % requests.size()].getRaw().dest) == Sari::Socks5::Reply::ConnectionNoAllowed;
+        }
+
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+
+        std::cout << std::left << std::setw(14) << name << std::setprecision(3) << ns
+            << "  (" << denied * 100 / lookups << "% denied)\n";
+    }
+
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sari/asio/config.h"
+#include "sari/asio/registered_buffers.h"
+#include "sari/net/server.h"
+#include "sari/stream/transfer.h"
+
+// Measures a Transfer::Forward relay between loopback TCP connections: the bulk throughput,
+// the CPU time the whole process spends per relayed gigabyte, the read and write calls the
+// relay makes per relayed megabyte, each one a system call, and the round trip times of
+// small messages echoed back through the relay. Build it once as is and once with
+// SARI_USE_IO_URING defined to compare the epoll and the io_uring backends. A single buffer
+// serializes reads and writes of the relay, more buffers let them overlap. Where splice(2)
+// is available the buffered relay is compared with the splice relay, and with io_uring and
+// Boost 1.79 or newer (SARI_HAS_REGISTERED_BUFFERS) with a relay reading into registered buffers.
+//
+// Usage: Benchmark relay [megabytes] [round trips] [message size] [buffers] [buffer size]
+class RelayBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        std::size_t megabytes = argc > 0 ? std::stoul(argv[0]) : 1024;
+        std::size_t roundTrips = argc > 1 ? std::stoul(argv[1]) : 10000;
+        std::size_t messageSize = argc > 2 ? std::stoul(argv[2]) : 64;
+
+        Sari::Stream::Transfer::Options options;
+        options.numOfBuffers = argc > 3 ? std::stoul(argv[3]) : options.numOfBuffers;
+        options.bufferSize = argc > 4 ? std::stoul(argv[4]) : options.bufferSize;
+
+        std::cout << "backend       " << Sari::Asio::IoBackend << '\n';
+        std::cout << "buffers       " << options.numOfBuffers << " x " << options.bufferSize << " .. " << options.maxBufferSize << '\n';
+        std::cout << "mode          MB/s    CPU s/GB    calls/MB    RTT p50 us    RTT p99 us\n";
+
+        options.splice = false;
+        Measure("buffered", megabytes, roundTrips, messageSize, options);
+
+#if defined(SARI_HAS_SPLICE)
+        options.splice = true;
+        Measure("splice", megabytes, roundTrips, messageSize, options);
+#endif
+
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+        options.splice = false;
+        options.waitReadable = false;
+        Measure("registered", megabytes, roundTrips, messageSize, options, true);
+#endif
+
+        return 0;
+    }
+
+private:
+
+    using tcp = boost::asio::ip::tcp;
+
+    struct Bulk {
+        double throughput;
+        double cpuPerGigabyte;
+        double callsPerMegabyte;
+    };
+
+    static void Measure(
+        const std::string& mode,
+        std::size_t megabytes, std::size_t roundTrips, std::size_t messageSize,
+        const Sari::Stream::Transfer::Options& options, bool registered = false
+    )
+    {
+        Bulk bulk = MeasureBulk(megabytes, options, registered);
+        std::vector<double> rtts = MeasureRoundTrips(roundTrips, messageSize, options, registered);
+
+        std::cout
+            << std::left
+            << std::setw(14) << mode
+            << std::setw(8) << static_cast<long>(bulk.throughput)
+            << std::setw(12) << std::setprecision(3) << bulk.cpuPerGigabyte
+            << std::setw(12) << std::setprecision(3) << bulk.callsPerMegabyte
+            << std::setw(14) << std::setprecision(3) << Percentile(rtts, 0.50)
+            << std::setprecision(3) << Percentile(rtts, 0.99) << '\n';
+    }
+
+    // A relay running on its own thread which forwards each accepted connection
+    // to the upstream endpoint. Registered, its transfers use buffers registered with its io_context.
+    class Relay {
+    public:
+
+        Relay(const tcp::endpoint& upstream, const Sari::Stream::Transfer::Options& options, bool registered) :
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+            registeredBuffers_(context_, RegisteredBlocks, RegisteredBlockSize),
+#endif
+            server_(
+                Sari::Net::Listen(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+                [this, upstream, options, registered](const boost::system::error_code& ec, tcp::socket peer) {
+
+                    if (ec) {
+                        return;
+                    }
+
+                    auto in = std::make_shared<tcp::socket>(std::move(peer));
+                    auto out = std::make_shared<tcp::socket>(context_);
+
+                    out->connect(upstream);
+                    in->set_option(tcp::no_delay(true));
+                    out->set_option(tcp::no_delay(true));
+
+                    Sari::Stream::Transfer::Options counted = options;
+                    counted.registry = &registry_;
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+                    if (registered) {
+                        counted.registeredBuffers = &registeredBuffers_;
+                    }
+#endif
+
+                    Sari::Stream::Transfer::Forward(*in, *out, counted)
+                        .then([in, out]() {});
+                }
+            ),
+            thread_([this]() { context_.run(); })
+        {
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+            if (registered && !registeredBuffers_.registered()) {
+                std::cerr << "registering the buffers failed (RLIMIT_MEMLOCK?), the relay uses its ordinary buffers\n";
+            }
+#else
+            (void)registered;
+#endif
+        }
+
+        ~Relay()
+        {
+            context_.stop();
+            thread_.join();
+        }
+
+        tcp::endpoint localEndpoint() const
+        {
+            return server_.localEndpoint();
+        }
+
+        // The read and write calls of the transfers, the running and the finished ones.
+        std::uint64_t calls() const
+        {
+            std::uint64_t calls = 0;
+
+            for (const auto& stats : registry_.running()) {
+                for (const auto& direction : stats.directions) {
+                    calls += direction.reads + direction.writes;
+                }
+            }
+            for (const auto& direction : registry_.finishedTotals()) {
+                calls += direction.reads + direction.writes;
+            }
+
+            return calls;
+        }
+
+    private:
+
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+        static constexpr std::size_t RegisteredBlocks = 32;
+        static constexpr std::size_t RegisteredBlockSize = 64 * 1024;
+#endif
+
+        Sari::Stream::Transfer::Registry registry_;
+        boost::asio::io_context context_;
+#if defined(SARI_HAS_REGISTERED_BUFFERS)
+        // destroyed after the io_context has stopped and before the io_context
+        Sari::Asio::RegisteredBuffers registeredBuffers_;
+#endif
+        Sari::Net::Server server_;
+        std::thread thread_;
+    };
+
+    // The client writes through the relay to the upstream which discards everything.
+    static Bulk MeasureBulk(std::size_t megabytes, const Sari::Stream::Transfer::Options& options, bool registered)
+    {
+        const std::size_t total = megabytes * 1024 * 1024;
+
+        boost::asio::io_context context;
+        auto upstreamAcceptor = Sari::Net::Listen(context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+
+        std::thread upstream([&upstreamAcceptor]() {
+            tcp::socket peer = upstreamAcceptor.accept();
+            std::vector<char> buff(256 * 1024);
+            boost::system::error_code ec;
+            while (!ec) {
+                peer.read_some(boost::asio::buffer(buff), ec);
+            }
+        });
+
+        Relay relay(upstreamAcceptor.local_endpoint(), options, registered);
+
+        tcp::socket client(context);
+        client.connect(relay.localEndpoint());
+
+        std::vector<char> buff(64 * 1024);
+        std::size_t sent = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        std::clock_t cpuStart = std::clock();
+
+        while (sent < total) {
+            sent += boost::asio::write(client, boost::asio::buffer(buff));
+        }
+
+        client.shutdown(tcp::socket::shutdown_send);
+        upstream.join();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+        return { megabytes / elapsed.count(), cpu / (megabytes / 1024.0), static_cast<double>(relay.calls()) / megabytes };
+    }
+
+    // The client sends small messages through the relay to the upstream which echoes them back.
+    static std::vector<double> MeasureRoundTrips(
+        std::size_t roundTrips, std::size_t messageSize, const Sari::Stream::Transfer::Options& options, bool registered
+    )
+    {
+        boost::asio::io_context context;
+        auto upstreamAcceptor = Sari::Net::Listen(context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+
+        std::thread upstream([&upstreamAcceptor, messageSize]() {
+            tcp::socket peer = upstreamAcceptor.accept();
+            peer.set_option(tcp::no_delay(true));
+            std::vector<char> buff(messageSize);
+            boost::system::error_code ec;
+            while (!ec) {
+                boost::asio::read(peer, boost::asio::buffer(buff), ec);
+                if (!ec) {
+                    boost::asio::write(peer, boost::asio::buffer(buff), ec);
+                }
+            }
+        });
+
+        Relay relay(upstreamAcceptor.local_endpoint(), options, registered);
+
+        tcp::socket client(context);
+        client.connect(relay.localEndpoint());
+        client.set_option(tcp::no_delay(true));
+
+        std::vector<char> buff(messageSize, 'x');
+        std::vector<double> rtts;
+        rtts.reserve(roundTrips);
+
+        for (std::size_t i = 0; i < roundTrips; ++i) {
+
+            auto start = std::chrono::steady_clock::now();
+
+            boost::asio::write(client, boost::asio::buffer(buff));
+            boost::asio::read(client, boost::asio::buffer(buff));
+
+            std::chrono::duration<double, std::micro> rtt = std::chrono::steady_clock::now() - start;
+            rtts.push_back(rtt.count());
+        }
+
+        client.shutdown(tcp::socket::shutdown_send);
+        upstream.join();
+
+        return rtts;
+    }
+
+    static double Percentile(std::vector<double> values, double fraction)
+    {
+        if (values.empty()) {
+            return 0;
+        }
+
+        std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(fraction * values.size()));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+
+        return values[index];
+    }
+
+};
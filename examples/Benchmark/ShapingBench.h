@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sari/net/server.h"
+#include "sari/stream/token_bucket.h"
+#include "sari/stream/transfer.h"
+#include "sari/utils/timer_wheel.h"
+
+// Sends data as fast as possible over many connections through Transfer::Forward relays
+// shaped by token buckets: one per connection within one per user within a global one.
+// The connections are spread over two users. Reports the rates achieved by every level and
+// the number of relays waiting on the shared timer wheel at the end.
+//
+// Usage: Benchmark shaping [connections] [connection KiB/s] [user KiB/s] [global KiB/s] [seconds]
+class ShapingBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        using Sari::Stream::Transfer::TokenBucket;
+
+        std::size_t connections = argc > 0 ? std::stoul(argv[0]) : 100;
+        double connectionRate = (argc > 1 ? std::stod(argv[1]) : 200) * 1024;
+        double userRate = (argc > 2 ? std::stod(argv[2]) : 5000) * 1024;
+        double globalRate = (argc > 3 ? std::stod(argv[3]) : 8000) * 1024;
+        int seconds = argc > 4 ? std::stoi(argv[4]) : 5;
+
+        Sink sink;
+        Relay relay(sink.localEndpoint(), globalRate, userRate, connectionRate);
+
+        boost::asio::io_context clientContext;
+        std::vector<std::shared_ptr<Client>> clients;
+
+        for (std::size_t i = 0; i < connections; ++i) {
+            clients.push_back(std::make_shared<Client>(clientContext, relay.localEndpoint()));
+            clients.back()->send();
+        }
+
+        std::thread clientThread([&clientContext]() { clientContext.run(); });
+
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+        Relay::Rates rates = relay.rates();
+
+        clientContext.stop();
+        clientThread.join();
+
+        std::cout << "connections             " << connections << '\n';
+        std::cout << "limits KiB/s            " << connectionRate / 1024 << " / " << userRate / 1024 << " / " << globalRate / 1024 << '\n';
+        std::cout << "global KiB/s            " << rates.global / 1024 << '\n';
+
+        for (std::size_t i = 0; i < rates.users.size(); ++i) {
+            std::cout << "user " << i << " KiB/s            " << rates.users[i] / 1024 << '\n';
+        }
+
+        if (!rates.connections.empty()) {
+
+            double sum = 0;
+            for (double rate : rates.connections) {
+                sum += rate;
+            }
+
+            auto bounds = std::minmax_element(rates.connections.begin(), rates.connections.end());
+
+            std::cout << "connection KiB/s        min " << *bounds.first / 1024
+                << " avg " << sum / rates.connections.size() / 1024
+                << " max " << *bounds.second / 1024 << '\n';
+        }
+
+        std::cout << "waiting on timer wheel  " << rates.waiting << '\n';
+
+        return 0;
+    }
+
+private:
+
+    using tcp = boost::asio::ip::tcp;
+    using TokenBucket = Sari::Stream::Transfer::TokenBucket;
+
+    // Writes continuously to the relay.
+    class Client : public std::enable_shared_from_this<Client> {
+    public:
+
+        Client(boost::asio::io_context& ioContext, const tcp::endpoint& relay) :
+            socket_(ioContext)
+        {
+            socket_.connect(relay);
+        }
+
+        void send()
+        {
+            socket_.async_write_some(boost::asio::buffer(data_), [client = shared_from_this()](const boost::system::error_code& ec, std::size_t) {
+                if (!ec) {
+                    client->send();
+                }
+            });
+        }
+
+    private:
+        tcp::socket socket_;
+        std::array<char, 65536> data_ = {};
+    };
+
+    // Discards everything it receives.
+    class Sink {
+    public:
+
+        Sink() :
+            server_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this](const boost::system::error_code& ec, tcp::socket peer) {
+                    if (!ec) {
+                        drain(std::make_shared<tcp::socket>(std::move(peer)));
+                    }
+                }
+            ),
+            thread_([this]() { context_.run(); })
+        {}
+
+        ~Sink()
+        {
+            context_.stop();
+            thread_.join();
+        }
+
+        tcp::endpoint localEndpoint() const { return server_.localEndpoint(); }
+
+    private:
+
+        void drain(std::shared_ptr<tcp::socket> peer)
+        {
+            peer->async_read_some(boost::asio::buffer(buffer_), [this, peer](const boost::system::error_code& ec, std::size_t) {
+                if (!ec) {
+                    drain(peer);
+                }
+            });
+        }
+
+        boost::asio::io_context context_;
+        Sari::Net::Server server_;
+        std::array<char, 65536> buffer_;
+        std::thread thread_;
+    };
+
+    // Forwards each accepted connection to the upstream endpoint, shaping the data sent
+    // upstream with a bucket per connection within the bucket of its user.
+    class Relay {
+    public:
+
+        struct Rates {
+            double global;
+            std::vector<double> users;
+            std::vector<double> connections;
+            std::size_t waiting;
+        };
+
+        Relay(const tcp::endpoint& upstream, double globalRate, double userRate, double connectionRate) :
+            timerWheel_(context_),
+            global_(std::make_shared<TokenBucket>(globalRate, Burst(globalRate))),
+            users_{
+                std::make_shared<TokenBucket>(userRate, Burst(userRate), global_),
+                std::make_shared<TokenBucket>(userRate, Burst(userRate), global_)
+            },
+            server_(context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+                [this, upstream, connectionRate](const boost::system::error_code& ec, tcp::socket peer) {
+
+                    if (ec) {
+                        return;
+                    }
+
+                    auto in = std::make_shared<tcp::socket>(std::move(peer));
+                    auto out = std::make_shared<tcp::socket>(context_);
+
+                    out->connect(upstream);
+
+                    auto& user = users_[connections_.size() % users_.size()];
+                    connections_.push_back(std::make_shared<TokenBucket>(connectionRate, Burst(connectionRate), user));
+
+                    Sari::Stream::Transfer::Options options;
+                    options.buckets[0] = connections_.back();
+                    options.timerWheel = &timerWheel_;
+
+                    Sari::Stream::Transfer::Forward(*in, *out, options)
+                        .then([in, out]() {});
+                }
+            ),
+            thread_([this]() { context_.run(); })
+        {}
+
+        ~Relay()
+        {
+            context_.stop();
+            thread_.join();
+        }
+
+        tcp::endpoint localEndpoint() const { return server_.localEndpoint(); }
+
+        // The rates achieved so far, taken on the thread of the relay.
+        Rates rates()
+        {
+            std::promise<Rates> result;
+
+            boost::asio::post(context_, [this, &result]() {
+
+                Rates rates;
+                auto now = TokenBucket::Clock::now();
+
+                rates.global = global_->achievedRate(now);
+
+                for (auto& user : users_) {
+                    rates.users.push_back(user->achievedRate(now));
+                }
+
+                for (auto& connection : connections_) {
+                    rates.connections.push_back(connection->achievedRate(now));
+                }
+
+                rates.waiting = timerWheel_.size();
+
+                result.set_value(rates);
+            });
+
+            return result.get_future().get();
+        }
+
+    private:
+
+        // Lets a tenth of a second worth of data through at once.
+        static double Burst(double rate)
+        {
+            return std::max(rate / 10, 16384.0);
+        }
+
+        boost::asio::io_context context_;
+        Sari::Utils::TimerWheel timerWheel_;
+        std::shared_ptr<TokenBucket> global_;
+        std::array<std::shared_ptr<TokenBucket>, 2> users_;
+        std::vector<std::shared_ptr<TokenBucket>> connections_;
+        Sari::Net::Server server_;
+        std::thread thread_;
+    };
+
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sari/net/server.h"
+
+// Shows the effect of Net::SocketProfile on a loopback connection: the round trip latency
+// of small requests written in two segments (which Nagle's algorithm delays) and the bulk
+// throughput of one-way transfers.
+//
+// Usage: Benchmark sockopt [round trips] [megabytes]
+class SocketBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        namespace Net = Sari::Net;
+
+        std::size_t roundTrips = argc > 0 ? std::stoul(argv[0]) : 200;
+        std::size_t megabytes = argc > 1 ? std::stoul(argv[1]) : 512;
+
+        std::vector<std::pair<std::string, Net::SocketProfile>> profiles = {
+            { "default", Net::SocketProfile{} },
+            { "interactive", Net::SocketProfile::Interactive() },
+            { "bulk", Net::SocketProfile::Bulk() }
+        };
+
+        std::cout << "profile       rtt avg us   rtt p99 us   MB/s\n";
+
+        for (auto& [name, profile] : profiles) {
+
+            std::vector<double> rtts = MeasureLatency(profile, roundTrips);
+            double throughput = MeasureThroughput(profile, megabytes);
+
+            std::sort(rtts.begin(), rtts.end());
+
+            double sum = 0;
+
+            for (double rtt : rtts) {
+                sum += rtt;
+            }
+
+            std::cout
+                << name << std::string(14 - name.size(), ' ')
+                << static_cast<long>(sum / rtts.size()) << "\t\t"
+                << static_cast<long>(rtts[rtts.size() * 99 / 100]) << "\t\t"
+                << static_cast<long>(throughput) << '\n';
+        }
+
+        return 0;
+    }
+
+private:
+
+    using tcp = boost::asio::ip::tcp;
+
+    struct Connection {
+
+        boost::asio::io_context ioContext;
+        tcp::socket client{ioContext};
+        tcp::socket server{ioContext};
+
+        Connection(const Sari::Net::SocketProfile& profile)
+        {
+            tcp::acceptor acceptor = Sari::Net::Listen(
+                ioContext, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), profile
+            );
+
+            client.open(tcp::v4());
+            profile.applyBeforeConnect(client);
+            client.connect(acceptor.local_endpoint());
+            profile.applyAfterConnect(client);
+
+            acceptor.accept(server);
+            profile.applyToAccepted(server);
+        }
+
+    };
+
+    static std::vector<double> MeasureLatency(const Sari::Net::SocketProfile& profile, std::size_t roundTrips)
+    {
+        Connection conn(profile);
+        std::vector<double> rtts;
+
+        // Echoes every request back as a header and a body.
+        std::thread echo([&conn, roundTrips]() {
+            char buff[64];
+            for (std::size_t i = 0; i < roundTrips; i++) {
+                boost::asio::read(conn.server, boost::asio::buffer(buff, 20));
+                boost::asio::write(conn.server, boost::asio::buffer(buff, 10));
+                boost::asio::write(conn.server, boost::asio::buffer(buff + 10, 10));
+            }
+        });
+
+        char buff[64] = { 0 };
+
+        for (std::size_t i = 0; i < roundTrips; i++) {
+
+            auto start = std::chrono::steady_clock::now();
+
+            boost::asio::write(conn.client, boost::asio::buffer(buff, 10));
+            boost::asio::write(conn.client, boost::asio::buffer(buff + 10, 10));
+            boost::asio::read(conn.client, boost::asio::buffer(buff, 20));
+
+            std::chrono::duration<double, std::micro> rtt = std::chrono::steady_clock::now() - start;
+            rtts.push_back(rtt.count());
+        }
+
+        echo.join();
+
+        return rtts;
+    }
+
+    static double MeasureThroughput(const Sari::Net::SocketProfile& profile, std::size_t megabytes)
+    {
+        Connection conn(profile);
+
+        const std::size_t total = megabytes * 1024 * 1024;
+
+        std::thread sink([&conn, total]() {
+            std::vector<char> buff(256 * 1024);
+            std::size_t received = 0;
+            while (received < total) {
+                received += conn.server.read_some(boost::asio::buffer(buff));
+            }
+        });
+
+        std::vector<char> buff(64 * 1024);
+        std::size_t sent = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        while (sent < total) {
+            sent += boost::asio::write(conn.client, boost::asio::buffer(buff));
+        }
+
+        sink.join();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        return megabytes / elapsed.count();
+    }
+
+};
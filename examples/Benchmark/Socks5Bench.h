@@ -0,0 +1,419 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "sari/net/server.h"
+#include "../Socks5Server/Socks5Server.h"
+#include "Memory.h"
+
+// Measures the Socks5Server example under load. The server runs on a thread of its own, the
+// clients and an echo upstream on the main thread. Each client connects, negotiates no
+// authentication, connects to the upstream by its IP address or by the name localhost, sends
+// a small payload, waits for its echo and closes, and the next one takes its place. Reports
+// handshakes per second, the latency of handshakes from connecting to the server to the reply
+// to the CONNECT request, and the allocations and the CPU time of the server thread per
+// handshake.
+//
+// The clients take one round trip per message of the handshake (steps), or send both requests
+// at once with Socks5::AsyncConnectVia (via), or also send the payload along with them
+// (pipelined).
+//
+// Usage: Benchmark socks5 [handshakes] [concurrent clients] [payload size] [ip | domain] [steps | via | pipelined]
+class Socks5Bench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        std::size_t handshakes = argc > 0 ? std::stoul(argv[0]) : 10000;
+        std::size_t concurrency = argc > 1 ? std::stoul(argv[1]) : 64;
+        std::size_t payloadSize = argc > 2 ? std::stoul(argv[2]) : 64;
+        std::string target = argc > 3 ? argv[3] : "";
+        std::string client = argc > 4 ? argv[4] : "";
+
+        std::cout << "target    client     handshakes/s  p50 us    p99 us    p999 us   allocs/handshake  CPU us/handshake\n";
+
+        for (Handshake handshake : { Handshake::Steps, Handshake::Via, Handshake::Pipelined }) {
+
+            if (!client.empty() && client != Name(handshake)) {
+                continue;
+            }
+            if (target.empty() || target == "ip") {
+                Measure(false, handshake, handshakes, concurrency, payloadSize);
+            }
+            if (target.empty() || target == "domain") {
+                Measure(true, handshake, handshakes, concurrency, payloadSize);
+            }
+        }
+
+        return 0;
+    }
+
+private:
+
+    using tcp = boost::asio::ip::tcp;
+
+    enum class Handshake { Steps, Via, Pipelined };
+
+    static const char* Name(Handshake handshake)
+    {
+        switch (handshake) {
+            case Handshake::Via:
+                return "via";
+            case Handshake::Pipelined:
+                return "pipelined";
+            default:
+                return "steps";
+        }
+    }
+
+    struct Totals {
+        std::size_t started = 0;
+        std::size_t completed = 0;
+        std::size_t failed = 0;
+        std::vector<double> latencies;
+    };
+
+    // A client repeating the handshake, the payload and its echo on new connections until all
+    // handshakes have been started.
+    class Client : public std::enable_shared_from_this<Client> {
+    public:
+
+        Client(
+            boost::asio::io_context& ioContext, tcp::endpoint server, Handshake handshake, Sari::Socks5::CommandRequest target,
+            std::vector<unsigned char> commandRequest, std::size_t payloadSize, std::size_t handshakes, Totals& totals
+        ) :
+            ioContext_(ioContext),
+            server_(server),
+            handshake_(handshake),
+            target_(std::move(target)),
+            commandRequest_(std::move(commandRequest)),
+            payload_(payloadSize, 'x'),
+            handshakes_(handshakes),
+            totals_(totals)
+        {}
+
+        void start()
+        {
+            if (totals_.started == handshakes_) {
+                return;
+            }
+
+            ++totals_.started;
+
+            auto self = shared_from_this();
+
+            socket_ = std::make_unique<tcp::socket>(ioContext_);
+            start_ = std::chrono::steady_clock::now();
+
+            socket_->async_connect(server_, [self](const boost::system::error_code& ec) {
+                if (self->failed(ec)) {
+                    return;
+                }
+                self->socket_->set_option(tcp::no_delay(true));
+
+                if (self->handshake_ == Handshake::Steps) {
+                    self->sendMethodRequest();
+                }
+                else {
+                    self->connectVia();
+                }
+            });
+        }
+
+    private:
+
+        // Sends the method request and the CONNECT request with one write, and the payload too
+        // when pipelined.
+        void connectVia()
+        {
+            namespace Socks5 = Sari::Socks5;
+
+            auto self = shared_from_this();
+            auto buffer = std::make_shared<Socks5::RecvBuffer>();
+            bool pipelined = handshake_ == Handshake::Pipelined;
+
+            Socks5::AsyncConnectVia(*socket_, *buffer, target_, pipelined ? std::string(payload_.begin(), payload_.end()) : std::string())
+                .then([self, buffer, pipelined](Socks5::CommandReply cmdReply) {
+
+                    if (self->failed(cmdReply.getReply() != Socks5::Reply::Succeeded ? boost::asio::error::connection_refused : boost::system::error_code())) {
+                        return;
+                    }
+
+                    std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - self->start_;
+                    self->totals_.latencies.push_back(latency.count());
+
+                    if (!pipelined) {
+                        self->echo();
+                        return;
+                    }
+
+                    // the echo may have arrived together with the reply
+                    std::size_t echoed = std::min(buffer->size(), self->payload_.size());
+                    self->receiveEcho(echoed);
+                }).fail([self](const boost::system::error_code& ec) {
+                    self->failed(ec);
+                }).fail([self]() {
+                    self->failed(boost::asio::error::connection_aborted);
+                });
+        }
+
+        void sendMethodRequest()
+        {
+            static const std::array<unsigned char, 3> methodRequest = { 0x05, 0x01, 0x00 };
+
+            auto self = shared_from_this();
+
+            boost::asio::async_write(*socket_, boost::asio::buffer(methodRequest), [self](const boost::system::error_code& ec, std::size_t) {
+                if (self->failed(ec)) {
+                    return;
+                }
+                boost::asio::async_read(*self->socket_, boost::asio::buffer(self->reply_, 2), [self](const boost::system::error_code& ec, std::size_t) {
+                    if (self->failed(ec ? ec : self->refused())) {
+                        return;
+                    }
+                    self->sendCommandRequest();
+                });
+            });
+        }
+
+        void sendCommandRequest()
+        {
+            auto self = shared_from_this();
+
+            boost::asio::async_write(*socket_, boost::asio::buffer(commandRequest_), [self](const boost::system::error_code& ec, std::size_t) {
+                if (self->failed(ec)) {
+                    return;
+                }
+                // the reply up to the first byte of its address tells how long it is
+                boost::asio::async_read(*self->socket_, boost::asio::buffer(self->reply_, 5), [self](const boost::system::error_code& ec, std::size_t) {
+                    if (self->failed(ec ? ec : self->refused())) {
+                        return;
+                    }
+
+                    std::size_t rest = self->reply_[3] == 0x01 ? 5 : self->reply_[3] == 0x04 ? 17 : self->reply_[4] + 2;
+
+                    boost::asio::async_read(*self->socket_, boost::asio::buffer(self->reply_, rest), [self](const boost::system::error_code& ec, std::size_t) {
+                        if (self->failed(ec)) {
+                            return;
+                        }
+
+                        std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - self->start_;
+                        self->totals_.latencies.push_back(latency.count());
+
+                        self->echo();
+                    });
+                });
+            });
+        }
+
+        void echo()
+        {
+            auto self = shared_from_this();
+
+            boost::asio::async_write(*socket_, boost::asio::buffer(payload_), [self](const boost::system::error_code& ec, std::size_t) {
+                if (self->failed(ec)) {
+                    return;
+                }
+                self->receiveEcho(0);
+            });
+        }
+
+        // Reads the rest of the echo of the payload and closes.
+        void receiveEcho(std::size_t echoed)
+        {
+            auto self = shared_from_this();
+
+            boost::asio::async_read(*socket_, boost::asio::buffer(payload_.data() + echoed, payload_.size() - echoed), [self](const boost::system::error_code& ec, std::size_t) {
+                if (self->failed(ec)) {
+                    return;
+                }
+
+                boost::system::error_code ignored;
+                self->socket_->shutdown(tcp::socket::shutdown_both, ignored);
+                self->socket_->close(ignored);
+
+                ++self->totals_.completed;
+                self->start();
+            });
+        }
+
+        // The error of a reply other than succeeded.
+        boost::system::error_code refused() const
+        {
+            return reply_[1] != 0x00 ? boost::asio::error::connection_refused : boost::system::error_code();
+        }
+
+        // Counts a failed handshake and starts the next one.
+        bool failed(const boost::system::error_code& ec)
+        {
+            if (!ec) {
+                return false;
+            }
+
+            ++totals_.failed;
+            start();
+
+            return true;
+        }
+
+        boost::asio::io_context& ioContext_;
+        tcp::endpoint server_;
+        Handshake handshake_;
+        Sari::Socks5::CommandRequest target_;
+        std::vector<unsigned char> commandRequest_;
+        std::vector<char> payload_;
+        std::size_t handshakes_;
+        Totals& totals_;
+        std::unique_ptr<tcp::socket> socket_;
+        std::array<unsigned char, 262> reply_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Echoes the data of every connection back until the peer shuts its side down.
+    static void Echo(std::shared_ptr<tcp::socket> peer, std::shared_ptr<std::array<char, 4096>> buff)
+    {
+        peer->async_read_some(boost::asio::buffer(*buff), [peer, buff](const boost::system::error_code& ec, std::size_t size) {
+            if (ec) {
+                boost::system::error_code ignored;
+                peer->close(ignored);
+                return;
+            }
+            boost::asio::async_write(*peer, boost::asio::buffer(*buff, size), [peer, buff](const boost::system::error_code& ec, std::size_t) {
+                if (!ec) {
+                    Echo(peer, buff);
+                }
+            });
+        });
+    }
+
+    static void Accept(tcp::acceptor& acceptor)
+    {
+        acceptor.async_accept([&acceptor](const boost::system::error_code& ec, tcp::socket peer) {
+            if (ec) {
+                return;
+            }
+            peer.set_option(tcp::no_delay(true));
+            Echo(std::make_shared<tcp::socket>(std::move(peer)), std::make_shared<std::array<char, 4096>>());
+            Accept(acceptor);
+        });
+    }
+
+    // The CPU time of the calling thread in seconds, of the process where it is not available.
+    static double ThreadCpuSeconds()
+    {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+        timespec time;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return time.tv_sec + time.tv_nsec / 1e9;
+#else
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+    }
+
+    static void Measure(bool domain, Handshake handshake, std::size_t handshakes, std::size_t concurrency, std::size_t payloadSize)
+    {
+        boost::asio::io_context clientContext;
+        tcp::acceptor upstream(clientContext, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        unsigned short upstreamPort = upstream.local_endpoint().port();
+
+        Accept(upstream);
+
+        // the server thread counts its allocations and its CPU time while it serves clients
+        boost::asio::io_context serverContext;
+        auto serverWork = boost::asio::make_work_guard(serverContext);
+        Sari::Net::Server server(
+            serverContext, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+            [](const boost::system::error_code& ec, tcp::socket peer) {
+                if (!ec) {
+                    Socks5Server(std::move(peer)).fail([]() {});
+                }
+            }
+        );
+
+        double serverCpu = 0;
+
+        Allocations = 0;
+
+        std::thread serverThread([&serverContext, &serverCpu]() {
+            CountAllocations = true;
+            double start = ThreadCpuSeconds();
+            serverContext.run();
+            serverCpu = ThreadCpuSeconds() - start;
+        });
+
+        // the CONNECT request to the upstream
+        Sari::Socks5::CommandRequest target = domain
+            ? Sari::Socks5::CommandRequest{ Sari::Socks5::Command::Connect, "localhost", upstreamPort }
+            : Sari::Socks5::CommandRequest{ Sari::Socks5::Command::Connect, tcp::endpoint(boost::asio::ip::address_v4::loopback(), upstreamPort) };
+
+        std::vector<unsigned char> commandRequest;
+
+        if (domain) {
+            const std::string name = "localhost";
+            commandRequest = { 0x05, 0x01, 0x00, 0x03, static_cast<unsigned char>(name.size()) };
+            commandRequest.insert(commandRequest.end(), name.begin(), name.end());
+        }
+        else {
+            commandRequest = { 0x05, 0x01, 0x00, 0x01, 127, 0, 0, 1 };
+        }
+
+        commandRequest.push_back(static_cast<unsigned char>(upstreamPort >> 8));
+        commandRequest.push_back(static_cast<unsigned char>(upstreamPort & 0xff));
+
+        Totals totals;
+        totals.latencies.reserve(handshakes);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < concurrency; ++i) {
+            std::make_shared<Client>(clientContext, server.localEndpoint(), handshake, target, commandRequest, payloadSize, handshakes, totals)->start();
+        }
+
+        while (totals.completed + totals.failed < handshakes) {
+            clientContext.run_one();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        serverWork.reset();
+        serverContext.stop();
+        serverThread.join();
+
+        std::size_t completed = std::max<std::size_t>(totals.completed, 1);
+
+        std::cout << std::left << std::fixed << std::setprecision(1)
+            << std::setw(10) << (domain ? "domain" : "ip")
+            << std::setw(11) << Name(handshake)
+            << std::setw(14) << static_cast<long>(totals.completed / seconds)
+            << std::setw(10) << Percentile(totals.latencies, 0.5)
+            << std::setw(10) << Percentile(totals.latencies, 0.99)
+            << std::setw(10) << Percentile(totals.latencies, 0.999)
+            << std::setw(18) << static_cast<double>(Allocations) / completed
+            << serverCpu * 1e6 / completed
+            << (totals.failed ? "  (" + std::to_string(totals.failed) + " failed)" : "") << '\n';
+        std::cout.unsetf(std::ios::fixed);
+    }
+
+    static double Percentile(std::vector<double> values, double fraction)
+    {
+        if (values.empty()) {
+            return 0;
+        }
+
+        std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(fraction * values.size()));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+
+        return values[index];
+    }
+
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "sari/socks5/udp_relay.h"
+
+// Measures the datagrams a Socks5::UdpRelay relays per second on loopback when it receives
+// them one at a time and in batches. A client sends windows of datagrams with UDP headers
+// through the relay to an echo server and waits for the echoes of each window.
+//
+// Usage: Benchmark udp [datagrams] [datagram size] [batch size]
+class UdpBench {
+public:
+
+    static int Run(int argc, char* argv[])
+    {
+        std::size_t datagrams = argc > 0 ? std::stoul(argv[0]) : 200000;
+        std::size_t size = argc > 1 ? std::stoul(argv[1]) : 64;
+        std::size_t batchSize = argc > 2 ? std::stoul(argv[2]) : 32;
+
+#if defined(SARI_HAS_MMSG)
+        std::cout << "recvmmsg/sendmmsg\n";
+#else
+        std::cout << "non-blocking receive loop\n";
+#endif
+        std::cout << "batch   datagrams/s   lost     datagrams/batch\n";
+
+        for (std::size_t batch : { std::size_t(1), batchSize }) {
+            Measure(datagrams, size, batch);
+        }
+
+        return 0;
+    }
+
+private:
+
+    using udp = boost::asio::ip::udp;
+
+    // the datagrams the client sends before it waits for their echoes
+    static constexpr std::size_t Window = 64;
+
+    static void Measure(std::size_t datagrams, std::size_t size, std::size_t batch)
+    {
+        namespace Socks5 = Sari::Socks5;
+
+        boost::asio::io_context ioContext;
+        auto loopback = boost::asio::ip::address_v4::loopback();
+
+        udp::socket echo(ioContext, udp::endpoint(loopback, 0));
+        udp::socket client(ioContext, udp::endpoint(loopback, 0));
+
+        Socks5::UdpRelay::Options options;
+        options.batchSize = batch;
+
+        auto relay = std::make_shared<Socks5::UdpRelay>(
+            ioContext.get_executor(), udp::endpoint(loopback, 0), client.local_endpoint(), options
+        );
+
+        relay->start();
+
+        // the echo server
+        std::array<char, 65536> echoBuffer;
+        udp::endpoint echoPeer;
+
+        std::function<void()> serve = [&]() {
+            echo.async_receive_from(boost::asio::buffer(echoBuffer), echoPeer, [&](const boost::system::error_code& ec, std::size_t bytes) {
+                if (ec) {
+                    return;
+                }
+                boost::system::error_code ignored;
+                echo.send_to(boost::asio::buffer(echoBuffer.data(), bytes), echoPeer, 0, ignored);
+                serve();
+            });
+        };
+
+        // the datagram to the echo server
+        std::vector<unsigned char> datagram(Socks5::UdpHeader::MaxIpSize + size, 'x');
+        unsigned char* begin = Socks5::UdpHeader::Prepend(datagram.data() + Socks5::UdpHeader::MaxIpSize, echo.local_endpoint());
+        auto request = boost::asio::buffer(begin, datagram.data() + datagram.size() - begin);
+
+        std::array<char, 65536> reply;
+        udp::endpoint from;
+        boost::asio::steady_timer timer(ioContext);
+        std::size_t sent = 0;
+        std::size_t received = 0;
+        std::size_t lost = 0;
+        std::size_t pending = 0;
+
+        std::function<void()> sendWindow;
+        std::function<void()> receive = [&]() {
+            client.async_receive_from(boost::asio::buffer(reply), from, [&](const boost::system::error_code& ec, std::size_t) {
+                if (ec) {
+                    return;
+                }
+                ++received;
+                if (--pending == 0) {
+                    timer.cancel();
+                    sendWindow();
+                }
+                receive();
+            });
+        };
+
+        sendWindow = [&]() {
+
+            if (sent == datagrams) {
+                relay->stop();
+                echo.close();
+                client.close();
+                return;
+            }
+
+            std::size_t window = std::min(Window, datagrams - sent);
+
+            for (std::size_t i = 0; i < window; ++i) {
+                client.send_to(request, relay->localEndpoint());
+            }
+
+            sent += window;
+            pending = window;
+
+            // the datagrams a full socket buffer has dropped are not waited for
+            timer.expires_after(std::chrono::milliseconds(200));
+            timer.async_wait([&](const boost::system::error_code& ec) {
+                if (!ec) {
+                    lost += pending;
+                    pending = 0;
+                    sendWindow();
+                }
+            });
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        serve();
+        receive();
+        sendWindow();
+        ioContext.run();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const auto& stats = relay->stats();
+
+        std::cout << std::left
+            << std::setw(8) << batch
+            << std::setw(14) << static_cast<long>(received / seconds)
+            << std::setw(9) << lost
+            << std::setprecision(3) << static_cast<double>(stats.sent + stats.received) / stats.batches << '\n';
+    }
+
+};
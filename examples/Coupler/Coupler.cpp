@@ -1,6 +1,7 @@
 #include <iostream>
 #include "sari/asio/asio.h"
 #include "sari/stream/twowaystream.h"
+#include "sari/stream/memory_pipe.h"
 
 namespace asio = boost::asio;
 namespace Asio = Sari::Asio;
@@ -71,15 +72,15 @@ static Utils::Promise AsyncClient(std::shared_ptr<Stream> stream)
 
 int main()
 {
-    using PipeCoupler = Stream::TwoWayStream<boost::asio::readable_pipe, boost::asio::writable_pipe>;
+    using PipeCoupler = Stream::TwoWayStream<Stream::MemoryPipe>;
 
     asio::io_context ioContext;
 
     auto sourcePipe = std::make_shared<PipeCoupler>(ioContext);
     auto sinkPipe = std::make_shared<PipeCoupler>(ioContext);
 
-    boost::asio::connect_pipe(sourcePipe->writable_end(), sinkPipe->readable_end());
-    boost::asio::connect_pipe(sinkPipe->writable_end(), sourcePipe->readable_end());
+    Stream::ConnectPipe(sourcePipe->writable_end(), sinkPipe->readable_end());
+    Stream::ConnectPipe(sinkPipe->writable_end(), sourcePipe->readable_end());
 
     Utils::Promise echo = AsyncEcho(sourcePipe);
     Utils::Promise client = AsyncClient(sinkPipe);
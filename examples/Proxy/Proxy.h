@@ -3,7 +3,8 @@
 #include "sari/asio/asio.h"
 #include "sari/string/trim.h"
 #include "sari/utils/exchanger.h"
-#include "Sari/stream/twowaystream.h"
+#include "sari/stream/twowaystream.h"
+#include "sari/stream/memory_pipe.h"
 #include "sari/stream/transfer.h"
 
 class Proxy {
@@ -38,13 +39,13 @@ public:
                     });
             }).then([sock, &exchanger](std::string command) {
 
-                using TwoWayPipe = Stream::TwoWayStream<boost::asio::readable_pipe, boost::asio::writable_pipe>;
+                using TwoWayPipe = Stream::TwoWayStream<Stream::MemoryPipe>;
 
                 auto sourcePipe = std::make_shared<TwoWayPipe>(sock->get_executor());
                 auto sinkPipe = std::make_shared<TwoWayPipe>(sock->get_executor());
 
-                boost::asio::connect_pipe(sourcePipe->writable_end(), sinkPipe->readable_end());
-                boost::asio::connect_pipe(sinkPipe->writable_end(), sourcePipe->readable_end());
+                Stream::ConnectPipe(sourcePipe->writable_end(), sinkPipe->readable_end());
+                Stream::ConnectPipe(sinkPipe->writable_end(), sourcePipe->readable_end());
 
                 auto trans = std::make_shared<Utils::Exchanger::Transaction>(sock->get_executor());
 
@@ -1,40 +1,186 @@
 // Socks5Server.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
+// Usage: Socks5Server [port | unix:<path> | abstract:<name>] [credentials file | -] [rules file]
+//
+// With a credentials file of lines username:password clients must log in. With a rules file of
+// lines allow|deny <address, network or domain> and default allow|deny the destinations are
+// checked against the rules. SIGHUP reloads both files, SIGUSR1 prints the destinations of the
+// most connections.
 
+#include <csignal>
+#include <functional>
+#include <iomanip>
 #include <iostream>
-#include "Server.h"
+#include <memory>
+#include <string>
+#include "sari/net/server.h"
 #include "Socks5Server.h"
 
+namespace Net = Sari::Net;
 namespace Asio = Sari::Asio;
 namespace Utils = Sari::Utils;
 namespace Stream = Sari::Stream;
 
+template<typename Socket>
+static void HandleConnection(
+    const boost::system::error_code& ec, Socket peer, const Socks5ServerOptions& options
+)
+{
+    if (ec) {
+        std::cerr << ec.category().name() << " error: " << ec.message() << '\n';
+        return;
+    }
+
+    Socks5Server(std::move(peer), options)
+        .fail([](const boost::system::error_code ec) {
+            std::cerr << ec.category().name() << " error: " << ec.message() << '\n';
+        }).fail([](const std::exception& e) {
+            std::cerr << "error: " << e.what() << '\n';
+        }).fail([]() {
+            std::cerr << "an unknown error occurred\n";
+        });
+}
+
+static void PrintMetrics(const Sari::Socks5::DestinationMetrics& metrics)
+{
+    std::cout << metrics.connections() << " connections\n"
+        << "destination                               connections  refused  failed  KiB sent  KiB received  connect ms\n";
+
+    for (const auto& entry : metrics.top(20)) {
+
+        std::uint64_t failed = 0;
+        for (std::size_t reply = 0; reply < entry.replies.size(); ++reply) {
+            failed += reply == 0 || reply == 2 ? 0 : entry.replies[reply];
+        }
+
+        std::cout << std::left << std::setw(42) << entry.destination
+            << std::setw(13) << (entry.error ? "~" : "") + std::to_string(entry.connections)
+            << std::setw(9) << entry.replies[2]
+            << std::setw(8) << failed
+            << std::setw(10) << entry.bytesSent / 1024
+            << std::setw(14) << entry.bytesReceived / 1024
+            << std::chrono::duration<double, std::milli>(entry.meanConnectTime()).count() << '\n';
+    }
+
+    std::cout.flush();
+}
+
 int main(int argc, char* argv[])
 {
     using Sari::Utils::Promise;
- 
+
     boost::asio::io_context ioContext;
 
     try {
 
-        Server server(
-            ioContext, 1234,
-            [](const boost::system::error_code& ec, boost::asio::ip::tcp::socket peer) {
+        std::string address = argc > 1 ? argv[1] : "1234";
+
+        std::unique_ptr<Sari::Socks5::CredentialStore> credentials;
+        std::unique_ptr<Sari::Socks5::Authenticator> authenticator;
+        std::unique_ptr<Sari::Socks5::AccessControl> accessControl;
+        Sari::Socks5::DestinationMetrics metrics;
+        // loads the files off the I/O thread
+        boost::asio::thread_pool reloader(1);
+        boost::asio::signal_set signals(ioContext);
+        std::function<void()> reloadOnSignal;
+
+        if (argc > 2 && std::string(argv[2]) != "-") {
+
+            credentials = std::make_unique<Sari::Socks5::CredentialStore>(argv[2]);
+            authenticator = std::make_unique<Sari::Socks5::IndexAuthenticator>(*credentials);
+
+            std::cout << credentials->index()->size() << " users\n";
+        }
+
+        if (argc > 3) {
+            accessControl = std::make_unique<Sari::Socks5::AccessControl>(Sari::Socks5::AccessPolicy::Load(argv[3]));
+        }
 
+#if defined(SIGHUP)
+        reloadOnSignal = [&]() {
+            signals.async_wait([&](const boost::system::error_code& ec, int) {
                 if (ec) {
-                    std::cerr << ec.category().name() << " error: " << ec.message() << '\n';
                     return;
                 }
-
-                Socks5Server(std::move(peer))
-                    .fail([](const boost::system::error_code ec) {
-                        std::cerr << ec.category().name() << " error: " << ec.message() << '\n';
-                    }).fail([](const std::exception& e) {
-                        std::cerr << "error: " << e.what() << '\n';
-                    }).fail([]() {
-                        std::cerr << "an unknown error occurred\n";
+                if (credentials) {
+                    credentials->reload(ioContext.get_executor(), reloader.get_executor())
+                        .then([](std::size_t users) {
+                            std::cout << "reloaded " << users << " users\n";
+                        }).fail([](const std::runtime_error& e) {
+                            std::cerr << "error: " << e.what() << '\n';
+                        });
+                }
+                if (accessControl) {
+                    // the previous rules keep serving if the new ones cannot be loaded
+                    boost::asio::post(reloader, [&accessControl, path = std::string(argv[3])]() {
+                        try {
+                            accessControl->update(Sari::Socks5::AccessPolicy::Load(path));
+                            std::cout << "reloaded the rules\n";
+                        }
+                        catch (const std::exception& e) {
+                            std::cerr << "error: " << e.what() << '\n';
+                        }
                     });
+                }
+                reloadOnSignal();
+            });
+        };
+
+        if (credentials || accessControl) {
+            signals.add(SIGHUP);
+            reloadOnSignal();
+        }
+#endif
+
+#if defined(SIGUSR1)
+        boost::asio::signal_set printSignals(ioContext, SIGUSR1);
+        std::function<void()> printOnSignal = [&]() {
+            printSignals.async_wait([&](const boost::system::error_code& ec, int) {
+                if (!ec) {
+                    PrintMetrics(metrics);
+                    printOnSignal();
+                }
+            });
+        };
+
+        printOnSignal();
+#endif
+
+        Socks5ServerOptions options;
+        options.authenticator = authenticator.get();
+        options.accessControl = accessControl.get();
+        options.metrics = &metrics;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        if (address.rfind("unix:", 0) == 0 || address.rfind("abstract:", 0) == 0) {
+
+            using LocalSocket = boost::asio::local::stream_protocol::socket;
+
+            auto endpoint = address.rfind("unix:", 0) == 0
+                ? Net::LocalEndpoint(address.substr(5))
+                : Net::AbstractLocalEndpoint(address.substr(9));
+
+            Net::LocalServer server(ioContext, endpoint, [&](const boost::system::error_code& ec, LocalSocket peer) {
+                HandleConnection(ec, std::move(peer), options);
+            });
+
+            ioContext.run();
+
+            return 0;
+        }
+#endif
+
+        // the listeners of BIND requests
+        Sari::Socks5::ListenerPool bindListeners(
+            ioContext.get_executor(), boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::any(), 0), 16
+        );
+
+        options.bindListeners = &bindListeners;
 
+        Net::Server server(
+            ioContext, static_cast<unsigned short>(std::stoul(address)),
+            [&](const boost::system::error_code& ec, boost::asio::ip::tcp::socket peer) {
+                HandleConnection(ec, std::move(peer), options);
             }
         );
 
@@ -45,4 +191,4 @@ int main(int argc, char* argv[])
     }
 
     return 0;
-}
\ No newline at end of file
+}
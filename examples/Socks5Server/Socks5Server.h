@@ -1,25 +1,182 @@
 #pragma once
 
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+#include "sari/socks5/access_policy.h"
+#include "sari/socks5/auth.h"
+#include "sari/socks5/bind.h"
+#include "sari/socks5/metrics.h"
 #include "sari/socks5/socks5.h"
-#include "sari/stream/forward.h"
+#include "sari/socks5/udp_relay.h"
+#include "sari/stream/transfer.h"
 
-template<typename Stream>
-Sari::Utils::Promise Socks5Server(Stream&& sock)
+// The optional services of the server, each one is off without it.
+struct Socks5ServerOptions {
+    // serves the BIND requests of TCP clients, they are refused without it
+    Sari::Socks5::ListenerPool* bindListeners = nullptr;
+    // clients must log in with a username and a password
+    Sari::Socks5::Authenticator* authenticator = nullptr;
+    // the destinations of CONNECT and the peers of BIND requests its current policy denies are
+    // refused, and so are the addresses a destination name resolves to, the datagrams of UDP
+    // clients to the destinations it denies are dropped
+    const Sari::Socks5::AccessControl* accessControl = nullptr;
+    // records every CONNECT request once its connection has ended
+    Sari::Socks5::DestinationMetrics* metrics = nullptr;
+};
+
+// Forwards the data between the client and the host it has connected to, the data the client
+// has sent along with its request first. Resolves with the Stats of the transfer.
+template<typename Socket>
+Sari::Utils::Promise Socks5Forward(
+    std::shared_ptr<Socket> iSock, std::shared_ptr<boost::asio::ip::tcp::socket> oSock, std::shared_ptr<Sari::Socks5::RecvBuffer> buffer
+)
 {
     namespace Asio = Sari::Asio;
+    using Sari::Utils::Promise;
+
+    Promise pipelined = buffer->empty()
+        ? Promise::Resolve(iSock->get_executor())
+        : Asio::AsyncWrite(*oSock, std::string(reinterpret_cast<const char*>(buffer->data()), buffer->size()));
+
+    return pipelined.then([iSock, oSock]() {
+        return Sari::Stream::Transfer::Forward(*iSock, *oSock)
+            .then([iSock, oSock](Sari::Stream::Transfer::Stats stats) {
+                return stats;
+            });
+    });
+}
+
+// Refuses the command with the reply and closes the connection.
+template<typename Socket>
+Sari::Utils::Promise Socks5Refuse(std::shared_ptr<Socket> iSock, Sari::Socks5::CommandReply cmdReply, Socks5Errc errc)
+{
+    namespace Socks5 = Sari::Socks5;
+    using Sari::Utils::Promise;
+
+    return Socks5::AsyncSendCommandReply(*iSock, cmdReply)
+        .then([iSock, errc]() {
+
+            iSock->shutdown(Socket::shutdown_both);
+            iSock->close();
+
+            return Promise::Reject(iSock->get_executor(), make_error_code(errc));
+        });
+}
+
+// Connects to the destination of a CONNECT request and forwards the data both ways. The
+// addresses a domain name resolves to which the policy, if any, denies are skipped, so a name
+// cannot lead to a denied network. The connection is recorded in the metrics, if any, once it
+// has ended.
+template<typename Socket>
+Sari::Utils::Promise Socks5Connect(
+    std::shared_ptr<Socket> iSock, std::shared_ptr<Sari::Socks5::RecvBuffer> buffer, Sari::Socks5::CommandRequest cmdReq,
+    std::shared_ptr<const Sari::Socks5::AccessPolicy> policy, Sari::Socks5::DestinationMetrics* metrics
+)
+{
     namespace Socks5 = Sari::Socks5;
     using Sari::Utils::Promise;
+    using Clock = Socks5::DestinationMetrics::Clock;
 
-    auto iSock = std::make_shared<boost::asio::ip::tcp::socket>(std::move(sock));
+    auto start = Clock::now();
     auto oSock = std::make_shared<boost::asio::ip::tcp::socket>(iSock->get_executor());
-    
+
+    Promise promise;
+
+    if (cmdReq.dest().getAddrType() == Socks5::AddressType::DomainName) {
+
+        auto domainResolver = std::make_shared<boost::asio::ip::tcp::resolver>(iSock->get_executor());
+
+        boost::asio::ip::tcp::resolver::query query(
+            cmdReq.dest().getDomainName(), std::to_string(cmdReq.dest().getPort())
+        );
+
+        promise = Sari::Asio::AsyncResolve(*domainResolver, query)
+            .then([domainResolver, oSock, policy](boost::asio::ip::tcp::resolver::iterator it) {
+
+                if (!policy) {
+                    return Sari::Asio::AsyncConnectEndpoints(*oSock, it);
+                }
+
+                std::vector<boost::asio::ip::tcp::endpoint> allowed;
+
+                for (; it != boost::asio::ip::tcp::resolver::iterator(); ++it) {
+                    if (policy->evaluate(it->endpoint().address()) == Socks5::AccessPolicy::Action::Allow) {
+                        allowed.push_back(it->endpoint());
+                    }
+                }
+
+                if (allowed.empty()) {
+                    return Promise::Reject(oSock->get_executor(), make_error_code(Socks5Errc::ConnectionNotAllowed));
+                }
+
+                return Sari::Asio::AsyncConnectSequence(*oSock, allowed);
+            });
+    }
+    else {
+        promise = Sari::Asio::AsyncConnect(
+            *oSock, cmdReq.dest().getEndpoint()
+        );
+    }
+
+    return Promise::AllSettled(iSock->get_executor(), { promise })
+        .then([iSock, oSock, buffer, cmdReq, metrics, start](Promise p) mutable {
+
+            Socks5::DestinationMetrics::Connection connection;
+            connection.connectTime = Clock::now() - start;
+
+            if (!p.isFulfilled()) {
+
+                bool denied = !p.result().empty() && p.result(0).type() == typeid(boost::system::error_code)
+                    && p.result<boost::system::error_code>(0) == make_error_code(Socks5Errc::ConnectionNotAllowed);
+
+                auto reply = denied ? Socks5::Reply::ConnectionNoAllowed : Socks5::Reply::HostUnreachable;
+
+                if (metrics) {
+                    connection.reply = reply;
+                    metrics->record(cmdReq.getRaw().dest, connection);
+                }
+                return Socks5Refuse(
+                    iSock, Socks5::CommandReply{ reply, cmdReq.dest().getAddr() },
+                    denied ? Socks5Errc::ConnectionNotAllowed : Socks5Errc::HostUnreachable
+                );
+            }
+
+            return Socks5::AsyncSendCommandReply(*iSock, Socks5::CommandReply{ Socks5::Reply::Succeeded, oSock->remote_endpoint() })
+                .then([iSock, oSock, buffer]() {
+                    return Socks5Forward(iSock, oSock, buffer);
+                }).then([cmdReq, metrics, connection](Sari::Stream::Transfer::Stats stats) mutable {
+                    if (metrics) {
+                        connection.bytesSent = stats.directions[0].bytes;
+                        connection.bytesReceived = stats.directions[1].bytes;
+                        metrics->record(cmdReq.getRaw().dest, connection);
+                    }
+                });
+        });
+}
+
+// Serves a SOCKS5 client connected through a TCP or a Unix domain socket with the services of
+// the options.
+template<typename Stream>
+Sari::Utils::Promise Socks5Server(Stream&& sock, const Socks5ServerOptions& options = Socks5ServerOptions())
+{
+    namespace Asio = Sari::Asio;
+    namespace Socks5 = Sari::Socks5;
+    using Sari::Utils::Promise;
+    using Socket = std::decay_t<Stream>;
+
+    auto iSock = std::make_shared<Socket>(std::move(sock));
+    // the handshake is parsed from whatever the reads return, a client may pipeline its messages
+    auto buffer = std::make_shared<Socks5::RecvBuffer>();
+    auto authenticator = options.authenticator;
+
     return Promise::Resolve(iSock->get_executor())
-        .then([iSock]() {
-            return Asio::AsyncDeadline(Socks5::AsyncRecvMethodRequest(*iSock), boost::asio::chrono::seconds(15));
+        .then([iSock, buffer]() {
+            return Asio::AsyncDeadline(Socks5::AsyncRecvMethodRequest(*iSock, *buffer), boost::asio::chrono::seconds(15));
         })
-        .then([iSock](Socks5::MethodRequest methReq) {
+        .then([iSock, buffer, authenticator](Socks5::MethodRequest methReq) {
 
-            Socks5::Method method = Socks5::Method::NoAuthRequired;
+            Socks5::Method method = authenticator ? Socks5::Method::UsernamePassword : Socks5::Method::NoAuthRequired;
 
             if (!methReq.contains(method)) {
                 method = Socks5::Method::NoAcceptableMethods;
@@ -28,79 +185,79 @@ Sari::Utils::Promise Socks5Server(Stream&& sock)
             Socks5::MethodReply methReply{ method };
 
             return Socks5::AsyncSendMethodReply(*iSock, methReply)
-                .then([iSock, method]() {
+                .then([iSock, buffer, authenticator, method]() {
                     if (method == Socks5::Method::NoAcceptableMethods) {
 
-                        iSock->shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+                        iSock->shutdown(Socket::shutdown_both);
                         iSock->close();
 
                         return Promise::Reject(
                             iSock->get_executor(), make_error_code(Socks5Errc::NoAcceptableMethods)
                         );
                     }
-                    return Asio::AsyncDeadline(
-                        Socks5::AsyncRecvCommandRequest(*iSock),
-                        boost::asio::chrono::seconds(15)
-                    );
-                });
 
-        }).then([iSock, oSock](Socks5::CommandRequest cmdReq){
-                    
-            if (cmdReq.getCmd() != Socks5::Command::Connect) {
+                    Promise authenticated = method == Socks5::Method::UsernamePassword
+                        ? Asio::AsyncDeadline(Socks5::AsyncAuthenticate(*iSock, *buffer, *authenticator), boost::asio::chrono::seconds(15))
+                        : Promise::Resolve(iSock->get_executor());
 
-                Socks5::CommandReply cmdReply{
-                    Socks5::Reply::CommandNotSupported, cmdReq.dest().getAddr()
-                };
-                        
-                return Promise::Resolve(iSock->get_executor(), cmdReply);
-            }
-
-            Promise promise;
+                    return authenticated.then([iSock, buffer]() {
+                        return Asio::AsyncDeadline(
+                            Socks5::AsyncRecvCommandRequest(*iSock, *buffer),
+                            boost::asio::chrono::seconds(15)
+                        );
+                    });
+                });
 
-            if (cmdReq.dest().getAddrType() == Socks5::AddressType::DomainName) {
+        }).then([iSock, buffer, options](Socks5::CommandRequest cmdReq) {
 
-                auto domainResolver = std::make_shared<boost::asio::ip::tcp::resolver>(iSock->get_executor());
+            // the destination of a UDP ASSOCIATE request is the client itself
+            if (options.accessControl && cmdReq.getCmd() != Socks5::Command::UDP) {
 
-                boost::asio::ip::tcp::resolver::query query(
-                    cmdReq.dest().getDomainName(), std::to_string(cmdReq.dest().getPort())
-                );
+                Socks5::Reply reply = options.accessControl->policy()->check(cmdReq.getRaw().dest);
 
-                promise = Sari::Asio::AsyncResolve(*domainResolver, query)
-                    .then([domainResolver, oSock](boost::asio::ip::tcp::resolver::iterator it) {
-                        return Sari::Asio::AsyncConnectEndpoints(*oSock, it);
-                    });
-            }
-            else {
-                promise = Sari::Asio::AsyncConnect(
-                    *oSock, cmdReq.dest().getEndpoint()
-                );
+                if (reply != Socks5::Reply::Succeeded) {
+                    if (options.metrics && cmdReq.getCmd() == Socks5::Command::Connect) {
+                        Socks5::DestinationMetrics::Connection connection;
+                        connection.reply = reply;
+                        options.metrics->record(cmdReq.getRaw().dest, connection);
+                    }
+                    return Socks5Refuse(
+                        iSock, Socks5::CommandReply{ reply, cmdReq.dest().getAddr() }, Socks5Errc::ConnectionNotAllowed
+                    );
+                }
             }
 
-            promise.then([oSock]() {
-                return Socks5::CommandReply{
-                    Socks5::Reply::Succeeded, oSock->remote_endpoint()
-                };
-            }).fail([cmdReq]() mutable {
-                return Socks5::CommandReply{
-                    Socks5::Reply::HostUnreachable, cmdReq.dest().getAddr()
-                };
-            });
-
-            return promise;
-        }).then([iSock, oSock](Socks5::CommandReply cmdReply) {
-            return Socks5::AsyncSendCommandReply(*iSock, cmdReply)
-                .then([iSock, oSock, reply = cmdReply.getReply()]() {
-                    if (reply != Socks5::Reply::Succeeded) {
-
-                        iSock->shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-                        iSock->close();
+            switch (cmdReq.getCmd()) {
+                case Socks5::Command::Connect:
+                    return Socks5Connect(
+                        iSock, buffer, cmdReq, options.accessControl ? options.accessControl->policy() : nullptr, options.metrics
+                    );
+                case Socks5::Command::Bind:
+                    if constexpr (std::is_same_v<Socket, boost::asio::ip::tcp::socket>) {
+                        if (options.bindListeners) {
+                            return Socks5::AsyncBind(*iSock, cmdReq, *options.bindListeners)
+                                .then([iSock, buffer](std::shared_ptr<boost::asio::ip::tcp::socket> peer) {
+                                    return Socks5Forward(iSock, peer, buffer);
+                                });
+                        }
+                    }
+                    break;
+                case Socks5::Command::UDP:
+                    // the relay is opened on the address of a TCP connection
+                    if constexpr (std::is_same_v<Socket, boost::asio::ip::tcp::socket>) {
+                        Socks5::UdpRelay::Options relayOptions;
+                        relayOptions.accessControl = options.accessControl;
 
-                        return Promise::Reject(
-                            iSock->get_executor(), make_error_code(Socks5Errc::HostUnreachable)
-                        );
+                        return Socks5::AsyncUdpAssociate(*iSock, cmdReq, relayOptions)
+                            .then([iSock](Socks5::UdpRelay::Stats) {});
                     }
-                    return Sari::Stream::Forward(*iSock, *oSock)
-                        .then([iSock, oSock]() {});
-                }); 
+                    break;
+                default:
+                    break;
+            }
+
+            return Socks5Refuse(
+                iSock, Socks5::CommandReply{ Socks5::Reply::CommandNotSupported, cmdReq.dest().getAddr() }, Socks5Errc::CommandNotSupported
+            );
         });
-}
\ No newline at end of file
+}